@@ -0,0 +1,528 @@
+/*
+ * WebP Converter - Animated WebP encoder implementation
+ *
+ * stb_image hands over every GIF frame fully composed, so frame i only
+ * depends on canvases i-1 and i, and all frames can be diffed and
+ * encoded at once. Workers claim frames from an atomic counter; each one
+ * finds the rectangle that changed since the previous canvas, encodes
+ * it (pixels that did not change made transparent and blended over the
+ * previous frame when possible), and keeps the smallest of the
+ * candidates allowed: full frames for keyframes and, with minimize_size,
+ * for any frame; lossy and lossless with best_of. Frames identical to
+ * the previous one are merged into it. The container is then written in
+ * order, reusing each frame's ALPH/VP8/VP8L chunks as they are.
+ */
+
+#include "anim.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* GIF delays up to ANIM_MIN_DELAY_MS are shown as ANIM_DEFAULT_DELAY_MS by browsers */
+#define ANIM_MIN_DELAY_MS 10
+#define ANIM_DEFAULT_DELAY_MS 100
+
+/* Largest frame duration an ANMF chunk holds (24 bits) */
+#define ANIM_MAX_DURATION 0xFFFFFF
+
+/* ANIM background colour, as the canvas is cleared to by viewers that use it */
+#define ANIM_BACKGROUND 0xFFFFFFFFu
+
+/* Container chunk sizes */
+#define RIFF_HEADER_SIZE 12
+#define CHUNK_HEADER_SIZE 8
+#define VP8X_SIZE 10
+#define ANIM_SIZE 6
+#define ANMF_HEADER_SIZE 16
+
+/* Growable encoded frame */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} FrameOutput;
+
+/* One frame as it will be written */
+typedef struct {
+    FrameOutput output;     /* Single-image WebP of the frame's rectangle */
+    int x, y;               /* Rectangle on the canvas (even) */
+    int width, height;
+    bool blend;             /* Alpha-blend over the previous canvas */
+    bool lossless;
+    bool merged;            /* Same as the previous canvas: its time goes to that frame */
+    bool ok;
+} AnimFrame;
+
+/* Work shared by the frame workers */
+typedef struct {
+    const ImageData *image;
+    const WebPConfig *config;
+    const ConversionParams *params;
+    const ConversionProgress *progress;
+    AnimFrame *frames;
+    atomic_int next;        /* Next frame to claim */
+    atomic_int done;        /* Frames finished */
+    atomic_bool failed;
+    int trace_file;
+} AnimJob;
+
+typedef struct {
+    AnimJob *job;
+    uint32_t *scratch;      /* Rectangle being encoded */
+    size_t scratch_capacity;
+    size_t held;            /* Most scratch and picture memory held at once */
+    double prepare_ms;
+    bool report;            /* The calling thread: reports progress */
+    pthread_t thread;
+    bool threaded;
+} AnimWorker;
+
+static bool anim_cancelled(const ConversionProgress *progress) {
+    return progress && progress->cancel &&
+           atomic_load_explicit(progress->cancel, memory_order_relaxed);
+}
+
+static int frame_output_write(const uint8_t *data, size_t data_size, const WebPPicture *picture) {
+    FrameOutput *out = (FrameOutput *)picture->custom_ptr;
+
+    if (out->size + data_size > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity * 2 : 16 * 1024;
+        while (capacity < out->size + data_size) capacity *= 2;
+        unsigned char *grown = realloc(out->data, capacity);
+        if (!grown) return 0;
+        out->data = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->size, data, data_size);
+    out->size += data_size;
+    return 1;
+}
+
+/* WebPProgressHook: abort once the conversion is cancelled */
+static int frame_progress(int percent, const WebPPicture *picture) {
+    (void)percent;
+    return !anim_cancelled((const ConversionProgress *)picture->user_data);
+}
+
+static const uint32_t* canvas(const ImageData *image, int frame) {
+    return (const uint32_t *)(image->data + (size_t)frame * image->width * image->height * 4);
+}
+
+/*
+ * Rectangle of canvas i that differs from canvas i-1, widened to even x
+ * and y as ANMF offsets require. Returns false if nothing changed.
+ * *opaque tells whether every changed pixel is opaque, which blending
+ * needs.
+ */
+static bool changed_rect(const ImageData *image, int i, int *rx, int *ry, int *rw, int *rh,
+                         bool *opaque) {
+    const uint32_t *prev = canvas(image, i - 1);
+    const uint32_t *cur = canvas(image, i);
+    int width = image->width;
+    int left = width, right = -1, top = -1, bottom = -1;
+    bool all_opaque = true;
+
+    for (int y = 0; y < image->height; y++) {
+        const uint32_t *p = prev + (size_t)y * width;
+        const uint32_t *c = cur + (size_t)y * width;
+        if (memcmp(p, c, (size_t)width * 4) == 0) continue;
+
+        if (top < 0) top = y;
+        bottom = y;
+        for (int x = 0; x < width; x++) {
+            if (p[x] == c[x]) continue;
+            if (x < left) left = x;
+            if (x > right) right = x;
+            if (((const uint8_t *)&c[x])[3] != 255) all_opaque = false;
+        }
+    }
+    if (top < 0) return false;
+
+    left &= ~1;
+    top &= ~1;
+    *rx = left;
+    *ry = top;
+    *rw = right - left + 1;
+    *rh = bottom - top + 1;
+    *opaque = all_opaque;
+    return true;
+}
+
+static bool reserve_scratch(AnimWorker *worker, size_t pixels) {
+    if (worker->scratch_capacity >= pixels) return true;
+    uint32_t *grown = realloc(worker->scratch, pixels * sizeof(uint32_t));
+    if (!grown) return false;
+    worker->scratch = grown;
+    worker->scratch_capacity = pixels;
+    return true;
+}
+
+/* Encode RGBA pixels (stride in pixels) into out; false if failed or cancelled */
+static bool encode_rect(AnimWorker *worker, const WebPConfig *config, const uint32_t *pixels,
+                        int stride, int width, int height, FrameOutput *out) {
+    const AnimJob *job = worker->job;
+    WebPPicture picture;
+    if (!WebPPictureInit(&picture)) return false;
+
+    picture.use_argb = config->lossless;
+    picture.width = width;
+    picture.height = height;
+
+    double start = converter_now_ms();
+    TraceSpan span = trace_begin(TRACE_IMPORT);
+    bool ok = WebPPictureImportRGBA(&picture, (const uint8_t *)pixels, stride * 4) != 0;
+    trace_end(span);
+    worker->prepare_ms += converter_now_ms() - start;
+
+    if (ok) {
+        out->size = 0;
+        picture.writer = frame_output_write;
+        picture.custom_ptr = out;
+        picture.progress_hook = frame_progress;
+        picture.user_data = (void *)job->progress;
+        span = trace_begin(TRACE_ENCODE);
+        ok = WebPEncode(config, &picture) != 0;
+        trace_end(span);
+    }
+
+    size_t held = worker->scratch_capacity * sizeof(uint32_t) +
+                  (size_t)width * height * (config->lossless ? 4 : 2);
+    if (held > worker->held) worker->held = held;
+    WebPPictureFree(&picture);
+    return ok;
+}
+
+/* Encode candidate pixels lossy and/or lossless, keeping the smallest output in frame */
+static bool try_candidate(AnimWorker *worker, AnimFrame *frame, const uint32_t *pixels,
+                          int stride, int x, int y, int width, int height, bool blend) {
+    const AnimJob *job = worker->job;
+    int passes = job->params->best_of ? 2 : 1;
+
+    for (int pass = 0; pass < passes; pass++) {
+        WebPConfig config = *job->config;
+        config.thread_level = 0;        /* The frames are the parallelism */
+        if (job->params->best_of) {
+            config.lossless = pass;
+            config.quality = pass ? 100.0f : job->params->quality;
+        }
+        /* Blending relies on exact transparency for unchanged pixels */
+        if (blend) config.alpha_quality = 100;
+
+        FrameOutput candidate = { 0 };
+        if (!encode_rect(worker, &config, pixels, stride, width, height, &candidate)) {
+            free(candidate.data);
+            if (anim_cancelled(job->progress)) return false;
+            continue;
+        }
+        if (!frame->ok || candidate.size < frame->output.size) {
+            free(frame->output.data);
+            frame->output = candidate;
+            frame->x = x;
+            frame->y = y;
+            frame->width = width;
+            frame->height = height;
+            frame->blend = blend;
+            frame->lossless = config.lossless != 0;
+            frame->ok = true;
+        } else {
+            free(candidate.data);
+        }
+    }
+    return frame->ok;
+}
+
+static bool encode_frame(AnimWorker *worker, int i) {
+    const AnimJob *job = worker->job;
+    const ImageData *image = job->image;
+    AnimFrame *frame = &job->frames[i];
+    const uint32_t *cur = canvas(image, i);
+    int interval = job->params->keyframe_interval;
+    bool keyframe = i == 0 || (interval > 0 && i % interval == 0);
+
+    double start = converter_now_ms();
+    int x = 0, y = 0, width = image->width, height = image->height;
+    bool opaque = false;
+    if (i > 0 && !changed_rect(image, i, &x, &y, &width, &height, &opaque)) {
+        frame->merged = true;
+        frame->ok = true;
+        worker->prepare_ms += converter_now_ms() - start;
+        return true;
+    }
+
+    bool full = keyframe || job->params->minimize_size;
+    bool sub = !keyframe;
+
+    /* Sub-frame: unchanged pixels turn transparent and show the previous frame */
+    const uint32_t *sub_pixels = cur + (size_t)y * image->width + x;
+    int sub_stride = image->width;
+    if (sub && opaque) {
+        if (!reserve_scratch(worker, (size_t)width * height)) return false;
+        const uint32_t *prev = canvas(image, i - 1);
+        for (int row = 0; row < height; row++) {
+            size_t offset = (size_t)(y + row) * image->width + x;
+            uint32_t *dst = worker->scratch + (size_t)row * width;
+            for (int col = 0; col < width; col++) {
+                dst[col] = (cur[offset + col] == prev[offset + col]) ? 0 : cur[offset + col];
+            }
+        }
+        sub_pixels = worker->scratch;
+        sub_stride = width;
+    }
+    worker->prepare_ms += converter_now_ms() - start;
+
+    if (full && !try_candidate(worker, frame, cur, image->width, 0, 0,
+                               image->width, image->height, false)) {
+        return false;
+    }
+    if (sub && !try_candidate(worker, frame, sub_pixels, sub_stride, x, y, width, height,
+                              opaque)) {
+        return false;
+    }
+    return frame->ok;
+}
+
+static void* frame_worker(void *arg) {
+    AnimWorker *worker = arg;
+    AnimJob *job = worker->job;
+    int count = job->image->frames;
+
+    trace_set_file(job->trace_file);
+    for (;;) {
+        if (atomic_load(&job->failed) || anim_cancelled(job->progress)) break;
+        int i = atomic_fetch_add(&job->next, 1);
+        if (i >= count) break;
+
+        if (!encode_frame(worker, i)) {
+            atomic_store(&job->failed, true);
+            break;
+        }
+        int done = atomic_fetch_add(&job->done, 1) + 1;
+        if (worker->report && job->progress && job->progress->report) {
+            job->progress->report((float)done / count, job->progress->user_data);
+        }
+    }
+    return NULL;
+}
+
+static void* frame_thread_main(void *arg) {
+    trace_set_thread_name("frame encoder");
+    return frame_worker(arg);
+}
+
+static void put_le16(unsigned char *p, unsigned v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void put_le24(unsigned char *p, unsigned v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    put_le24(p, v);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * The ALPH/VP8/VP8L chunks of a single-image WebP, as one run of bytes
+ * (WebPEncode writes any VP8X chunk first and the image chunks last).
+ * *alpha tells whether the frame carries transparency.
+ */
+static bool image_chunks(const FrameOutput *output, const unsigned char **chunks,
+                         size_t *size, bool *alpha) {
+    size_t pos = RIFF_HEADER_SIZE;
+    *chunks = NULL;
+    *alpha = false;
+
+    while (pos + CHUNK_HEADER_SIZE <= output->size) {
+        const unsigned char *chunk = output->data + pos;
+        size_t padded = (get_le32(chunk + 4) + 1) & ~(size_t)1;
+        if (pos + CHUNK_HEADER_SIZE + padded > output->size) return false;
+
+        if (memcmp(chunk, "ALPH", 4) == 0 || memcmp(chunk, "VP8 ", 4) == 0 ||
+            memcmp(chunk, "VP8L", 4) == 0) {
+            if (!*chunks) *chunks = chunk;
+            if (memcmp(chunk, "ALPH", 4) == 0) *alpha = true;
+            /* VP8L header: signature, 14+14 bits of size, then alpha_is_used */
+            if (memcmp(chunk, "VP8L", 4) == 0 && padded >= 5 && (chunk[12] & 0x10)) *alpha = true;
+        }
+        pos += CHUNK_HEADER_SIZE + padded;
+    }
+    if (!*chunks) return false;
+    *size = output->data + output->size - *chunks;
+    return true;
+}
+
+/* Display time of frame i in ms, as browsers show GIF delays */
+static unsigned frame_delay(const ImageData *image, int i) {
+    int delay = image->delays ? image->delays[i] : ANIM_DEFAULT_DELAY_MS;
+    return (delay <= ANIM_MIN_DELAY_MS) ? ANIM_DEFAULT_DELAY_MS : (unsigned)delay;
+}
+
+/* Lay out VP8X, ANIM and one ANMF chunk per written frame */
+static bool write_container(const ImageData *image, AnimFrame *frames, AnimResult *result) {
+    int count = image->frames;
+
+    /* Merged frames lengthen the frame before them */
+    unsigned *durations = calloc((size_t)count, sizeof(unsigned));
+    if (!durations) return false;
+    int last = 0;
+    for (int i = 0; i < count; i++) {
+        if (!frames[i].merged) last = i;
+        unsigned long total = (unsigned long)durations[last] + frame_delay(image, i);
+        durations[last] = total > ANIM_MAX_DURATION ? ANIM_MAX_DURATION : (unsigned)total;
+    }
+
+    size_t size = RIFF_HEADER_SIZE + CHUNK_HEADER_SIZE + VP8X_SIZE + CHUNK_HEADER_SIZE + ANIM_SIZE;
+    bool alpha = false;
+    for (int i = 0; i < count; i++) {
+        if (frames[i].merged) continue;
+        const unsigned char *chunks;
+        size_t chunks_size;
+        bool frame_alpha;
+        if (!image_chunks(&frames[i].output, &chunks, &chunks_size, &frame_alpha)) {
+            free(durations);
+            return false;
+        }
+        alpha |= frame_alpha;
+        size += CHUNK_HEADER_SIZE + ANMF_HEADER_SIZE + chunks_size;
+    }
+    if (size - CHUNK_HEADER_SIZE > UINT32_MAX) {
+        free(durations);
+        return false;
+    }
+
+    unsigned char *data = malloc(size);
+    if (!data) {
+        free(durations);
+        return false;
+    }
+
+    unsigned char *p = data;
+    memcpy(p, "RIFF", 4);
+    put_le32(p + 4, (uint32_t)(size - CHUNK_HEADER_SIZE));
+    memcpy(p + 8, "WEBP", 4);
+    p += RIFF_HEADER_SIZE;
+
+    memcpy(p, "VP8X", 4);
+    put_le32(p + 4, VP8X_SIZE);
+    memset(p + 8, 0, 4);
+    p[8] = 0x02 | (alpha ? 0x10 : 0);   /* Animation, alpha */
+    put_le24(p + 12, (unsigned)image->width - 1);
+    put_le24(p + 15, (unsigned)image->height - 1);
+    p += CHUNK_HEADER_SIZE + VP8X_SIZE;
+
+    memcpy(p, "ANIM", 4);
+    put_le32(p + 4, ANIM_SIZE);
+    put_le32(p + 8, ANIM_BACKGROUND);
+    put_le16(p + 12, (unsigned)image->loops);
+    p += CHUNK_HEADER_SIZE + ANIM_SIZE;
+
+    result->frames = 0;
+    result->lossless = true;
+    for (int i = 0; i < count; i++) {
+        const AnimFrame *frame = &frames[i];
+        if (frame->merged) continue;
+
+        const unsigned char *chunks;
+        size_t chunks_size;
+        bool frame_alpha;
+        image_chunks(&frame->output, &chunks, &chunks_size, &frame_alpha);
+
+        memcpy(p, "ANMF", 4);
+        put_le32(p + 4, (uint32_t)(ANMF_HEADER_SIZE + chunks_size));
+        put_le24(p + 8, (unsigned)frame->x / 2);
+        put_le24(p + 11, (unsigned)frame->y / 2);
+        put_le24(p + 14, (unsigned)frame->width - 1);
+        put_le24(p + 17, (unsigned)frame->height - 1);
+        put_le24(p + 20, durations[i]);
+        p[23] = frame->blend ? 0x00 : 0x02;  /* Blend or not; never dispose */
+        memcpy(p + CHUNK_HEADER_SIZE + ANMF_HEADER_SIZE, chunks, chunks_size);
+        p += CHUNK_HEADER_SIZE + ANMF_HEADER_SIZE + chunks_size;
+
+        result->frames++;
+        if (!frame->lossless) result->lossless = false;
+    }
+    free(durations);
+
+    result->data = data;
+    result->size = size;
+    return true;
+}
+
+bool anim_encode(const ImageData *image, const WebPConfig *config,
+                 const ConversionParams *params, int threads,
+                 const ConversionProgress *progress, AnimResult *result) {
+    memset(result, 0, sizeof(AnimResult));
+    if (!image || !image->data || image->channels != 4 || image->frames < 1 ||
+        !config || !params) {
+        return false;
+    }
+
+    int count = image->frames;
+    AnimFrame *frames = calloc((size_t)count, sizeof(AnimFrame));
+    if (!frames) return false;
+
+    AnimJob job = {
+        .image = image,
+        .config = config,
+        .params = params,
+        .progress = progress,
+        .frames = frames,
+        .trace_file = trace_current_file()
+    };
+    atomic_init(&job.next, 0);
+    atomic_init(&job.done, 0);
+    atomic_init(&job.failed, false);
+
+    int workers = threads < count ? threads : count;
+    if (workers < 1) workers = 1;
+    AnimWorker *pool = calloc((size_t)workers, sizeof(AnimWorker));
+    if (!pool) {
+        free(frames);
+        return false;
+    }
+    for (int w = 0; w < workers; w++) {
+        pool[w].job = &job;
+        pool[w].report = w == 0;
+    }
+    for (int w = 1; w < workers; w++) {
+        pool[w].threaded = pthread_create(&pool[w].thread, NULL, frame_thread_main, &pool[w]) == 0;
+    }
+    frame_worker(&pool[0]);
+    for (int w = 1; w < workers; w++) {
+        if (pool[w].threaded) pthread_join(pool[w].thread, NULL);
+    }
+
+    /* Workers that could not be started leave frames unclaimed: finish them here */
+    if (!atomic_load(&job.failed)) frame_worker(&pool[0]);
+
+    size_t held = (size_t)count * image->width * image->height * 4;
+    for (int w = 0; w < workers; w++) {
+        result->prepare_ms += pool[w].prepare_ms / workers;
+        held += pool[w].held;
+        free(pool[w].scratch);
+    }
+    free(pool);
+
+    bool ok = false;
+    result->cancelled = anim_cancelled(progress);
+    if (!result->cancelled && !atomic_load(&job.failed)) {
+        for (int i = 0; i < count; i++) held += frames[i].output.capacity;
+        ok = write_container(image, frames, result);
+        result->peak_bytes = held + result->size;
+    }
+
+    for (int i = 0; i < count; i++) free(frames[i].output.data);
+    free(frames);
+    return ok;
+}
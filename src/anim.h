@@ -0,0 +1,37 @@
+/*
+ * WebP Converter - Animated WebP encoder
+ * Turns the composed frames of an animated GIF into an animated WebP.
+ * Each frame is diffed against the one before it and encoded on its
+ * own, so frames are spread over the cores; the ANIM/ANMF container is
+ * then assembled in frame order.
+ */
+
+#ifndef ANIM_H
+#define ANIM_H
+
+#include "converter.h"
+#include <webp/encode.h>
+
+/* An encoded animation */
+typedef struct {
+    unsigned char *data;    /* The whole .webp file (free() it) */
+    size_t size;
+    int frames;             /* Frames written, unchanged ones merged into the previous */
+    bool lossless;          /* Every frame written lossless */
+    double prepare_ms;      /* Frame diffing and import, per worker on average */
+    size_t peak_bytes;      /* Frames, scratch and encoded output held at once */
+    bool cancelled;
+} AnimResult;
+
+/*
+ * Encode the image->frames canvases of image (RGBA, one after the other)
+ * with config for every frame. params supplies keyframe_interval,
+ * minimize_size and best_of. Frames are encoded on up to threads threads,
+ * the calling one included. Returns false on failure or cancellation
+ * (result->cancelled says which).
+ */
+bool anim_encode(const ImageData *image, const WebPConfig *config,
+                 const ConversionParams *params, int threads,
+                 const ConversionProgress *progress, AnimResult *result);
+
+#endif /* ANIM_H */
@@ -0,0 +1,1128 @@
+/*
+ * WebP Converter - Batch conversion engine implementation
+ *
+ * Each batch runs as a three-stage pipeline:
+ *
+ *   reader thread --read--> decoder threads --decoded--> encoder tasks
+ *
+ * The reader maps input files and faults their pages in, decoders turn
+ * them into pixels, and the pool workers encode and write. Stages are
+ * joined by bounded lock-free rings carrying slot pointers, so the
+ * slowest stage sets the pace instead of the sum of all of them.
+ *
+ * The reader is also the admission scheduler. It probes the header of
+ * each mapped file, predicts the job's peak memory from its dimensions
+ * (converter_predict_peak) and admits it into the pipeline only while the
+ * predictions of the jobs in flight fit the memory budget. Probed jobs
+ * wait in a small window, so smaller jobs can go ahead of one that does
+ * not fit yet; once the oldest has been passed BATCH_MAX_BYPASS times
+ * nothing else is admitted until it fits. A job larger than the whole
+ * budget runs alone.
+ *
+ * Cores are split between files and within them: each encode is given
+ * the cores the rest of the batch cannot use (all of them for a single
+ * file, one each while at least a worker's worth of jobs is left) and
+ * that other encodes have not claimed, and spends them on libwebp's
+ * internal threads and a banded ARGB import.
+ *
+ * With a manifest or deduplication, the reader first reads and hashes
+ * every input on the pool. Jobs whose output is up to date, or can be
+ * copied from an identical encode, are settled there and only reported
+ * when the reader reaches them; the encoders are started after this pass.
+ * Jobs with the same input as an earlier one are chained behind it and
+ * completed, with a link or copy of its output, when it completes.
+ *
+ * With a deadline, every encode picks its method when it starts. Finished
+ * encodes give the cost of their method in core-ms per megapixel; the
+ * megapixels left are the encode's own plus the probed average for each
+ * job not started yet, and the pick is the highest method predicted to
+ * get through them in the time left on the encoder workers.
+ *
+ * Cancelling sets one flag that every stage checks: the reader reports
+ * the jobs it has not admitted, decoders pass on what they are handed,
+ * and encodes in flight are stopped by their libwebp progress hook.
+ */
+
+#include "batch.h"
+#include "ring.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/* Files mapped ahead of the decoders, per decoder thread */
+#define BATCH_READ_AHEAD 2
+
+/* Probed jobs the reader can choose from when admitting */
+#define BATCH_ADMIT_WINDOW 16
+
+/* Times the oldest waiting job may be passed before it blocks admission */
+#define BATCH_MAX_BYPASS 32
+
+/* Default budget: this fraction of physical memory (or the fallback) */
+#define BATCH_BUDGET_FRACTION 0.5
+#define BATCH_BUDGET_FALLBACK ((size_t)1 << 30)
+
+/* Deadline mode: share of the time left the prediction may fill */
+#define BATCH_DEADLINE_MARGIN 0.9
+
+/* Deadline mode: weight kept by older samples of a method's cost per new one */
+#define BATCH_COST_DECAY 0.8
+
+/* Encoder methods (WebPConfig.method) */
+#define BATCH_METHODS 7
+
+/*
+ * Rough encode cost of each method relative to method 4, used to scale a
+ * measured method's cost to one not measured yet. Lossless runs at
+ * quality 100, where method 6 is libwebp's exhaustive search.
+ */
+static const double relative_cost_lossy[BATCH_METHODS] = {
+    0.3, 0.4, 0.5, 0.7, 1.0, 1.1, 1.4
+};
+static const double relative_cost_lossless[BATCH_METHODS] = {
+    0.3, 1.0, 1.1, 1.05, 1.0, 1.5, 18.0
+};
+
+/* Ring value that tells a stage thread the batch is over */
+#define STAGE_END ((uintptr_t)0)
+
+/* Job progress is kept in fixed point, so the batch total can be atomic */
+#define PROGRESS_SCALE 10000
+
+/* One job moving through the pipeline */
+typedef struct {
+    int index;
+    FileBuffer file;        /* Read stage -> decode stage */
+    ImageData image;        /* Decode stage -> encode stage */
+    size_t reserved;        /* Budget held from admission until the job ends */
+    int bypassed;           /* Later jobs admitted while this one waited */
+    double read_ms;         /* Map, probe and prefetch */
+    double decode_ms;
+    atomic_int progress;    /* 0..PROGRESS_SCALE, written by the job's encoder */
+    bool hashed;            /* input_hash is set */
+    int next_duplicate;     /* Next job with the same input, -1 at the end */
+} BatchSlot;
+
+/*
+ * Lock-free ring with a fallback to sleeping. Push and pop never take the
+ * lock while the ring is neither full nor empty; a thread that finds it
+ * full or empty registers as a sleeper and waits for the next pop or push.
+ */
+typedef struct {
+    Ring ring;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    atomic_int sleepers;
+} StageQueue;
+
+struct BatchEngine {
+    ThreadPool *pool;
+    ConverterContext **contexts;    /* One per worker thread */
+
+    /* Current batch */
+    BatchJob *jobs;
+    BatchSlot *slots;
+    int job_count;
+    ConversionParams params;
+    const Manifest *manifest;       /* Of the current batch, NULL if off */
+    const Manifest *next_manifest;  /* For the next batch_start() */
+    uint64_t params_hash;
+    bool dedupe;                    /* Encode identical inputs once */
+
+    /* Pipeline of the current batch */
+    StageQueue read_queue;          /* Admitted files waiting for a decoder */
+    StageQueue decoded_queue;       /* Decoded images waiting for an encoder */
+    pthread_t reader;
+    pthread_t *decoders;
+    int decoder_count;              /* Decoder threads wanted */
+    int decoders_started;
+    atomic_int decoders_running;
+    bool pipeline_started;
+
+    /* Admission: predicted bytes and jobs between admission and completion */
+    pthread_mutex_t budget_lock;
+    pthread_cond_t budget_freed;
+    size_t budget;
+    size_t budget_used;
+    int jobs_in_flight;
+    int max_in_flight;
+    BatchMemoryStats memory;        /* Current batch */
+    size_t rss_at_start;
+
+    /* Progress: sum of the slots' progress, start time, cancel request */
+    atomic_llong progress_sum;
+    double start_ms;
+    atomic_bool cancel;
+
+    /* Deadline mode: measured cost per method, encodes left to pick for */
+    double deadline_ms;             /* 0: off */
+    pthread_mutex_t effort_lock;
+    double method_ms[BATCH_METHODS];    /* Decayed sums of encoder core-ms */
+    double method_mp[BATCH_METHODS];    /* and megapixels, per method */
+    int encode_total;               /* Jobs the encoders get, set before they start */
+    atomic_int encodes_picked;
+    atomic_llong probed_pixels;     /* Sum and count over the probed jobs */
+    atomic_int probed_count;
+
+    /* Intra-image core split */
+    atomic_int encodes_started;
+    atomic_int cores_claimed;       /* By the encodes in flight */
+
+    /* Finished job indices, pushed by workers, popped by the owner */
+    Ring completions;
+    atomic_int completed;   /* Pushed to the ring */
+    int reported;           /* Popped by the owner thread */
+
+    /* Only used by batch_wait_next() to sleep between completions */
+    pthread_mutex_t wait_lock;
+    pthread_cond_t wait_cond;
+};
+
+static bool stage_queue_init(StageQueue *queue, size_t capacity) {
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    atomic_init(&queue->sleepers, 0);
+    return ring_init(&queue->ring, capacity);
+}
+
+static void stage_queue_free(StageQueue *queue) {
+    ring_free(&queue->ring);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+}
+
+/* Wake sleepers after a push or pop (the fence pairs with the one in wait) */
+static void stage_queue_notify(StageQueue *queue) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&queue->sleepers, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&queue->lock);
+        pthread_cond_broadcast(&queue->changed);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+static void stage_queue_push(StageQueue *queue, uintptr_t value) {
+    if (!ring_push(&queue->ring, value)) {
+        pthread_mutex_lock(&queue->lock);
+        atomic_fetch_add(&queue->sleepers, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        while (!ring_push(&queue->ring, value)) {
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        }
+        atomic_fetch_sub(&queue->sleepers, 1);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    stage_queue_notify(queue);
+}
+
+static uintptr_t stage_queue_pop(StageQueue *queue) {
+    uintptr_t value;
+    if (!ring_pop(&queue->ring, &value)) {
+        pthread_mutex_lock(&queue->lock);
+        atomic_fetch_add(&queue->sleepers, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        while (!ring_pop(&queue->ring, &value)) {
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        }
+        atomic_fetch_sub(&queue->sleepers, 1);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    stage_queue_notify(queue);
+    return value;
+}
+
+static bool batch_cancelled(BatchEngine *engine) {
+    return atomic_load_explicit(&engine->cancel, memory_order_relaxed);
+}
+
+/* Raise a job's progress; only its current stage thread calls this */
+static void set_progress(BatchEngine *engine, BatchSlot *slot, int value) {
+    int old = atomic_load_explicit(&slot->progress, memory_order_relaxed);
+    if (value <= old) return;
+    atomic_store_explicit(&slot->progress, value, memory_order_relaxed);
+    atomic_fetch_add_explicit(&engine->progress_sum, value - old, memory_order_relaxed);
+}
+
+/* Report a finished (or failed) job to the owner thread */
+static void push_completion(BatchEngine *engine, int index) {
+    set_progress(engine, &engine->slots[index], PROGRESS_SCALE);
+
+    /* The ring was sized for the whole batch, so this cannot fail */
+    ring_push(&engine->completions, (uintptr_t)index);
+    atomic_fetch_add_explicit(&engine->completed, 1, memory_order_release);
+
+    pthread_mutex_lock(&engine->wait_lock);
+    pthread_cond_signal(&engine->wait_cond);
+    pthread_mutex_unlock(&engine->wait_lock);
+}
+
+/* A duplicate gets the output of the job it duplicates, or its failure */
+static void complete_duplicate(BatchEngine *engine, const BatchJob *original, BatchJob *job) {
+    ConversionResult *result = &job->result;
+    *result = original->result;
+    memset(&result->timings, 0, sizeof(result->timings));
+    result->peak_bytes = 0;
+    result->allocations = 0;
+    result->threads = 0;
+    if (!result->success) return;
+
+    double start = converter_now_ms();
+    job->copy_method = converter_copy_file(original->output_path, job->output_path);
+    result->timings.write_ms = converter_now_ms() - start;
+    if (job->copy_method == COPY_FAILED) {
+        result->success = false;
+        snprintf(result->error_message, sizeof(result->error_message),
+                 "Failed to copy the output of %s", original->input_path);
+    }
+}
+
+static void complete_job(BatchEngine *engine, int index) {
+    int duplicate = engine->slots[index].next_duplicate;
+    push_completion(engine, index);
+
+    while (duplicate >= 0) {
+        int next = engine->slots[duplicate].next_duplicate;
+        complete_duplicate(engine, &engine->jobs[index], &engine->jobs[duplicate]);
+        push_completion(engine, duplicate);
+        duplicate = next;
+    }
+}
+
+static void fail_job(BatchEngine *engine, BatchSlot *slot, const char *message) {
+    ConversionResult *result = &engine->jobs[slot->index].result;
+    result->success = false;
+    result->timings.read_ms = slot->read_ms;
+    result->timings.decode_ms = slot->decode_ms;
+    snprintf(result->error_message, sizeof(result->error_message), "%s", message);
+    complete_job(engine, slot->index);
+}
+
+static void cancel_job(BatchEngine *engine, BatchSlot *slot) {
+    engine->jobs[slot->index].result.cancelled = true;
+    fail_job(engine, slot, "Cancelled");
+}
+
+/* True if slot can be admitted now (called with budget_lock held) */
+static bool budget_fits(const BatchEngine *engine, const BatchSlot *slot) {
+    if (engine->jobs_in_flight >= engine->max_in_flight) return false;
+    if (engine->budget_used == 0) return true;
+    return engine->budget_used <= engine->budget &&
+           slot->reserved <= engine->budget - engine->budget_used;
+}
+
+/*
+ * Block until some job of the window fits the budget, reserve its bytes
+ * and return its position. The oldest job goes first when it fits, and
+ * is the only candidate once it has been bypassed too often. Returns -1
+ * once the batch is cancelled. (A job only waits while others hold
+ * budget, and those end promptly when cancelled, so the flag is seen.)
+ */
+static int admit_from_window(BatchEngine *engine, BatchSlot **window, int count) {
+    pthread_mutex_lock(&engine->budget_lock);
+
+    int pick = -1;
+    for (;;) {
+        if (batch_cancelled(engine)) {
+            pthread_mutex_unlock(&engine->budget_lock);
+            return -1;
+        }
+        int candidates = (window[0]->bypassed >= BATCH_MAX_BYPASS) ? 1 : count;
+        for (int i = 0; i < candidates && pick < 0; i++) {
+            if (budget_fits(engine, window[i])) pick = i;
+        }
+        if (pick >= 0) break;
+        pthread_cond_wait(&engine->budget_freed, &engine->budget_lock);
+    }
+
+    BatchSlot *slot = window[pick];
+    engine->budget_used += slot->reserved;
+    engine->jobs_in_flight++;
+    if (engine->budget_used > engine->memory.predicted_peak) {
+        engine->memory.predicted_peak = engine->budget_used;
+    }
+    if (pick > 0) engine->memory.reordered++;
+
+    pthread_mutex_unlock(&engine->budget_lock);
+
+    for (int i = 0; i < pick; i++) window[i]->bypassed++;
+    return pick;
+}
+
+/* Hand back a job's reservation once its memory is freed */
+static void release_budget(BatchEngine *engine, BatchSlot *slot) {
+    pthread_mutex_lock(&engine->budget_lock);
+    engine->budget_used -= slot->reserved;
+    engine->jobs_in_flight--;
+    pthread_cond_signal(&engine->budget_freed);
+    pthread_mutex_unlock(&engine->budget_lock);
+}
+
+/* Pixels of every frame of a decoded or probed image */
+static long long image_pixels(const ImageData *image) {
+    int frames = image->frames > 1 ? image->frames : 1;
+    return (long long)image->width * image->height * frames;
+}
+
+/* Map a file and predict its cost; false (job reported) if it cannot run */
+static bool probe_job(BatchEngine *engine, BatchSlot *slot) {
+    BatchJob *job = &engine->jobs[slot->index];
+    double start = converter_now_ms();
+    trace_set_file(slot->index);
+    TraceSpan span = trace_begin(TRACE_READ);
+
+    if (!converter_read_file(job->input_path, &slot->file, false)) {
+        trace_end(span);
+        slot->read_ms = converter_now_ms() - start;
+        fail_job(engine, slot, "Failed to read file");
+        return false;
+    }
+    job->input_size = slot->file.size;
+
+    ImageData probe;
+    bool probed = converter_probe_image_from_memory(slot->file.data, slot->file.size, &probe);
+    trace_end(span);
+    slot->read_ms = converter_now_ms() - start;
+    if (!probed) {
+        converter_release_file(&slot->file);
+        fail_job(engine, slot, "Failed to load image");
+        return false;
+    }
+    slot->reserved = converter_predict_peak(&probe, &engine->params);
+    job->predicted_bytes = slot->reserved;
+    atomic_fetch_add(&engine->probed_pixels, image_pixels(&probe));
+    atomic_fetch_add(&engine->probed_count, 1);
+    return true;
+}
+
+static void encoder_task(void *arg, int worker);
+
+/* Hash pass over one job: hash the input, settle it if the manifest has its output */
+static void check_job(void *arg, int index, int worker) {
+    BatchEngine *engine = arg;
+    BatchJob *job = &engine->jobs[index];
+    if (batch_cancelled(engine)) return;
+
+    double start = converter_now_ms();
+    trace_set_file(index);
+    TraceSpan span = trace_begin(TRACE_HASH);
+    FileBuffer file;
+    bool read = converter_read_file(job->input_path, &file, true);
+    if (read) {
+        job->input_hash = manifest_hash(file.data, file.size);
+        job->input_size = file.size;
+        /*
+         * Not kept for probe_job(): a large batch cannot hold every input
+         * mapped until the reader gets to it, and the second read of the
+         * files it soon does is mostly served by the page cache
+         */
+        converter_release_file(&file);
+    }
+    trace_end(span);
+    trace_set_file(-1);
+    /* Unreadable inputs fail later, in probe_job */
+    if (!read) return;
+    engine->slots[index].hashed = true;
+    if (!engine->manifest) return;
+
+    size_t size;
+    char source[1024];
+    if (manifest_is_current(engine->manifest, job->output_path, job->input_hash,
+                            engine->params_hash, &size)) {
+        job->reuse = BATCH_SKIPPED;
+    } else if (manifest_find_copy(engine->manifest, job->output_path, job->input_hash,
+                                  engine->params_hash, source, sizeof(source), &size) &&
+               (job->copy_method = converter_copy_file(source, job->output_path)) != COPY_FAILED) {
+        job->reuse = BATCH_REUSED;
+    } else {
+        return;
+    }
+
+    ConversionResult *result = &job->result;
+    result->success = true;
+    result->output_size = size;
+    result->compression_ratio = size > 0 ? (float)job->input_size / (float)size : 0.0f;
+    result->timings.read_ms = converter_now_ms() - start;
+}
+
+/*
+ * True if the inputs of two jobs hold the same bytes. The hash pass
+ * released its mappings (a large batch cannot keep every input mapped),
+ * so both are mapped again, most likely from the page cache.
+ */
+static bool same_input(const BatchJob *a, const BatchJob *b) {
+    FileBuffer first, second;
+    if (!converter_read_file(a->input_path, &first, false)) return false;
+
+    bool same = false;
+    if (converter_read_file(b->input_path, &second, false)) {
+        same = first.size == second.size &&
+               (first.size == 0 || memcmp(first.data, second.data, first.size) == 0);
+        converter_release_file(&second);
+    }
+    converter_release_file(&first);
+    return same;
+}
+
+/*
+ * Group the jobs left to encode by input hash and size (the params are
+ * the batch's): the first of each group is encoded, the others are
+ * chained behind it as duplicates once their bytes compare equal, so a
+ * hash collision never gets another file's output. False if there is no
+ * memory for it.
+ */
+static bool group_duplicates(BatchEngine *engine) {
+    size_t slot_count = 16;
+    while (slot_count < (size_t)engine->job_count * 2) slot_count *= 2;
+    int *first = malloc(slot_count * sizeof(int));
+    int *last = malloc(engine->job_count * sizeof(int));
+    if (!first || !last) {
+        free(first);
+        free(last);
+        return false;
+    }
+    memset(first, 0xff, slot_count * sizeof(int));
+
+    size_t mask = slot_count - 1;
+    for (int i = 0; i < engine->job_count; i++) {
+        BatchJob *job = &engine->jobs[i];
+        if (!engine->slots[i].hashed || job->reuse != BATCH_REBUILT) continue;
+
+        size_t slot = (size_t)job->input_hash & mask;
+        while (first[slot] >= 0) {
+            const BatchJob *other = &engine->jobs[first[slot]];
+            if (other->input_hash == job->input_hash && other->input_size == job->input_size) break;
+            slot = (slot + 1) & mask;
+        }
+
+        int original = first[slot];
+        if (original < 0) {
+            first[slot] = i;
+            last[i] = i;
+            continue;
+        }
+
+        trace_set_file(i);
+        TraceSpan span = trace_begin(TRACE_HASH);
+        bool same = same_input(&engine->jobs[original], job);
+        trace_end(span);
+        trace_set_file(-1);
+        if (!same) continue;
+
+        job->reuse = BATCH_DUPLICATE;
+        job->duplicate_of = original;
+        engine->slots[last[original]].next_duplicate = i;
+        last[original] = i;
+    }
+
+    free(first);
+    free(last);
+    return true;
+}
+
+/*
+ * Account for a job that never reaches an encoder: the manifest settled
+ * it, or it is completed along with the job it duplicates.
+ */
+static void settle_job(BatchEngine *engine, BatchSlot *slot) {
+    atomic_fetch_add(&engine->encodes_started, 1);
+    if (engine->jobs[slot->index].reuse != BATCH_DUPLICATE) complete_job(engine, slot->index);
+}
+
+/* Stage 1: map and probe input files, admit them within the budget */
+static void* reader_main(void *arg) {
+    BatchEngine *engine = arg;
+    BatchSlot *window[BATCH_ADMIT_WINDOW];
+    int waiting = 0;
+    int next = 0;
+
+    trace_set_thread_name("reader");
+
+    /* The pool is still idle: hash every input on it before the encoders start */
+    if (engine->manifest || engine->dedupe) {
+        pool_parallel_for(engine->pool, engine->job_count, check_job, engine);
+        if (engine->dedupe && !batch_cancelled(engine)) group_duplicates(engine);
+    }
+    engine->encode_total = 0;
+    for (int i = 0; i < engine->job_count; i++) {
+        if (engine->jobs[i].reuse == BATCH_REBUILT) engine->encode_total++;
+    }
+    int encoders = pool_thread_count(engine->pool);
+    for (int i = 0; i < encoders; i++) {
+        pool_submit(engine->pool, encoder_task, engine);
+    }
+
+    for (;;) {
+        while (waiting < BATCH_ADMIT_WINDOW && next < engine->job_count &&
+               !batch_cancelled(engine)) {
+            BatchSlot *slot = &engine->slots[next++];
+            if (engine->jobs[slot->index].reuse != BATCH_REBUILT) {
+                settle_job(engine, slot);
+            } else if (probe_job(engine, slot)) {
+                window[waiting++] = slot;
+            }
+        }
+        if (waiting == 0) break;
+
+        int pick = admit_from_window(engine, window, waiting);
+        if (pick < 0) break;
+        BatchSlot *slot = window[pick];
+        memmove(&window[pick], &window[pick + 1], (size_t)(waiting - pick - 1) * sizeof(BatchSlot *));
+        waiting--;
+
+        double start = converter_now_ms();
+        trace_set_file(slot->index);
+        TraceSpan span = trace_begin(TRACE_READ);
+        converter_prefetch_file(&slot->file);
+        trace_end(span);
+        slot->read_ms += converter_now_ms() - start;
+        stage_queue_push(&engine->read_queue, (uintptr_t)slot);
+    }
+
+    /* Cancelled: report what was probed or never read */
+    for (int i = 0; i < waiting; i++) {
+        converter_release_file(&window[i]->file);
+        cancel_job(engine, window[i]);
+    }
+    while (next < engine->job_count) {
+        BatchSlot *slot = &engine->slots[next++];
+        if (engine->jobs[slot->index].reuse != BATCH_REBUILT) {
+            settle_job(engine, slot);
+        } else {
+            cancel_job(engine, slot);
+        }
+    }
+
+    for (int i = 0; i < engine->decoders_started; i++) {
+        stage_queue_push(&engine->read_queue, STAGE_END);
+    }
+    return NULL;
+}
+
+/* Stage 2: decode admitted files (their budget stays held until encoded) */
+static void* decoder_main(void *arg) {
+    BatchEngine *engine = arg;
+
+    trace_set_thread_name("decoder");
+    for (;;) {
+        BatchSlot *slot = (BatchSlot *)stage_queue_pop(&engine->read_queue);
+        if (!slot) break;
+
+        if (batch_cancelled(engine)) {
+            converter_release_file(&slot->file);
+            cancel_job(engine, slot);
+            release_budget(engine, slot);
+            continue;
+        }
+
+        double start = converter_now_ms();
+        trace_set_file(slot->index);
+        TraceSpan span = trace_begin(TRACE_DECODE);
+        bool ok = converter_load_image_from_memory(slot->file.data, slot->file.size,
+                                                   &slot->image);
+        trace_end(span);
+        slot->decode_ms = converter_now_ms() - start;
+        converter_release_file(&slot->file);
+
+        if (!ok) {
+            fail_job(engine, slot, "Failed to load image");
+            release_budget(engine, slot);
+            continue;
+        }
+        strncpy(slot->image.filepath, engine->jobs[slot->index].input_path,
+                sizeof(slot->image.filepath) - 1);
+        stage_queue_push(&engine->decoded_queue, (uintptr_t)slot);
+    }
+
+    /* The last decoder out tells every encoder to stop */
+    if (atomic_fetch_sub(&engine->decoders_running, 1) == 1) {
+        int encoders = pool_thread_count(engine->pool);
+        for (int i = 0; i < encoders; i++) {
+            stage_queue_push(&engine->decoded_queue, STAGE_END);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Claim cores for the next encode: the workers shared out between the
+ * remaining jobs, but no more than the encodes in flight left unclaimed.
+ * Jobs that failed before reaching an encoder still count as remaining,
+ * which only errs towards fewer threads. Give them back with
+ * release_cores().
+ */
+static int claim_cores(BatchEngine *engine) {
+    int workers = pool_thread_count(engine->pool);
+    int left = engine->job_count - atomic_fetch_add(&engine->encodes_started, 1);
+    int cores = 1;
+    if (left > 0 && left < workers) {
+        int unclaimed = workers - atomic_load(&engine->cores_claimed);
+        cores = workers / left;
+        if (cores > unclaimed) cores = unclaimed;
+        if (cores < 1) cores = 1;
+    }
+    atomic_fetch_add(&engine->cores_claimed, cores);
+    return cores;
+}
+
+static void release_cores(BatchEngine *engine, int cores) {
+    atomic_fetch_sub(&engine->cores_claimed, cores);
+}
+
+/*
+ * Cost of method in encoder core-ms per megapixel, scaled from the
+ * nearest method measured so far; < 0 if none is. Called with
+ * effort_lock held.
+ */
+static double method_cost(const BatchEngine *engine, int method) {
+    const double *relative = engine->params.lossless ? relative_cost_lossless
+                                                     : relative_cost_lossy;
+    for (int distance = 0; distance < BATCH_METHODS; distance++) {
+        int nearest[2] = { method - distance, method + distance };
+        for (int i = 0; i < 2; i++) {
+            int measured = nearest[i];
+            if (measured < 0 || measured >= BATCH_METHODS || engine->method_mp[measured] <= 0.0) {
+                continue;
+            }
+            return engine->method_ms[measured] / engine->method_mp[measured] *
+                   relative[method] / relative[measured];
+        }
+    }
+    return -1.0;
+}
+
+/*
+ * Method for the encode of slot: with a deadline, the highest predicted
+ * to encode it and the jobs after it in the time left (0 if none is).
+ * Effort only rises one method past the highest measured at a time, as
+ * the scaled cost of a method above is the least reliable. Jobs that
+ * fail before their encode still count as left, which only errs towards
+ * lower methods.
+ */
+static BatchEffort pick_effort(BatchEngine *engine, const BatchSlot *slot) {
+    BatchEffort effort = { engine->params.method, false, 0.0, -1.0 };
+    if (engine->deadline_ms <= 0.0) return effort;
+
+    effort.deadline = true;
+    double left_ms = engine->deadline_ms - (converter_now_ms() - engine->start_ms);
+    effort.seconds_left = left_ms / 1000.0;
+
+    int after = engine->encode_total - atomic_fetch_add(&engine->encodes_picked, 1) - 1;
+    int probed = atomic_load(&engine->probed_count);
+    double average = probed > 0 ? (double)atomic_load(&engine->probed_pixels) / probed : 0.0;
+    double megapixels = ((double)image_pixels(&slot->image) + (after > 0 ? after : 0) * average) / 1e6;
+    double workers = pool_thread_count(engine->pool);
+
+    pthread_mutex_lock(&engine->effort_lock);
+    int highest = BATCH_METHODS - 1;
+    while (highest > 0 && engine->method_mp[highest - 1] <= 0.0 && engine->method_mp[highest] <= 0.0) {
+        highest--;
+    }
+    for (int method = highest; method >= 0; method--) {
+        double cost = method_cost(engine, method);
+        if (cost < 0.0) break;
+        effort.method = method;
+        effort.predicted_seconds = megapixels * cost / workers / 1000.0;
+        if (effort.predicted_seconds <= effort.seconds_left * BATCH_DEADLINE_MARGIN) break;
+    }
+    pthread_mutex_unlock(&engine->effort_lock);
+    return effort;
+}
+
+/* Add a finished encode to the cost of its method */
+static void measure_effort(BatchEngine *engine, const BatchSlot *slot, int method,
+                           const ConversionResult *result, int cores) {
+    double megapixels = (double)image_pixels(&slot->image) / 1e6;
+    if (!result->success || megapixels <= 0.0 || method < 0 || method >= BATCH_METHODS) return;
+
+    const StageTimings *timings = &result->timings;
+    double ms = (timings->analyze_ms + timings->import_ms + timings->encode_ms +
+                 timings->write_ms) * cores;
+    pthread_mutex_lock(&engine->effort_lock);
+    engine->method_ms[method] = engine->method_ms[method] * BATCH_COST_DECAY + ms;
+    engine->method_mp[method] = engine->method_mp[method] * BATCH_COST_DECAY + megapixels;
+    pthread_mutex_unlock(&engine->effort_lock);
+}
+
+/* Where an encode's progress goes */
+typedef struct {
+    BatchEngine *engine;
+    BatchSlot *slot;
+} EncodeReport;
+
+static void report_encode(float fraction, void *user_data) {
+    EncodeReport *report = user_data;
+    set_progress(report->engine, report->slot, (int)(fraction * (PROGRESS_SCALE - 1)));
+}
+
+/* Stage 3: encode and write on the pool, one long-running task per worker */
+static void encoder_task(void *arg, int worker) {
+    BatchEngine *engine = arg;
+    EncodeReport report = { engine, NULL };
+    ConversionProgress progress = { report_encode, &report, &engine->cancel };
+
+    if (atomic_load_explicit(&trace_active, memory_order_relaxed)) {
+        char name[32];
+        snprintf(name, sizeof(name), "encoder %d", worker);
+        trace_set_thread_name(name);
+    }
+    for (;;) {
+        BatchSlot *slot = (BatchSlot *)stage_queue_pop(&engine->decoded_queue);
+        if (!slot) break;
+
+        BatchJob *job = &engine->jobs[slot->index];
+        report.slot = slot;
+        int cores = claim_cores(engine);
+        ConversionParams params = engine->params;
+        job->effort = pick_effort(engine, slot);
+        params.method = job->effort.method;
+        converter_context_set_threads(engine->contexts[worker], cores);
+        trace_set_file(slot->index);
+        job->result = converter_context_to_webp(engine->contexts[worker], &slot->image,
+                                                job->output_path, &params, &progress);
+        release_cores(engine, cores);
+        if (job->effort.deadline) {
+            measure_effort(engine, slot, params.method, &job->result, cores);
+        }
+        trace_set_file(-1);
+        job->result.timings.read_ms = slot->read_ms;
+        job->result.timings.decode_ms = slot->decode_ms;
+        converter_free_image(&slot->image);
+        release_budget(engine, slot);
+
+        complete_job(engine, slot->index);
+    }
+}
+
+BatchEngine* batch_create(int thread_count) {
+    BatchEngine *engine = calloc(1, sizeof(BatchEngine));
+    if (!engine) return NULL;
+
+    pthread_mutex_init(&engine->wait_lock, NULL);
+    pthread_cond_init(&engine->wait_cond, NULL);
+    pthread_mutex_init(&engine->budget_lock, NULL);
+    pthread_cond_init(&engine->budget_freed, NULL);
+    pthread_mutex_init(&engine->effort_lock, NULL);
+    atomic_init(&engine->completed, 0);
+    atomic_init(&engine->decoders_running, 0);
+    atomic_init(&engine->progress_sum, 0);
+    atomic_init(&engine->cancel, false);
+    atomic_init(&engine->encodes_started, 0);
+    atomic_init(&engine->cores_claimed, 0);
+    atomic_init(&engine->encodes_picked, 0);
+    atomic_init(&engine->probed_pixels, 0);
+    atomic_init(&engine->probed_count, 0);
+
+    engine->pool = pool_create(thread_count);
+    if (!engine->pool) {
+        batch_destroy(engine);
+        return NULL;
+    }
+
+    int workers = pool_thread_count(engine->pool);
+    engine->contexts = calloc(workers, sizeof(ConverterContext *));
+    if (!engine->contexts) {
+        batch_destroy(engine);
+        return NULL;
+    }
+    for (int i = 0; i < workers; i++) {
+        engine->contexts[i] = converter_context_create();
+        if (!engine->contexts[i]) {
+            batch_destroy(engine);
+            return NULL;
+        }
+    }
+
+    /* Decoding is several times cheaper than encoding */
+    engine->decoder_count = (workers + 3) / 4;
+
+    /* Encoding, decoded and waiting, decoding and read ahead */
+    engine->max_in_flight = workers + engine->decoder_count * (2 + BATCH_READ_AHEAD);
+    batch_set_memory_budget(engine, 0);
+
+    return engine;
+}
+
+/* Half of physical memory, when the platform reports it */
+static size_t default_budget(void) {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0) return BATCH_BUDGET_FALLBACK;
+    return (size_t)((double)pages * (double)page_size * BATCH_BUDGET_FRACTION);
+}
+
+void batch_set_memory_budget(BatchEngine *engine, size_t bytes) {
+    if (!engine) return;
+    engine->budget = bytes ? bytes : default_budget();
+}
+
+/* Wait for the stage threads of the last batch and free its pipeline */
+static void release_batch(BatchEngine *engine) {
+    if (engine->pipeline_started) {
+        pthread_join(engine->reader, NULL);
+        for (int i = 0; i < engine->decoders_started; i++) {
+            pthread_join(engine->decoders[i], NULL);
+        }
+        pool_wait(engine->pool);
+
+        stage_queue_free(&engine->read_queue);
+        stage_queue_free(&engine->decoded_queue);
+        engine->pipeline_started = false;
+    }
+
+    ring_free(&engine->completions);
+    free(engine->decoders);
+    free(engine->slots);
+    engine->decoders = NULL;
+    engine->slots = NULL;
+    engine->jobs = NULL;
+    engine->job_count = 0;
+}
+
+void batch_destroy(BatchEngine *engine) {
+    if (!engine) return;
+
+    release_batch(engine);
+
+    int workers = pool_thread_count(engine->pool);
+    pool_destroy(engine->pool);
+
+    for (int i = 0; engine->contexts && i < workers; i++) {
+        converter_context_destroy(engine->contexts[i]);
+    }
+    free(engine->contexts);
+    pthread_mutex_destroy(&engine->wait_lock);
+    pthread_cond_destroy(&engine->wait_cond);
+    pthread_mutex_destroy(&engine->budget_lock);
+    pthread_cond_destroy(&engine->budget_freed);
+    pthread_mutex_destroy(&engine->effort_lock);
+    free(engine);
+}
+
+bool batch_start(BatchEngine *engine, BatchJob *jobs, int count,
+                 const ConversionParams *params) {
+    if (!engine || !jobs || count <= 0 || !params) return false;
+    if (batch_is_running(engine)) return false;
+
+    /* Stage threads of the previous batch are done or about to be */
+    release_batch(engine);
+
+    int encoders = pool_thread_count(engine->pool);
+    engine->slots = calloc(count, sizeof(BatchSlot));
+    engine->decoders = calloc(engine->decoder_count, sizeof(pthread_t));
+    if (!engine->slots || !engine->decoders ||
+        !ring_init(&engine->completions, (size_t)count)) {
+        release_batch(engine);
+        return false;
+    }
+
+    /* Room for every admitted job and end marker, so encoders' input never fills */
+    bool queues_ok = stage_queue_init(&engine->read_queue,
+                                      (size_t)engine->decoder_count * BATCH_READ_AHEAD);
+    queues_ok = stage_queue_init(&engine->decoded_queue,
+                                 (size_t)(engine->max_in_flight + encoders)) && queues_ok;
+    if (!queues_ok) {
+        stage_queue_free(&engine->read_queue);
+        stage_queue_free(&engine->decoded_queue);
+        release_batch(engine);
+        return false;
+    }
+
+    engine->jobs = jobs;
+    engine->job_count = count;
+    engine->params = *params;
+    engine->manifest = engine->next_manifest;
+    engine->params_hash = engine->manifest ? manifest_params_hash(params) : 0;
+    engine->reported = 0;
+    atomic_store(&engine->completed, 0);
+    atomic_store(&engine->decoders_running, 0);
+    atomic_store(&engine->progress_sum, 0);
+    atomic_store(&engine->cancel, false);
+    atomic_store(&engine->encodes_started, 0);
+    atomic_store(&engine->encodes_picked, 0);
+    atomic_store(&engine->probed_pixels, 0);
+    atomic_store(&engine->probed_count, 0);
+    memset(engine->method_ms, 0, sizeof(engine->method_ms));
+    memset(engine->method_mp, 0, sizeof(engine->method_mp));
+    engine->start_ms = converter_now_ms();
+
+    engine->budget_used = 0;
+    engine->jobs_in_flight = 0;
+    memset(&engine->memory, 0, sizeof(engine->memory));
+    engine->memory.budget = engine->budget;
+    converter_reset_peak_rss();
+    engine->rss_at_start = converter_peak_rss();
+
+    for (int i = 0; i < count; i++) {
+        memset(&jobs[i].result, 0, sizeof(jobs[i].result));
+        jobs[i].input_size = 0;
+        jobs[i].predicted_bytes = 0;
+        jobs[i].input_hash = 0;
+        jobs[i].reuse = BATCH_REBUILT;
+        jobs[i].duplicate_of = -1;
+        jobs[i].copy_method = COPY_FAILED;
+        jobs[i].effort = (BatchEffort){ -1, false, 0.0, -1.0 };
+        engine->slots[i].index = i;
+        engine->slots[i].hashed = false;
+        engine->slots[i].next_duplicate = -1;
+        atomic_init(&engine->slots[i].progress, 0);
+    }
+
+    /*
+     * The reader starts the encoders (after the manifest pass, if any). A
+     * decoder thread that cannot be created shrinks the stage rather than
+     * failing the batch, but each stage needs at least one thread to make
+     * progress.
+     */
+    int decoders = 0;
+    for (int i = 0; i < engine->decoder_count; i++) {
+        if (pthread_create(&engine->decoders[i], NULL, decoder_main, engine) != 0) break;
+        decoders++;
+        atomic_fetch_add(&engine->decoders_running, 1);
+    }
+    engine->decoders_started = decoders;
+
+    if (decoders == 0 || pthread_create(&engine->reader, NULL, reader_main, engine) != 0) {
+        /* Unwind: stop what was started and report the batch as not run */
+        for (int i = 0; i < decoders; i++) {
+            stage_queue_push(&engine->read_queue, STAGE_END);
+        }
+        for (int i = 0; i < decoders; i++) {
+            pthread_join(engine->decoders[i], NULL);
+        }
+        stage_queue_free(&engine->read_queue);
+        stage_queue_free(&engine->decoded_queue);
+        release_batch(engine);
+        return false;
+    }
+
+    engine->pipeline_started = true;
+    return true;
+}
+
+void batch_set_manifest(BatchEngine *engine, const Manifest *manifest) {
+    if (engine) engine->next_manifest = manifest;
+}
+
+void batch_set_dedupe(BatchEngine *engine, bool enabled) {
+    if (engine) engine->dedupe = enabled;
+}
+
+void batch_set_deadline(BatchEngine *engine, double seconds) {
+    if (engine) engine->deadline_ms = seconds > 0.0 ? seconds * 1000.0 : 0.0;
+}
+
+bool batch_record_manifest(const BatchEngine *engine, Manifest *manifest) {
+    if (!engine || !manifest || !engine->manifest) return false;
+
+    bool ok = true;
+    for (int i = 0; i < engine->job_count; i++) {
+        const BatchJob *job = &engine->jobs[i];
+        if (!job->result.success) continue;
+
+        /* A deadline may have encoded it at another method than the params' */
+        const BatchJob *encoded = job->duplicate_of >= 0 ? &engine->jobs[job->duplicate_of] : job;
+        uint64_t params_hash = engine->params_hash;
+        if (encoded->effort.method >= 0 && encoded->effort.method != engine->params.method) {
+            ConversionParams params = engine->params;
+            params.method = encoded->effort.method;
+            params_hash = manifest_params_hash(&params);
+        }
+        ok = manifest_record(manifest, job->output_path, job->input_hash,
+                             params_hash, job->result.output_size) && ok;
+    }
+    return ok;
+}
+
+void batch_cancel(BatchEngine *engine) {
+    if (engine) atomic_store(&engine->cancel, true);
+}
+
+float batch_job_progress(const BatchEngine *engine, int job_index) {
+    if (!engine || !engine->slots || job_index < 0 || job_index >= engine->job_count) return 0.0f;
+    int value = atomic_load_explicit(&engine->slots[job_index].progress, memory_order_relaxed);
+    return (float)value / PROGRESS_SCALE;
+}
+
+bool batch_progress(const BatchEngine *engine, BatchProgress *progress) {
+    if (!engine || !progress) return false;
+
+    progress->finished = atomic_load_explicit(&engine->completed, memory_order_acquire);
+    progress->total = engine->job_count;
+    progress->fraction = 0.0f;
+    progress->elapsed_seconds = 0.0;
+    progress->eta_seconds = -1.0;
+    if (engine->job_count == 0) return true;
+
+    long long sum = atomic_load_explicit(&engine->progress_sum, memory_order_relaxed);
+    double fraction = (double)sum / ((double)PROGRESS_SCALE * engine->job_count);
+    if (fraction > 1.0) fraction = 1.0;
+    progress->fraction = (float)fraction;
+    progress->elapsed_seconds = (converter_now_ms() - engine->start_ms) / 1000.0;
+
+    /* Too little done to extrapolate from until a percent is in */
+    if (fraction >= 1.0) {
+        progress->eta_seconds = 0.0;
+    } else if (fraction >= 0.01) {
+        progress->eta_seconds = progress->elapsed_seconds * (1.0 - fraction) / fraction;
+    }
+    return true;
+}
+
+bool batch_poll(BatchEngine *engine, int *job_index) {
+    if (!engine || engine->reported >= engine->job_count) return false;
+
+    uintptr_t value;
+    if (!ring_pop(&engine->completions, &value)) return false;
+
+    engine->reported++;
+    *job_index = (int)value;
+    return true;
+}
+
+bool batch_wait_next(BatchEngine *engine, int *job_index) {
+    if (!engine) return false;
+
+    while (engine->reported < engine->job_count) {
+        if (batch_poll(engine, job_index)) return true;
+
+        pthread_mutex_lock(&engine->wait_lock);
+        while (atomic_load_explicit(&engine->completed, memory_order_acquire) <= engine->reported) {
+            pthread_cond_wait(&engine->wait_cond, &engine->wait_lock);
+        }
+        pthread_mutex_unlock(&engine->wait_lock);
+    }
+
+    return false;
+}
+
+bool batch_is_running(const BatchEngine *engine) {
+    return engine && engine->reported < engine->job_count;
+}
+
+int batch_thread_count(const BatchEngine *engine) {
+    return engine ? pool_thread_count(engine->pool) : 0;
+}
+
+int batch_job_limit(const BatchEngine *engine) {
+    return engine ? engine->max_in_flight : 0;
+}
+
+bool batch_memory_stats(BatchEngine *engine, BatchMemoryStats *stats) {
+    if (!engine || !stats) return false;
+
+    pthread_mutex_lock(&engine->budget_lock);
+    *stats = engine->memory;
+    pthread_mutex_unlock(&engine->budget_lock);
+
+    size_t peak = converter_peak_rss();
+    stats->measured_peak = (peak > engine->rss_at_start) ? peak - engine->rss_at_start : 0;
+    return true;
+}
+
+ThreadPool* batch_get_pool(BatchEngine *engine) {
+    return engine ? engine->pool : NULL;
+}
@@ -0,0 +1,163 @@
+/*
+ * WebP Converter - Batch conversion engine
+ * Runs conversions as a read -> decode -> encode/write pipeline (encoding
+ * on a persistent worker pool), admitting jobs within a memory budget,
+ * and reports completions through a lock-free queue, so callers (UI
+ * frame loop, CLI) never block on an encode.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "converter.h"
+#include "pool.h"
+#include "manifest.h"
+
+/* How a job's output came about (see batch_set_manifest) */
+typedef enum {
+    BATCH_REBUILT,              /* Encoded */
+    BATCH_SKIPPED,              /* Already up to date, left as is */
+    BATCH_REUSED,               /* Copied from an identical encode elsewhere */
+    BATCH_DUPLICATE             /* Same input as duplicate_of, which was encoded for both */
+} BatchReuse;
+
+/* Encoder effort picked for a job (see batch_set_deadline) */
+typedef struct {
+    int method;                 /* Method it was encoded with, -1 if not encoded */
+    bool deadline;              /* Picked for a deadline, else the params' method */
+    double seconds_left;        /* To the deadline when its encode started */
+    double predicted_seconds;   /* Encoding what was left at that method, < 0 if unknown */
+} BatchEffort;
+
+/* One file in a batch */
+typedef struct {
+    const char *input_path;
+    const char *output_path;
+
+    /* Filled in by the engine before the job is reported complete */
+    size_t input_size;
+    size_t predicted_bytes;     /* Predicted peak memory (0 if never probed) */
+    uint64_t input_hash;        /* Content hash (0 unless a manifest is set) */
+    BatchReuse reuse;
+    int duplicate_of;           /* Job whose output this one shares, or -1 */
+    CopyMethod copy_method;     /* How a reused or duplicate output was made */
+    BatchEffort effort;
+    ConversionResult result;
+} BatchJob;
+
+/* Memory use of the current (or last) batch */
+typedef struct {
+    size_t budget;              /* Bytes the predictions in flight may add up to */
+    size_t predicted_peak;      /* Highest sum of predictions in flight */
+    size_t measured_peak;       /* Growth of the process peak RSS over the batch */
+    int reordered;              /* Jobs admitted ahead of an older waiting job */
+} BatchMemoryStats;
+
+/* Progress of the current (or last) batch */
+typedef struct {
+    int finished;               /* Jobs done, failed or cancelled */
+    int total;
+    float fraction;             /* 0-1, jobs being encoded counted part way */
+    double elapsed_seconds;
+    double eta_seconds;         /* Time left at the pace so far, < 0 if unknown yet */
+} BatchProgress;
+
+typedef struct BatchEngine BatchEngine;
+
+/* Create an engine with its worker threads; thread_count <= 0 uses every core */
+BatchEngine* batch_create(int thread_count);
+
+/*
+ * Set the memory budget for later batches; 0 picks the default (half of
+ * physical memory). Jobs are only admitted while their predicted peaks
+ * fit, except that a job over the whole budget may run alone.
+ */
+void batch_set_memory_budget(BatchEngine *engine, size_t bytes);
+
+/*
+ * Check later batches against manifest (NULL: off). Every input is then
+ * read and hashed first, in parallel; jobs whose output the manifest
+ * shows up to date for the same content and params are reported at once
+ * as BATCH_SKIPPED, and jobs that an intact output elsewhere already
+ * encoded get a copy of it (BATCH_REUSED). Only the rest are encoded.
+ * The manifest is only read; record the finished jobs in it afterwards.
+ */
+void batch_set_manifest(BatchEngine *engine, const Manifest *manifest);
+
+/*
+ * Encode each distinct input of later batches once. Every input is read
+ * and hashed first, as with a manifest; jobs with the same bytes as an
+ * earlier job become its BATCH_DUPLICATE, and get a reflink, hard link or
+ * copy of its output (or its failure) when it completes.
+ */
+void batch_set_dedupe(BatchEngine *engine, bool enabled);
+
+/*
+ * Give later batches seconds of wall-clock time from batch_start() (0:
+ * off). Each encode then picks its own method: the highest whose encode
+ * cost per megapixel, measured on the batch's finished files, lets the
+ * files left finish in time, or 0 if none does. Until a file has been
+ * measured the params' method is used. The pick is in job->effort.
+ */
+void batch_set_deadline(BatchEngine *engine, double seconds);
+
+/*
+ * Record every output of the last batch in manifest, under its content
+ * hash and the hash of the params it was encoded with (with the method a
+ * deadline picked, if any). Call once all jobs are reported.
+ */
+bool batch_record_manifest(const BatchEngine *engine, Manifest *manifest);
+
+/* Wait for the running batch (if any) and stop the workers */
+void batch_destroy(BatchEngine *engine);
+
+/*
+ * Start converting jobs[0..count-1] with a copy of params.
+ * The jobs array must stay valid until every job has been reported.
+ * Returns false if a batch is still running.
+ */
+bool batch_start(BatchEngine *engine, BatchJob *jobs, int count,
+                 const ConversionParams *params);
+
+/*
+ * Cancel the running batch. Encodes in flight stop at their next progress
+ * checkpoint and leave no output; jobs not started yet are reported
+ * without being read. Every job is still reported, with result.cancelled
+ * set on those that did not finish. Only sets a flag, so it may be called
+ * from any thread or a signal handler.
+ */
+void batch_cancel(BatchEngine *engine);
+
+/* Fraction (0-1) of one job of the current batch done so far */
+float batch_job_progress(const BatchEngine *engine, int job_index);
+
+/* Aggregate progress and estimated time left of the current batch */
+bool batch_progress(const BatchEngine *engine, BatchProgress *progress);
+
+/* Pop one finished job index without blocking; false if none is ready */
+bool batch_poll(BatchEngine *engine, int *job_index);
+
+/* Block until a job finishes; false once every job has been reported */
+bool batch_wait_next(BatchEngine *engine, int *job_index);
+
+/* True while some job of the current batch has not been reported yet */
+bool batch_is_running(const BatchEngine *engine);
+
+/* Number of worker threads */
+int batch_thread_count(const BatchEngine *engine);
+
+/* Most jobs a batch holds in memory at once, whatever the budget */
+int batch_job_limit(const BatchEngine *engine);
+
+/*
+ * Budget and predicted versus measured peak of the current or last batch.
+ * The measured peak is the process RSS growth since batch_start(): on
+ * Linux the peak is restarted per batch, elsewhere it only counts growth
+ * past earlier peaks. Read it once the batch is done.
+ */
+bool batch_memory_stats(BatchEngine *engine, BatchMemoryStats *stats);
+
+/* Worker pool, for short parallel jobs while no batch is running */
+ThreadPool* batch_get_pool(BatchEngine *engine);
+
+#endif /* BATCH_H */
@@ -0,0 +1,306 @@
+/*
+ * WebP Converter - Conversion benchmark
+ *
+ * Generates the synthetic corpus (or reuses the files of an earlier run),
+ * then loads and converts every image with each preset through
+ * converter_load_image() and converter_to_webp(), and prints throughput,
+ * per-stage latency percentiles, peak RSS and output sizes as JSON, to be
+ * compared between builds on the same machine.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <webp/encode.h>
+#include "converter.h"
+#include "presets.h"
+#include "corpus.h"
+
+/* Stages timed for every conversion, in the order they are reported */
+typedef enum {
+    STAGE_LOAD,             /* converter_load_image(): read and decode */
+    STAGE_ANALYZE,
+    STAGE_IMPORT,
+    STAGE_ENCODE,
+    STAGE_WRITE,
+    STAGE_TOTAL,            /* Load and convert, wall time */
+    STAGE_COUNT
+} Stage;
+
+static const char *const STAGE_NAMES[STAGE_COUNT] = {
+    "load", "analyze", "import", "encode", "write", "total"
+};
+
+/* One preset over the whole corpus */
+typedef struct {
+    double *samples[STAGE_COUNT];   /* One per image and run */
+    int sample_count;
+    double megapixels;              /* Converted, all runs */
+    double seconds;                 /* Spent loading and converting */
+    size_t output_bytes;            /* One run */
+    size_t peak_rss;
+    int failed;
+    double *best_ms;                /* Per image: fastest run */
+    size_t *file_bytes;             /* Per image */
+} PresetRun;
+
+static void print_usage(const char *program) {
+    printf("Usage: %s [options]\n\n", program);
+    printf("Benchmark the converter on a generated corpus; JSON results on stdout.\n\n");
+    printf("Options:\n");
+    printf("  -c, --corpus DIR       Where the corpus images are kept (default: bench-corpus)\n");
+    printf("  -r, --runs N           Conversions per image and preset (default: 3)\n");
+    printf("  -m, --max-mp N         Skip images over N megapixels (default: all, up to 50)\n");
+    printf("  -p, --preset NAME      Only this preset (default: every preset)\n");
+    printf("  -h, --help             Show this help\n");
+}
+
+static bool parse_int(const char *text, int min, int max, int *out) {
+    char *end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (errno || end == text || *end != '\0' || value < min || value > max) {
+        return false;
+    }
+    *out = (int)value;
+    return true;
+}
+
+static bool parse_double(const char *text, double min, double max, double *out) {
+    char *end;
+    errno = 0;
+    double value = strtod(text, &end);
+    if (errno || end == text || *end != '\0' || value < min || value > max) {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted values */
+static double percentile(const double *sorted, int count, double p) {
+    if (count == 0) return 0.0;
+    int rank = (int)ceil(p / 100.0 * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static bool preset_run_init(PresetRun *run, int samples, int images) {
+    memset(run, 0, sizeof(PresetRun));
+    bool ok = true;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        run->samples[s] = malloc(sizeof(double) * (samples > 0 ? samples : 1));
+        ok = ok && run->samples[s];
+    }
+    run->best_ms = calloc(images > 0 ? images : 1, sizeof(double));
+    run->file_bytes = calloc(images > 0 ? images : 1, sizeof(size_t));
+    return ok && run->best_ms && run->file_bytes;
+}
+
+static void preset_run_free(PresetRun *run) {
+    for (int s = 0; s < STAGE_COUNT; s++) free(run->samples[s]);
+    free(run->best_ms);
+    free(run->file_bytes);
+}
+
+/* Load and convert image index of the corpus once, adding its timings to run */
+static void bench_one(PresetRun *run, int index, const char *input, const char *output,
+                      const ConversionParams *params) {
+    double start = converter_now_ms();
+    ImageData image;
+    if (!converter_load_image(input, &image)) {
+        run->failed++;
+        return;
+    }
+    double loaded = converter_now_ms();
+    ConversionResult result = converter_to_webp(&image, output, params, NULL);
+    double end = converter_now_ms();
+
+    if (!result.success) {
+        fprintf(stderr, "bench: %s: %s\n", input, result.error_message);
+        run->failed++;
+        converter_free_image(&image);
+        return;
+    }
+
+    int n = run->sample_count++;
+    run->samples[STAGE_LOAD][n] = loaded - start;
+    run->samples[STAGE_ANALYZE][n] = result.timings.analyze_ms;
+    run->samples[STAGE_IMPORT][n] = result.timings.import_ms;
+    run->samples[STAGE_ENCODE][n] = result.timings.encode_ms;
+    run->samples[STAGE_WRITE][n] = result.timings.write_ms;
+    run->samples[STAGE_TOTAL][n] = end - start;
+
+    run->megapixels += (double)image.width * image.height / 1e6;
+    run->seconds += (end - start) / 1000.0;
+    if (run->best_ms[index] == 0.0 || end - start < run->best_ms[index]) {
+        run->best_ms[index] = end - start;
+    }
+    run->file_bytes[index] = result.output_size;
+
+    converter_free_image(&image);
+}
+
+static void write_preset(FILE *out, PresetType preset, PresetRun *run,
+                         const CorpusImage *images, int image_count) {
+    fprintf(out, "    {\"preset\": \"%s\", \"megapixels\": %.3f, \"seconds\": %.3f, "
+                 "\"mp_per_s\": %.3f, \"output_bytes\": %zu, \"peak_rss\": %zu, \"failed\": %d,\n",
+            presets_get_name(preset), run->megapixels, run->seconds,
+            run->seconds > 0 ? run->megapixels / run->seconds : 0.0,
+            run->output_bytes, run->peak_rss, run->failed);
+
+    fprintf(out, "     \"latency_ms\": {");
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        double *values = run->samples[s];
+        qsort(values, run->sample_count, sizeof(double), compare_doubles);
+        fprintf(out, "%s\n       \"%s\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+                s ? "," : "", STAGE_NAMES[s],
+                percentile(values, run->sample_count, 50), percentile(values, run->sample_count, 90),
+                percentile(values, run->sample_count, 99), percentile(values, run->sample_count, 100));
+    }
+    fprintf(out, "},\n");
+
+    fprintf(out, "     \"files\": [");
+    for (int i = 0; i < image_count; i++) {
+        fprintf(out, "%s\n       {\"name\": \"%s\", \"output_bytes\": %zu, \"best_ms\": %.3f}",
+                i ? "," : "", images[i].name, run->file_bytes[i], run->best_ms[i]);
+    }
+    fprintf(out, "]}");
+}
+
+int main(int argc, char **argv) {
+    const char *corpus_dir = "bench-corpus";
+    int runs = 3;
+    double max_mp = 0.0;
+    int only_preset = -1;
+
+    static const struct option long_options[] = {
+        { "corpus", required_argument, NULL, 'c' },
+        { "runs",   required_argument, NULL, 'r' },
+        { "max-mp", required_argument, NULL, 'm' },
+        { "preset", required_argument, NULL, 'p' },
+        { "help",   no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "c:r:m:p:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c': corpus_dir = optarg; break;
+            case 'r':
+                if (!parse_int(optarg, 1, 1000000, &runs)) {
+                    fprintf(stderr, "error: --runs must be a number of at least 1: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'm':
+                if (!parse_double(optarg, 0.0, 1e6, &max_mp)) {
+                    fprintf(stderr, "error: --max-mp must be a number of megapixels: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'p': {
+                PresetType type;
+                if (!presets_find(optarg, &type)) {
+                    fprintf(stderr, "error: unknown preset '%s'\n", optarg);
+                    return 1;
+                }
+                only_preset = type;
+                break;
+            }
+            case 'h': print_usage(argv[0]); return 0;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+
+    if (mkdir(corpus_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "error: cannot create %s: %s\n", corpus_dir, strerror(errno));
+        return 1;
+    }
+
+    /* Corpus: every kind at every size within --max-mp */
+    CorpusImage images[CORPUS_KIND_COUNT * CORPUS_SIZE_COUNT];
+    char paths[CORPUS_KIND_COUNT * CORPUS_SIZE_COUNT][1024];
+    size_t input_bytes[CORPUS_KIND_COUNT * CORPUS_SIZE_COUNT];
+    int image_count = 0;
+    for (int size = 0; size < CORPUS_SIZE_COUNT; size++) {
+        for (int kind = 0; kind < CORPUS_KIND_COUNT; kind++) {
+            CorpusImage *image = &images[image_count];
+            corpus_describe((CorpusKind)kind, (CorpusSize)size, image);
+            if (max_mp > 0 && (double)image->width * image->height / 1e6 > max_mp) continue;
+
+            fprintf(stderr, "bench: preparing %s\n", image->name);
+            if (!corpus_prepare(image, corpus_dir, paths[image_count], sizeof(paths[0]))) {
+                fprintf(stderr, "error: cannot write %s/%s\n", corpus_dir, image->name);
+                return 1;
+            }
+            struct stat st;
+            input_bytes[image_count] = stat(paths[image_count], &st) == 0 ? (size_t)st.st_size : 0;
+            image_count++;
+        }
+    }
+
+    char output[1024];
+    snprintf(output, sizeof(output), "%s/bench-output.webp", corpus_dir);
+
+    int version = WebPGetEncoderVersion();
+    printf("{\n  \"version\": 1,\n  \"libwebp\": \"%d.%d.%d\", \"runs\": %d,\n",
+           (version >> 16) & 0xff, (version >> 8) & 0xff, version & 0xff, runs);
+    printf("  \"corpus\": [");
+    for (int i = 0; i < image_count; i++) {
+        printf("%s\n    {\"name\": \"%s\", \"kind\": \"%s\", \"width\": %d, \"height\": %d, "
+               "\"channels\": %d, \"megapixels\": %.3f, \"input_bytes\": %zu}",
+               i ? "," : "", images[i].name, corpus_kind_name(images[i].kind),
+               images[i].width, images[i].height, images[i].channels,
+               (double)images[i].width * images[i].height / 1e6, input_bytes[i]);
+    }
+    printf("],\n  \"presets\": [\n");
+
+    bool first = true;
+    int failed = 0;
+    for (int p = 0; p < PRESET_COUNT; p++) {
+        if (only_preset >= 0 && p != only_preset) continue;
+
+        PresetRun run;
+        if (!preset_run_init(&run, image_count * runs, image_count)) {
+            fprintf(stderr, "error: out of memory\n");
+            preset_run_free(&run);
+            return 1;
+        }
+
+        ConversionParams params;
+        converter_init_params(&params);
+        presets_apply((PresetType)p, &params);
+
+        converter_reset_peak_rss();
+        for (int i = 0; i < image_count; i++) {
+            for (int r = 0; r < runs; r++) {
+                bench_one(&run, i, paths[i], output, &params);
+            }
+            run.output_bytes += run.file_bytes[i];
+            fprintf(stderr, "bench: %-9s %-24s %10.1f ms %10zu bytes\n",
+                    presets_get_name((PresetType)p), images[i].name,
+                    run.best_ms[i], run.file_bytes[i]);
+        }
+        run.peak_rss = converter_peak_rss();
+
+        if (!first) printf(",\n");
+        write_preset(stdout, (PresetType)p, &run, images, image_count);
+        first = false;
+        failed += run.failed;
+        preset_run_free(&run);
+        fflush(stdout);
+    }
+    printf("\n  ]\n}\n");
+
+    remove(output);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,696 @@
+/*
+ * WebP Converter - Headless batch command line tool
+ *
+ * Converts files, globs or whole directories to WebP using the same
+ * engine as the GUI, spread over a pool of worker threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <glob.h>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include "converter.h"
+#include "content.h"
+#include "presets.h"
+#include "batch.h"
+#include "report.h"
+#include "trace.h"
+#include "pool.h"
+#include "scan.h"
+
+/* One file to convert */
+typedef struct {
+    char *input_path;
+    size_t relative;        /* Offset of the part mirrored under -o */
+    char output_path[1024];
+} CliJob;
+
+/* Growable list of jobs */
+typedef struct {
+    CliJob *items;
+    int count;
+    int capacity;
+} CliJobList;
+
+/* Engine of the running batch, for the SIGINT handler */
+static BatchEngine *interrupted_engine;
+
+/* First Ctrl-C cancels cleanly (no partial outputs), a second one kills */
+static void handle_interrupt(int signo) {
+    batch_cancel(interrupted_engine);
+}
+
+static void print_usage(const char *argv0) {
+    printf("Usage: %s [options] <file|directory|glob>...\n\n", argv0);
+    printf("Converts PNG, JPEG, BMP and GIF images to WebP.\n");
+    printf("Directories are scanned recursively for supported images.\n\n");
+    printf("Options:\n");
+    printf("  -p, --preset NAME        low, medium, high, lossless, web, photo, thumbnail,\n"
+           "                           auto (default: medium)\n");
+    printf("  -q, --quality N          Lossy quality 0-100\n");
+    printf("  -m, --method N           Compression effort 0-6\n");
+    printf("  -l, --lossless           Use lossless encoding\n");
+    printf("      --best-of            Encode lossy and lossless, keep the smaller\n");
+    printf("      --keyframe-interval N\n"
+           "                           Animated GIFs: a full frame at least every N frames\n"
+           "                           (default: 0, the first frame only)\n");
+    printf("      --minimize-size      Animated GIFs: also try each frame whole, keep the smaller\n");
+    printf("  -a, --alpha-quality N    Alpha channel quality 0-100\n");
+    printf("  -f, --filter N           Deblocking filter strength 0-100\n");
+    printf("  -s, --sharpness N        Filter sharpness 0-7\n");
+    printf("      --preprocessing N    Preprocessing filter 0-2\n");
+    printf("  -t, --target-size SIZE   Highest lossy quality that fits SIZE bytes (k/M suffix)\n");
+    printf("      --min-ssim X         Lowest lossy quality with SSIM >= X (0-1)\n");
+    printf("      --min-psnr DB        Lowest lossy quality with PSNR >= DB\n");
+    printf("  -o, --output DIR         Write outputs to DIR (default: next to source)\n");
+    printf("  -j, --jobs N             Worker threads (default: all %d cores)\n", pool_cpu_count());
+    printf("      --memory-budget SIZE Memory the jobs in flight may use (k/M/G suffix,\n");
+    printf("                           default: half of physical memory)\n");
+    printf("      --report FILE        Write a JSON report with per-file timings and\n");
+    printf("                           encoder statistics\n");
+    printf("      --trace FILE         Write a Chrome/Perfetto timeline of every stage\n");
+    printf("      --dedupe             Encode identical inputs once; link or copy the output\n");
+    printf("                           to the others (reflink, hardlink, else copy)\n");
+    printf("      --incremental        Skip files whose output is up to date, copy outputs\n");
+    printf("                           of identical inputs (manifest: %s)\n", MANIFEST_FILE_NAME);
+    printf("      --deadline TIME      Finish within TIME seconds (m/h suffix): pick each\n");
+    printf("                           file's method from the encode speed measured so far\n");
+    printf("  -v, --verbose            Per-file encoder details\n");
+    printf("      --quiet              Only print the final summary\n");
+    printf("  -h, --help               Show this help\n");
+}
+
+static bool parse_int(const char *text, int min, int max, int *out) {
+    char *end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (errno || end == text || *end != '\0' || value < min || value > max) {
+        return false;
+    }
+    *out = (int)value;
+    return true;
+}
+
+static bool parse_float(const char *text, float min, float max, float *out) {
+    char *end;
+    errno = 0;
+    float value = strtof(text, &end);
+    if (errno || end == text || *end != '\0' || value < min || value > max) {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+/* Byte count with an optional k/K (KiB), m/M (MiB) or g/G (GiB) suffix */
+static bool parse_size(const char *text, size_t *out) {
+    char *end;
+    errno = 0;
+    double value = strtod(text, &end);
+    if (errno || end == text || value <= 0) {
+        return false;
+    }
+    if (*end == 'k' || *end == 'K') {
+        value *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        value *= 1024 * 1024;
+        end++;
+    } else if (*end == 'g' || *end == 'G') {
+        value *= 1024.0 * 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0' || value < 1 || value > (double)SIZE_MAX / 2) {
+        return false;
+    }
+    *out = (size_t)value;
+    return true;
+}
+
+static const char* format_size(size_t bytes, char *buffer, size_t size) {
+    if (bytes < 1024) {
+        snprintf(buffer, size, "%zu B", bytes);
+    } else if (bytes < 1024 * 1024) {
+        snprintf(buffer, size, "%.1f KB", bytes / 1024.0);
+    } else if (bytes < 1024 * 1024 * 1024) {
+        snprintf(buffer, size, "%.2f MB", bytes / (1024.0 * 1024.0));
+    } else {
+        snprintf(buffer, size, "%.2f GB", bytes / (1024.0 * 1024.0 * 1024.0));
+    }
+    return buffer;
+}
+
+/* relative: tail of path to recreate under -o, NULL for the file name */
+static bool job_list_add(CliJobList *list, const char *path, const char *relative) {
+    if (list->count == list->capacity) {
+        int new_capacity = list->capacity ? list->capacity * 2 : 256;
+        CliJob *items = realloc(list->items, sizeof(CliJob) * new_capacity);
+        if (!items) return false;
+        list->items = items;
+        list->capacity = new_capacity;
+    }
+
+    CliJob *job = &list->items[list->count];
+    memset(job, 0, sizeof(CliJob));
+    job->input_path = strdup(path);
+    if (!job->input_path) return false;
+    if (!relative) {
+        const char *slash = strrchr(path, '/');
+        relative = slash ? slash + 1 : path;
+    }
+    job->relative = (size_t)(relative - path);
+
+    list->count++;
+    return true;
+}
+
+static void job_list_free(CliJobList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->items[i].input_path);
+    }
+    free(list->items);
+    list->items = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+/* Supported images below a directory, read in parallel on pool */
+static void collect_directory(CliJobList *list, ThreadPool *pool, const char *dir_path) {
+    ScanResult scan;
+    if (!scan_directory(pool, dir_path, &scan)) {
+        fprintf(stderr, "warning: cannot scan directory %s: %s\n", dir_path, strerror(errno));
+        return;
+    }
+
+    for (int i = 0; i < scan.count; i++) {
+        job_list_add(list, scan.paths[i], scan.paths[i] + scan.base);
+    }
+    scan_free(&scan);
+}
+
+static void collect_path(CliJobList *list, ThreadPool *pool, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "warning: %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        collect_directory(list, pool, path);
+    } else if (converter_is_supported(path)) {
+        job_list_add(list, path, NULL);
+    } else {
+        fprintf(stderr, "warning: %s: unsupported file type\n", path);
+    }
+}
+
+/* Arguments may be plain paths or (quoted) glob patterns */
+static void collect_argument(CliJobList *list, ThreadPool *pool, const char *arg) {
+    struct stat st;
+    if (strpbrk(arg, "*?[") == NULL || stat(arg, &st) == 0) {
+        collect_path(list, pool, arg);
+        return;
+    }
+
+    glob_t matches;
+    int rc = glob(arg, 0, NULL, &matches);
+    if (rc == GLOB_NOMATCH) {
+        fprintf(stderr, "warning: %s: no matches\n", arg);
+        return;
+    }
+    if (rc != 0) {
+        fprintf(stderr, "warning: %s: glob failed\n", arg);
+        return;
+    }
+
+    for (size_t i = 0; i < matches.gl_pathc; i++) {
+        collect_path(list, pool, matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+}
+
+static void generate_output_path(CliJob *job, const char *output_dir) {
+    char temp[sizeof(job->output_path) - 5]; /* Room for ".webp" */
+
+    if (output_dir) {
+        /* Files found in a directory argument keep their place in its tree */
+        snprintf(temp, sizeof(temp), "%s/%s", output_dir, job->input_path + job->relative);
+    } else {
+        snprintf(temp, sizeof(temp), "%s", job->input_path);
+    }
+
+    /* Replace extension with .webp */
+    char *dot = strrchr(temp, '.');
+    char *slash = strrchr(temp, '/');
+    if (dot && (!slash || dot > slash)) {
+        *dot = '\0';
+    }
+    snprintf(job->output_path, sizeof(job->output_path), "%s.webp", temp);
+}
+
+/* Seconds with an optional s, m (minutes) or h (hours) suffix */
+static bool parse_duration(const char *text, double *out) {
+    char *end;
+    errno = 0;
+    double value = strtod(text, &end);
+    if (errno || end == text || value <= 0) {
+        return false;
+    }
+    if (*end == 'm') {
+        value *= 60;
+        end++;
+    } else if (*end == 'h') {
+        value *= 3600;
+        end++;
+    } else if (*end == 's') {
+        end++;
+    }
+    if (*end != '\0' || value > 7 * 24 * 3600.0) {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+/* original: the job a duplicate shares its encode with, else NULL */
+static void print_job(const BatchJob *job, const BatchJob *original,
+                      const char *metric_name, bool verbose) {
+    char in_str[32], out_str[32];
+
+    if (job->result.success && job->reuse == BATCH_SKIPPED) {
+        /* Incremental runs are mostly these: only listed with -v */
+        if (verbose) printf("SKIP  %s (up to date)\n", job->output_path);
+    } else if (job->result.success && job->reuse == BATCH_REUSED) {
+        printf("COPY  %s -> %s (%s, identical input, %s)\n", job->input_path, job->output_path,
+               format_size(job->result.output_size, out_str, sizeof(out_str)),
+               converter_copy_method_name(job->copy_method));
+    } else if (job->result.success && original) {
+        printf("DUP   %s -> %s (%s, same as %s, %s)\n", job->input_path, job->output_path,
+               format_size(job->result.output_size, out_str, sizeof(out_str)),
+               original->input_path, converter_copy_method_name(job->copy_method));
+    } else if (job->result.success) {
+        printf("OK    %s -> %s (%s -> %s, %.1f%%)\n",
+               job->input_path, job->output_path,
+               format_size(job->input_size, in_str, sizeof(in_str)),
+               format_size(job->result.output_size, out_str, sizeof(out_str)),
+               job->input_size ? 100.0 * job->result.output_size / job->input_size : 0.0);
+        if (job->effort.deadline) {
+            printf("      effort: method %d, %.1f s left, ", job->effort.method, job->effort.seconds_left);
+            if (job->effort.predicted_seconds >= 0) {
+                printf("%.1f s predicted for the rest\n", job->effort.predicted_seconds);
+            } else {
+                printf("nothing measured yet\n");
+            }
+        }
+        if (verbose) {
+            printf("      quality: %.0f", job->result.quality);
+            if (job->result.metric > 0) {
+                printf(", %s: %.4f", metric_name, job->result.metric);
+            }
+            printf(", threads: %d", job->result.threads);
+            if (job->result.frames > 0) printf(", frames: %d", job->result.frames);
+            if (job->result.content != CONTENT_NONE) {
+                printf(", content: %s (%s)", content_class_name(job->result.content),
+                       job->result.lossless ? "lossless" : "lossy");
+            }
+            if (job->result.runner_up_size > 0) {
+                printf(", best of: %s (%s %s)", job->result.lossless ? "lossless" : "lossy",
+                       job->result.lossless ? "lossy" : "lossless",
+                       format_size(job->result.runner_up_size, out_str, sizeof(out_str)));
+            }
+            printf(", buffer allocations: %d", job->result.allocations);
+            printf(", predicted memory: %s\n",
+                   format_size(job->predicted_bytes, in_str, sizeof(in_str)));
+            const StageTimings *t = &job->result.timings;
+            printf("      read %.1f ms, decode %.1f ms, analyze %.1f ms, import %.1f ms, "
+                   "encode %.1f ms, write %.1f ms, peak buffers: %s\n",
+                   t->read_ms, t->decode_ms, t->analyze_ms, t->import_ms, t->encode_ms, t->write_ms,
+                   format_size(job->result.peak_bytes, in_str, sizeof(in_str)));
+        }
+    } else if (!job->result.cancelled) {
+        printf("FAIL  %s: %s\n", job->input_path, job->result.error_message);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    ConversionParams params;
+    presets_apply(PRESET_MEDIUM, &params);
+
+    /* Explicit settings override the preset, whatever the argument order */
+    PresetType preset = PRESET_MEDIUM;
+    float quality = -1.0f, alpha_quality = -1.0f;
+    int method = -1, filter = -1, sharpness = -1, preprocessing = -1, keyframe_interval = -1;
+    bool lossless = false, best_of = false, minimize_size = false, quiet = false, verbose = false;
+    bool incremental = false, dedupe = false;
+    double deadline = 0.0;
+    const char *output_dir = NULL, *report_path = NULL, *trace_path = NULL;
+    size_t target_size = 0, memory_budget = 0;
+    float min_ssim = -1.0f, min_psnr = -1.0f;
+    int jobs = 0;
+
+    enum { OPT_PREPROCESSING = 256, OPT_QUIET, OPT_MIN_SSIM, OPT_MIN_PSNR, OPT_MEMORY_BUDGET,
+           OPT_REPORT, OPT_TRACE, OPT_BEST_OF, OPT_KEYFRAME_INTERVAL, OPT_MINIMIZE_SIZE,
+           OPT_INCREMENTAL, OPT_DEDUPE, OPT_DEADLINE };
+    static const struct option long_options[] = {
+        { "preset",        required_argument, NULL, 'p' },
+        { "quality",       required_argument, NULL, 'q' },
+        { "method",        required_argument, NULL, 'm' },
+        { "lossless",      no_argument,       NULL, 'l' },
+        { "best-of",       no_argument,       NULL, OPT_BEST_OF },
+        { "keyframe-interval", required_argument, NULL, OPT_KEYFRAME_INTERVAL },
+        { "minimize-size", no_argument,       NULL, OPT_MINIMIZE_SIZE },
+        { "alpha-quality", required_argument, NULL, 'a' },
+        { "filter",        required_argument, NULL, 'f' },
+        { "sharpness",     required_argument, NULL, 's' },
+        { "preprocessing", required_argument, NULL, OPT_PREPROCESSING },
+        { "target-size",   required_argument, NULL, 't' },
+        { "min-ssim",      required_argument, NULL, OPT_MIN_SSIM },
+        { "min-psnr",      required_argument, NULL, OPT_MIN_PSNR },
+        { "output",        required_argument, NULL, 'o' },
+        { "jobs",          required_argument, NULL, 'j' },
+        { "memory-budget", required_argument, NULL, OPT_MEMORY_BUDGET },
+        { "report",        required_argument, NULL, OPT_REPORT },
+        { "trace",         required_argument, NULL, OPT_TRACE },
+        { "incremental",   no_argument,       NULL, OPT_INCREMENTAL },
+        { "dedupe",        no_argument,       NULL, OPT_DEDUPE },
+        { "deadline",      required_argument, NULL, OPT_DEADLINE },
+        { "verbose",       no_argument,       NULL, 'v' },
+        { "quiet",         no_argument,       NULL, OPT_QUIET },
+        { "help",          no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:q:m:la:f:s:t:o:j:vh", long_options, NULL)) != -1) {
+        bool ok = true;
+        switch (opt) {
+            case 'p': ok = presets_find(optarg, &preset); break;
+            case 'q': ok = parse_float(optarg, 0.0f, 100.0f, &quality); break;
+            case 'm': ok = parse_int(optarg, 0, 6, &method); break;
+            case 'l': lossless = true; break;
+            case OPT_BEST_OF: best_of = true; break;
+            case OPT_KEYFRAME_INTERVAL: ok = parse_int(optarg, 0, 100000, &keyframe_interval); break;
+            case OPT_MINIMIZE_SIZE: minimize_size = true; break;
+            case 'a': ok = parse_float(optarg, 0.0f, 100.0f, &alpha_quality); break;
+            case 'f': ok = parse_int(optarg, 0, 100, &filter); break;
+            case 's': ok = parse_int(optarg, 0, 7, &sharpness); break;
+            case OPT_PREPROCESSING: ok = parse_int(optarg, 0, 2, &preprocessing); break;
+            case 't': ok = parse_size(optarg, &target_size); break;
+            case OPT_MIN_SSIM: ok = parse_float(optarg, 0.0f, 1.0f, &min_ssim); break;
+            case OPT_MIN_PSNR: ok = parse_float(optarg, 0.0f, 99.0f, &min_psnr); break;
+            case 'o': output_dir = optarg; break;
+            case 'j': ok = parse_int(optarg, 1, 1024, &jobs); break;
+            case OPT_MEMORY_BUDGET: ok = parse_size(optarg, &memory_budget); break;
+            case OPT_REPORT: report_path = optarg; break;
+            case OPT_TRACE: trace_path = optarg; break;
+            case OPT_INCREMENTAL: incremental = true; break;
+            case OPT_DEDUPE: dedupe = true; break;
+            case OPT_DEADLINE: ok = parse_duration(optarg, &deadline); break;
+            case 'v': verbose = true; break;
+            case OPT_QUIET: quiet = true; break;
+            case 'h': print_usage(argv[0]); return 0;
+            default: print_usage(argv[0]); return 2;
+        }
+        if (!ok) {
+            fprintf(stderr, "error: invalid value for -%c: %s\n", opt < 256 ? opt : '-', optarg);
+            return 2;
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    presets_apply(preset, &params);
+    if (quality >= 0) params.quality = quality;
+    if (method >= 0) params.method = method;
+    if (lossless) {
+        params.lossless = true;
+        params.auto_content = false;
+    }
+    if (best_of) params.best_of = true;
+    if (keyframe_interval >= 0) params.keyframe_interval = keyframe_interval;
+    if (minimize_size) params.minimize_size = true;
+    if (alpha_quality >= 0) params.alpha_quality = alpha_quality;
+    if (filter >= 0) params.filter_strength = filter;
+    if (sharpness >= 0) params.filter_sharpness = sharpness;
+    if (preprocessing >= 0) params.preprocessing = preprocessing;
+
+    /* Target modes replace the fixed quality with a search */
+    int targets = (target_size > 0) + (min_ssim >= 0) + (min_psnr >= 0);
+    if (targets > 1) {
+        fprintf(stderr, "error: --target-size, --min-ssim and --min-psnr are exclusive\n");
+        return 2;
+    }
+    if (targets == 1 && params.lossless) {
+        fprintf(stderr, "error: target modes search lossy quality and cannot be combined with lossless\n");
+        return 2;
+    }
+    if (targets == 1 && params.best_of) {
+        fprintf(stderr, "error: target modes search lossy quality and cannot be combined with --best-of\n");
+        return 2;
+    }
+    if (lossless && best_of) {
+        fprintf(stderr, "error: --lossless and --best-of are exclusive\n");
+        return 2;
+    }
+    if (target_size > 0) {
+        params.target_mode = TARGET_SIZE;
+        params.target_size = target_size;
+    } else if (min_ssim >= 0) {
+        params.target_mode = TARGET_SSIM;
+        params.target_metric = min_ssim;
+    } else if (min_psnr >= 0) {
+        params.target_mode = TARGET_PSNR;
+        params.target_metric = min_psnr;
+    }
+    const char *metric_name = (params.target_mode == TARGET_PSNR) ? "PSNR" : "SSIM";
+
+    if (output_dir && mkdir(output_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "error: cannot create %s: %s\n", output_dir, strerror(errno));
+        return 1;
+    }
+
+    /* Workers first: directories are scanned on them */
+    BatchEngine *engine = batch_create(jobs);
+    if (!engine) {
+        fprintf(stderr, "error: failed to start worker threads\n");
+        return 1;
+    }
+
+    /* Gather inputs */
+    CliJobList list = {0};
+    for (int i = optind; i < argc; i++) {
+        collect_argument(&list, batch_get_pool(engine), argv[i]);
+    }
+
+    if (list.count == 0) {
+        fprintf(stderr, "error: no supported images found\n");
+        batch_destroy(engine);
+        job_list_free(&list);
+        return 1;
+    }
+
+    /* Output paths, and the subdirectories of -o they need (each created once) */
+    DirCache *dirs = output_dir ? dircache_create() : NULL;
+    for (int i = 0; i < list.count; i++) {
+        CliJob *job = &list.items[i];
+        generate_output_path(job, output_dir);
+        if (dirs && !dircache_make_parent(dirs, job->output_path)) {
+            fprintf(stderr, "warning: cannot create directory for %s: %s\n",
+                    job->output_path, strerror(errno));
+        }
+    }
+    dircache_destroy(dirs);
+
+    /* Convert */
+    BatchJob *batch_jobs = calloc(list.count, sizeof(BatchJob));
+    if (!batch_jobs) {
+        fprintf(stderr, "error: out of memory\n");
+        batch_destroy(engine);
+        job_list_free(&list);
+        return 1;
+    }
+
+    batch_set_memory_budget(engine, memory_budget);
+
+    for (int i = 0; i < list.count; i++) {
+        batch_jobs[i].input_path = list.items[i].input_path;
+        batch_jobs[i].output_path = list.items[i].output_path;
+    }
+
+    /* What earlier runs built, next to the outputs */
+    Manifest *manifest = NULL;
+    if (incremental) {
+        char manifest_path[1024];
+        const char **outputs = malloc(list.count * sizeof(char *));
+        if (outputs) {
+            for (int i = 0; i < list.count; i++) outputs[i] = batch_jobs[i].output_path;
+            if (manifest_default_path(output_dir, outputs, list.count,
+                                      manifest_path, sizeof(manifest_path))) {
+                manifest = manifest_load(manifest_path);
+            }
+            free(outputs);
+        }
+        if (!manifest) fprintf(stderr, "warning: incremental mode off, no manifest\n");
+        batch_set_manifest(engine, manifest);
+    }
+    /* The inputs are hashed for the manifest anyway */
+    batch_set_dedupe(engine, dedupe || incremental);
+    batch_set_deadline(engine, deadline);
+
+    if (!quiet) {
+        int threads = batch_thread_count(engine);
+        printf("Converting %d file%s with %d worker%s (preset: %s)\n",
+               list.count, list.count != 1 ? "s" : "",
+               threads, threads != 1 ? "s" : "",
+               presets_get_name(preset));
+    }
+
+    int converted = 0, failed = 0, cancelled = 0, allocations = 0, skipped = 0, reused = 0;
+    int duplicates = 0, linked[COPY_BYTES + 1] = {0};
+    size_t duplicate_input = 0;
+    size_t total_input = 0, total_output = 0;
+    int methods_used[7] = {0};
+
+    if (trace_path) trace_start();
+    double start_ms = converter_now_ms();
+    if (!batch_start(engine, batch_jobs, list.count, &params)) {
+        trace_stop();
+        fprintf(stderr, "error: failed to start batch\n");
+        batch_destroy(engine);
+        manifest_free(manifest);
+        free(batch_jobs);
+        job_list_free(&list);
+        return 1;
+    }
+
+    interrupted_engine = engine;
+    struct sigaction interrupt = {0};
+    interrupt.sa_handler = handle_interrupt;
+    interrupt.sa_flags = SA_RESETHAND;
+    sigemptyset(&interrupt.sa_mask);
+    sigaction(SIGINT, &interrupt, NULL);
+
+    int index;
+    while (batch_wait_next(engine, &index)) {
+        const BatchJob *job = &batch_jobs[index];
+        if (job->result.success) {
+            converted++;
+            total_input += job->input_size;
+            total_output += job->result.output_size;
+            if (job->reuse == BATCH_SKIPPED) skipped++;
+            else if (job->reuse == BATCH_REUSED) reused++;
+            if (job->reuse == BATCH_DUPLICATE) {
+                duplicates++;
+                duplicate_input += job->input_size;
+                linked[job->copy_method]++;
+            }
+            if (job->effort.method >= 0 && job->effort.method < 7) methods_used[job->effort.method]++;
+        } else if (job->result.cancelled) {
+            cancelled++;
+        } else {
+            failed++;
+        }
+        allocations += job->result.allocations;
+        if (!quiet) {
+            print_job(job, job->duplicate_of >= 0 ? &batch_jobs[job->duplicate_of] : NULL,
+                      metric_name, verbose);
+        }
+    }
+
+    signal(SIGINT, SIG_DFL);
+    double elapsed = (converter_now_ms() - start_ms) / 1000.0;
+
+    BatchMemoryStats memory;
+    batch_memory_stats(engine, &memory);
+
+    /* Even after a failure or ^C, what was built is recorded */
+    if (manifest) {
+        if (!batch_record_manifest(engine, manifest) || !manifest_save(manifest)) {
+            fprintf(stderr, "warning: cannot update manifest: %s\n", strerror(errno));
+        }
+        manifest_free(manifest);
+    }
+    batch_destroy(engine);
+
+    /* The stage threads are gone: their buffers can be read */
+    bool trace_failed = false;
+    if (trace_path) {
+        const char **names = malloc(list.count * sizeof(char *));
+        if (names) {
+            for (int i = 0; i < list.count; i++) names[i] = batch_jobs[i].input_path;
+        }
+        if (!trace_write(trace_path, names, names ? list.count : 0)) {
+            fprintf(stderr, "error: cannot write trace %s: %s\n", trace_path, strerror(errno));
+            trace_failed = true;
+        }
+        free(names);
+    }
+
+    /* Summary */
+    char in_str[32], out_str[32];
+    printf("Done: %d converted, %d failed, ", converted, failed);
+    if (cancelled > 0) printf("%d cancelled, ", cancelled);
+    printf("%s -> %s",
+           format_size(total_input, in_str, sizeof(in_str)),
+           format_size(total_output, out_str, sizeof(out_str)));
+    if (total_input > total_output) {
+        printf(" (saved %d%%)", (int)(100.0 * (total_input - total_output) / total_input));
+    }
+    printf("\n");
+    if (incremental) {
+        printf("Incremental: %d rebuilt, %d up to date, %d copied from identical inputs\n",
+               converted - skipped - reused - duplicates, skipped, reused);
+    }
+    if (duplicates > 0) {
+        printf("Duplicates: %d file%s shared an encode, %s not decoded again "
+               "(%d reflink, %d hardlink, %d copy)\n",
+               duplicates, duplicates != 1 ? "s" : "",
+               format_size(duplicate_input, in_str, sizeof(in_str)),
+               linked[COPY_REFLINK], linked[COPY_HARDLINK], linked[COPY_BYTES]);
+    }
+
+    if (deadline > 0) {
+        printf("Deadline: %.1f s of %.1f s (%s), methods:", elapsed, deadline,
+               elapsed <= deadline ? "met" : "missed");
+        for (int method = 6; method >= 0; method--) {
+            if (methods_used[method] > 0) printf(" %d x%d", method, methods_used[method]);
+        }
+        printf("\n");
+    }
+
+    char budget_str[32];
+    printf("Memory: predicted peak %s, measured %s (budget %s",
+           format_size(memory.predicted_peak, in_str, sizeof(in_str)),
+           format_size(memory.measured_peak, out_str, sizeof(out_str)),
+           format_size(memory.budget, budget_str, sizeof(budget_str)));
+    if (memory.reordered > 0) {
+        printf(", %d file%s run ahead of larger ones", memory.reordered,
+               memory.reordered != 1 ? "s" : "");
+    }
+    printf(")\n");
+    if (verbose) {
+        printf("Buffer allocations: %d over %d files\n", allocations, list.count);
+    }
+
+    bool report_failed = false;
+    if (report_path && !report_write_json(report_path, batch_jobs, list.count, &params, &memory)) {
+        fprintf(stderr, "error: cannot write report %s: %s\n", report_path, strerror(errno));
+        report_failed = true;
+    }
+
+    free(batch_jobs);
+    job_list_free(&list);
+
+    if (cancelled > 0) return 130;
+    return (failed > 0 || report_failed || trace_failed) ? 1 : 0;
+}
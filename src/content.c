@@ -0,0 +1,209 @@
+/*
+ * WebP Converter - Content analysis implementation
+ *
+ * One pass over (a sample of) the rows compares every pixel with its
+ * left neighbour: equal pixels count as flat, channel steps of
+ * CONTENT_EDGE_STEP or more as edges, and only pixels that differ from
+ * their neighbour go to the colour hash, so the long runs of screenshots
+ * and logos cost one vector compare per four pixels. Photos fill the
+ * colour table quickly, after which counting stops.
+ */
+
+#include "content.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+/* vaddvq_u8 is AArch64 only; 32-bit NEON counts edges in the scalar loop */
+#include <arm_neon.h>
+#endif
+
+/* Pixels analysed per image, at most (whole rows spread over the image) */
+#define CONTENT_SAMPLE_PIXELS (1024 * 1024)
+
+/* Channel difference to the left neighbour that counts as an edge */
+#define CONTENT_EDGE_STEP 48
+
+/* Open-addressing colour table, twice the cap so probes stay short */
+#define CONTENT_HASH_BITS 13
+#define CONTENT_HASH_SIZE (1 << CONTENT_HASH_BITS)
+
+/* Images up to this many pixels with few colours are icons */
+#define CONTENT_ICON_PIXELS (256 * 256)
+
+/* Running counts of one analysis */
+typedef struct {
+    uint32_t keys[CONTENT_HASH_SIZE];
+    uint8_t used[CONTENT_HASH_SIZE];
+    int colors;
+    size_t pixels;
+    size_t flat;
+    size_t edges;           /* Channel steps, not pixels */
+    size_t translucent;
+} ContentScan;
+
+static void count_color(ContentScan *scan, uint32_t color) {
+    if (scan->colors >= CONTENT_COLOR_CAP) return;
+
+    uint32_t slot = (color * 2654435761u) >> (32 - CONTENT_HASH_BITS);
+    while (scan->used[slot]) {
+        if (scan->keys[slot] == color) return;
+        slot = (slot + 1) & (CONTENT_HASH_SIZE - 1);
+    }
+    scan->used[slot] = 1;
+    scan->keys[slot] = color;
+    scan->colors++;
+}
+
+static uint32_t load_color(const uint8_t *p, int channels) {
+    uint32_t alpha = (channels == 4) ? p[3] : 255;
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | (alpha << 24);
+}
+
+/* Pixels [first, end) of a row: flat, translucent and new colours */
+static void scan_pixels(ContentScan *scan, const uint8_t *row, int channels, int first, int end) {
+    for (int x = first; x < end; x++) {
+        const uint8_t *p = row + (size_t)x * channels;
+        uint32_t color = load_color(p, channels);
+        if (channels == 4 && p[3] != 0 && p[3] != 255) scan->translucent++;
+        if (x > 0 && color == load_color(p - channels, channels)) {
+            scan->flat++;
+        } else {
+            count_color(scan, color);
+        }
+    }
+}
+
+/* Channel steps of CONTENT_EDGE_STEP or more between bytes [first, end) and their left pixel */
+static size_t count_edges(const uint8_t *row, int channels, size_t first, size_t end) {
+    size_t edges = 0;
+    size_t i = first;
+
+#if defined(__SSE2__)
+    const __m128i threshold = _mm_set1_epi8((char)(CONTENT_EDGE_STEP - 1));
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= end; i += 16) {
+        __m128i cur = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i left = _mm_loadu_si128((const __m128i *)(row + i - channels));
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(cur, left), _mm_subs_epu8(left, cur));
+        __m128i quiet = _mm_cmpeq_epi8(_mm_subs_epu8(diff, threshold), zero);
+        edges += 16 - __builtin_popcount(_mm_movemask_epi8(quiet));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t threshold = vdupq_n_u8(CONTENT_EDGE_STEP);
+    for (; i + 16 <= end; i += 16) {
+        uint8x16_t cur = vld1q_u8(row + i);
+        uint8x16_t left = vld1q_u8(row + i - channels);
+        uint8x16_t steps = vshrq_n_u8(vcgeq_u8(vabdq_u8(cur, left), threshold), 7);
+        edges += vaddvq_u8(steps);
+    }
+#endif
+
+    for (; i < end; i++) {
+        int diff = (int)row[i] - (int)row[i - channels];
+        if (diff >= CONTENT_EDGE_STEP || diff <= -CONTENT_EDGE_STEP) edges++;
+    }
+    return edges;
+}
+
+static void scan_row(ContentScan *scan, const uint8_t *row, int width, int channels) {
+    scan->pixels += (size_t)width;
+    if (width > 1) {
+        scan->edges += count_edges(row, channels, (size_t)channels, (size_t)width * channels);
+    }
+
+#if defined(__SSE2__)
+    /* Four RGBA pixels per compare: a run of equal pixels skips the hash */
+    if (channels == 4) {
+        scan_pixels(scan, row, channels, 0, width < 1 ? 0 : 1);
+        int x = 1;
+        for (; x + 4 <= width; x += 4) {
+            __m128i cur = _mm_loadu_si128((const __m128i *)(row + (size_t)x * 4));
+            __m128i left = _mm_loadu_si128((const __m128i *)(row + (size_t)x * 4 - 4));
+            int same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(cur, left)));
+            if (same == 0xF) {
+                /* All equal to the pixel before them, translucency included */
+                uint8_t alpha = row[(size_t)x * 4 - 1];
+                scan->flat += 4;
+                if (alpha != 0 && alpha != 255) scan->translucent += 4;
+            } else {
+                scan_pixels(scan, row, channels, x, x + 4);
+            }
+        }
+        scan_pixels(scan, row, channels, x, width);
+        return;
+    }
+#endif
+
+    scan_pixels(scan, row, channels, 0, width);
+}
+
+/*
+ * Few colours mean graphics, which lossless encodes exactly and usually
+ * smaller; so do large flat areas with a bounded palette (screenshots,
+ * UI). Dense edges between flat runs read as text, sparse ones as
+ * drawings. Everything else is photographic and goes lossy, as a
+ * "picture" (renders, cut-outs) when it has flat areas or soft alpha.
+ */
+static void classify(const ImageData *image, ContentAnalysis *a) {
+    size_t pixels = (size_t)image->width * image->height;
+    bool many_colors = a->colors >= CONTENT_COLOR_CAP;
+
+    if (pixels <= CONTENT_ICON_PIXELS && a->colors <= 1024) {
+        a->content = CONTENT_ICON;
+        a->lossless = true;
+    } else if (a->colors <= 256 || (!many_colors && a->flat >= 0.5f)) {
+        a->content = (a->edges >= 0.04f) ? CONTENT_TEXT : CONTENT_DRAWING;
+        a->lossless = true;
+    } else if (a->flat >= 0.9f) {
+        /* Screenshots with gradients or photos inset: the flat runs win */
+        a->content = CONTENT_TEXT;
+        a->lossless = true;
+    } else {
+        a->content = (a->flat >= 0.2f || a->translucent >= 0.05f) ? CONTENT_PICTURE : CONTENT_PHOTO;
+        a->lossless = false;
+    }
+}
+
+bool content_analyze(const ImageData *image, ContentAnalysis *analysis) {
+    if (!image || !image->data || !analysis || image->width <= 0 || image->height <= 0 ||
+        (image->channels != 3 && image->channels != 4)) {
+        return false;
+    }
+
+    ContentScan *scan = calloc(1, sizeof(ContentScan));
+    if (!scan) return false;
+
+    /* Every row_step-th row, so large images cost about CONTENT_SAMPLE_PIXELS */
+    size_t pixels = (size_t)image->width * image->height;
+    int row_step = (int)(pixels / CONTENT_SAMPLE_PIXELS) + 1;
+    size_t stride = (size_t)image->width * image->channels;
+    for (int y = row_step / 2; y < image->height; y += row_step) {
+        scan_row(scan, image->data + (size_t)y * stride, image->width, image->channels);
+    }
+
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->colors = scan->colors;
+    if (scan->pixels > 0) {
+        analysis->flat = (float)scan->flat / (float)scan->pixels;
+        analysis->edges = (float)scan->edges / (float)(scan->pixels * image->channels);
+        analysis->translucent = (float)scan->translucent / (float)scan->pixels;
+    }
+    classify(image, analysis);
+
+    free(scan);
+    return true;
+}
+
+const char* content_class_name(ContentClass content) {
+    switch (content) {
+        case CONTENT_PHOTO:   return "photo";
+        case CONTENT_PICTURE: return "picture";
+        case CONTENT_DRAWING: return "drawing";
+        case CONTENT_ICON:    return "icon";
+        case CONTENT_TEXT:    return "text";
+        default:              return "none";
+    }
+}
@@ -0,0 +1,35 @@
+/*
+ * WebP Converter - Content analysis
+ * A fast pass over decoded pixels that tells photos from screenshots,
+ * logos and icons, so the Auto preset can pick lossless or lossy
+ * encoding and a libwebp preset hint per image.
+ */
+
+#ifndef CONTENT_H
+#define CONTENT_H
+
+#include "converter.h"
+
+/* Distinct colours counted before an image is taken as photographic */
+#define CONTENT_COLOR_CAP 4096
+
+/* What the analysis measured and what it picked */
+typedef struct {
+    int colors;             /* Distinct RGBA values seen, at most CONTENT_COLOR_CAP */
+    float flat;             /* Share of pixels equal to their left neighbour */
+    float edges;            /* Share of channel steps to the left neighbour of 48 or more */
+    float translucent;      /* Share of pixels with 0 < alpha < 255 */
+    ContentClass content;
+    bool lossless;
+} ContentAnalysis;
+
+/*
+ * Analyse image (a sample of its rows when large) and classify it.
+ * Returns false if the image is empty or scratch memory runs out.
+ */
+bool content_analyze(const ImageData *image, ContentAnalysis *analysis);
+
+/* Lower-case name of a class ("photo", "text", ...; "none" for CONTENT_NONE) */
+const char* content_class_name(ContentClass content);
+
+#endif /* CONTENT_H */
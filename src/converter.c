@@ -3,16 +3,284 @@
  */
 
 #include "converter.h"
+#include "anim.h"
+#include "content.h"
+#include "metrics.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+/* vminvq_u8 is AArch64 only; 32-bit NEON checks alpha in the scalar loop */
+#include <arm_neon.h>
+#endif
+
 #include <webp/encode.h>
+#include <webp/decode.h>
+
+/* Size of the write-combining buffer between libwebp and the output file */
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+/* Candidate qualities encoded concurrently per round of a target search */
+#define TARGET_SEARCH_WIDTH 4
+
+/* ARGB packing: fewest pixels worth a thread of their own, most bands */
+#define PACK_BAND_PIXELS (512 * 1024)
+#define PACK_MAX_BANDS 64
+
+/* Size estimates: images up to ESTIMATE_FULL_PIXELS are encoded whole,
+   larger ones through ESTIMATE_SAMPLE_FRACTION of their rows, taken as
+   strips packed into ESTIMATE_MOSAICS mosaics */
+#define ESTIMATE_FULL_PIXELS (512 * 512)
+#define ESTIMATE_SAMPLE_FRACTION 0.125
+#define ESTIMATE_STRIP_ROWS 32
+#define ESTIMATE_MOSAICS 4
+#define ESTIMATE_CONTAINER_BYTES 30     /* RIFF + chunk + frame headers */
+
+/* Growable in-memory encoder output; encoding aborts once it exceeds limit */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    size_t limit;
+    bool over_limit;        /* The last encode was aborted for passing limit */
+    int allocations;
+} MemoryOutput;
+
+/* Growable scratch pixels */
+typedef struct {
+    unsigned char *data;
+    size_t capacity;
+    int allocations;
+} PixelBuffer;
+
+/*
+ * Per-worker encoder state, reused from one image to the next: the
+ * validated WebPConfig for the last params, the ARGB plane handed to
+ * libwebp and the output buffer. Buffers only grow, so a run of images
+ * of the same (or smaller) size allocates nothing after the first one.
+ */
+struct ConverterContext {
+    ConversionParams config_params;  /* Params config was built from */
+    WebPConfig config;
+    bool config_valid;
+
+    uint32_t *argb;                  /* Picture plane, argb_capacity pixels */
+    size_t argb_capacity;
+
+    unsigned char *output_buffer;    /* OUTPUT_BUFFER_SIZE bytes */
+
+    /* Trial outputs of a target search (the last slot holds the best) */
+    MemoryOutput search_outputs[TARGET_SEARCH_WIDTH + 1];
+    PixelBuffer search_pixels[TARGET_SEARCH_WIDTH];  /* Decoded trials */
+    PixelBuffer source_luma;                         /* Metric modes */
+
+    int threads;                     /* Cores one conversion may use */
+    int allocations;                 /* Buffer allocations for current image */
+};
+
+/*
+ * Streams encoder output into a temporary file next to the destination.
+ * The file is renamed over output_path only once encoding succeeded, so a
+ * failed or interrupted encode never leaves a truncated .webp behind.
+ * Chunks are gathered in the context's output buffer and written with
+ * write(2), so no stdio (or other heap) buffer is created per file.
+ */
+typedef struct {
+    int fd;
+    char temp_path[1024];
+    unsigned char *buffer;
+    size_t buffered;
+    size_t size;
+    bool write_failed;
+    double write_ms;        /* Time spent in open/write/close/rename */
+} FileWriter;
+
+static atomic_uint temp_counter;
+
+double converter_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+size_t converter_peak_rss(void) {
+#ifdef __linux__
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[128];
+        size_t kb = 0;
+        while (fgets(line, sizeof(line), status)) {
+            if (sscanf(line, "VmHWM: %zu kB", &kb) == 1) break;
+        }
+        fclose(status);
+        if (kb > 0) return kb * 1024;
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+void converter_reset_peak_rss(void) {
+#ifdef __linux__
+    FILE *clear_refs = fopen("/proc/self/clear_refs", "w");
+    if (clear_refs) {
+        fputs("5", clear_refs);
+        fclose(clear_refs);
+    }
+#endif
+}
+
+static bool write_all(int fd, const unsigned char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, unsigned char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = read(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) return false;   /* File shrank under us */
+        data += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+/* Name, unique to this process and call, to write output_path under first */
+static bool make_temp_path(const char *output_path, char *temp_path, size_t size) {
+    int n = snprintf(temp_path, size, "%s.%ld.%u.tmp",
+                     output_path, (long)getpid(), atomic_fetch_add(&temp_counter, 1));
+    return n >= 0 && (size_t)n < size;
+}
+
+static bool file_writer_open(FileWriter *writer, const char *output_path,
+                             unsigned char *buffer) {
+    memset(writer, 0, sizeof(FileWriter));
+    writer->fd = -1;
+    writer->buffer = buffer;
+
+    if (!make_temp_path(output_path, writer->temp_path, sizeof(writer->temp_path))) return false;
+
+    /* O_EXCL: never clobber another writer's temp file */
+    double start = converter_now_ms();
+    TraceSpan span = trace_begin(TRACE_WRITE);
+    writer->fd = open(writer->temp_path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    trace_end(span);
+    writer->write_ms += converter_now_ms() - start;
+    return writer->fd >= 0;
+}
+
+static bool file_writer_flush(FileWriter *writer) {
+    if (writer->buffered > 0) {
+        double start = converter_now_ms();
+        TraceSpan span = trace_begin(TRACE_WRITE);
+        if (!write_all(writer->fd, writer->buffer, writer->buffered)) {
+            writer->write_failed = true;
+        }
+        trace_end(span);
+        writer->write_ms += converter_now_ms() - start;
+        writer->buffered = 0;
+    }
+    return !writer->write_failed;
+}
+
+/* WebPWriterFunction: called by the encoder for each chunk it produces */
+static int file_writer_write(const uint8_t *data, size_t data_size, const WebPPicture *picture) {
+    FileWriter *writer = (FileWriter *)picture->custom_ptr;
+
+    if (writer->buffered + data_size > OUTPUT_BUFFER_SIZE) {
+        if (!file_writer_flush(writer)) return 0;
+    }
+
+    if (data_size >= OUTPUT_BUFFER_SIZE) {
+        /* Large chunk: write through */
+        double start = converter_now_ms();
+        TraceSpan span = trace_begin(TRACE_WRITE);
+        if (!write_all(writer->fd, data, data_size)) {
+            writer->write_failed = true;
+        }
+        trace_end(span);
+        writer->write_ms += converter_now_ms() - start;
+    } else {
+        memcpy(writer->buffer + writer->buffered, data, data_size);
+        writer->buffered += data_size;
+    }
+
+    if (writer->write_failed) {
+        return 0; /* Aborts the encode with VP8_ENC_ERROR_BAD_WRITE */
+    }
+    writer->size += data_size;
+
+    return 1;
+}
+
+/* Flush and move into place; false (and no file left) on any error */
+static bool file_writer_commit(FileWriter *writer, const char *output_path) {
+    bool ok = file_writer_flush(writer);
+    double start = converter_now_ms();
+    TraceSpan span = trace_begin(TRACE_WRITE);
+
+    if (close(writer->fd) != 0) ok = false;
+    writer->fd = -1;
+
+    if (ok && rename(writer->temp_path, output_path) != 0) ok = false;
+    if (!ok) unlink(writer->temp_path);
+
+    trace_end(span);
+    writer->write_ms += converter_now_ms() - start;
+    return ok;
+}
+
+static void file_writer_abort(FileWriter *writer) {
+    if (writer->fd >= 0) {
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    unlink(writer->temp_path);
+}
 
 void converter_init_params(ConversionParams *params) {
     params->quality = 75.0f;
@@ -22,6 +290,33 @@ void converter_init_params(ConversionParams *params) {
     params->filter_strength = 60;
     params->filter_sharpness = 0;
     params->preprocessing = 0;
+    params->target_mode = TARGET_QUALITY;
+    params->target_size = 0;
+    params->target_metric = 0.0f;
+    params->auto_content = false;
+    params->content_hint = CONTENT_NONE;
+    params->best_of = false;
+    params->keyframe_interval = 0;
+    params->minimize_size = false;
+}
+
+/* The fields manifest_params_hash covers */
+bool converter_params_equal(const ConversionParams *a, const ConversionParams *b) {
+    return a->quality == b->quality &&
+           a->method == b->method &&
+           a->lossless == b->lossless &&
+           a->alpha_quality == b->alpha_quality &&
+           a->filter_strength == b->filter_strength &&
+           a->filter_sharpness == b->filter_sharpness &&
+           a->preprocessing == b->preprocessing &&
+           a->target_mode == b->target_mode &&
+           a->target_size == b->target_size &&
+           a->target_metric == b->target_metric &&
+           a->auto_content == b->auto_content &&
+           a->best_of == b->best_of &&
+           a->keyframe_interval == b->keyframe_interval &&
+           a->minimize_size == b->minimize_size &&
+           a->content_hint == b->content_hint;
 }
 
 static size_t get_file_size(const char *filepath) {
@@ -40,13 +335,19 @@ static const char* get_extension(const char *filepath) {
     return "";
 }
 
-bool converter_is_supported(const char *filepath) {
+/* Lower-case extension of filepath, truncated to fit lower_ext[16] */
+static void lower_extension(const char *filepath, char lower_ext[16]) {
     const char *ext = get_extension(filepath);
-    char lower_ext[16] = {0};
+    memset(lower_ext, 0, 16);
 
     for (int i = 0; ext[i] && i < 15; i++) {
         lower_ext[i] = tolower((unsigned char)ext[i]);
     }
+}
+
+bool converter_is_supported(const char *filepath) {
+    char lower_ext[16];
+    lower_extension(filepath, lower_ext);
 
     return strcmp(lower_ext, "png") == 0 ||
            strcmp(lower_ext, "jpg") == 0 ||
@@ -59,179 +360,1790 @@ const char* converter_get_supported_extensions(void) {
     return "*.png;*.jpg;*.jpeg;*.bmp;*.gif";
 }
 
-bool converter_load_image(const char *filepath, ImageData *image) {
-    if (!filepath || !image) return false;
+/* Decode to RGB, or RGBA when the format carries an alpha channel */
+static int decode_channels(int file_channels) {
+    return (file_channels == 2 || file_channels == 4) ? 4 : 3;
+}
+
+static bool is_metric_mode(TargetMode mode) {
+    return mode == TARGET_SSIM || mode == TARGET_PSNR;
+}
+
+/* True if every alpha byte of an RGBA buffer is 255 */
+static bool rgba_is_opaque(const unsigned char *rgba, size_t pixels) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    /* 16 pixels per step; bail out at the first non-opaque block */
+    const __m128i alpha_mask = _mm_set1_epi32((int)0xFF000000);
+    for (; i + 16 <= pixels; i += 16) {
+        const __m128i *p = (const __m128i *)(rgba + i * 4);
+        __m128i all = _mm_and_si128(_mm_and_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+                                    _mm_and_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+        __m128i alpha = _mm_and_si128(all, alpha_mask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alpha_mask)) != 0xFFFF) return false;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x4_t px = vld4q_u8(rgba + i * 4);
+        if (vminvq_u8(px.val[3]) != 255) return false;
+    }
+#endif
+
+    for (; i < pixels; i++) {
+        if (rgba[i * 4 + 3] != 255) return false;
+    }
+    return true;
+}
+
+/*
+ * Formats with an alpha channel are often fully opaque in practice
+ * (screenshots, exported PNGs). Drop the alpha bytes in place so the
+ * encoder takes its RGB path and channels reports the real content.
+ */
+static void drop_opaque_alpha(ImageData *image) {
+    if (image->channels != 4) return;
+
+    size_t pixels = (size_t)image->width * image->height;
+    if (!rgba_is_opaque(image->data, pixels)) return;
+
+    unsigned char *data = image->data;
+    for (size_t i = 0; i < pixels; i++) {
+        data[i * 3 + 0] = data[i * 4 + 0];
+        data[i * 3 + 1] = data[i * 4 + 1];
+        data[i * 3 + 2] = data[i * 4 + 2];
+    }
+    image->channels = 3;
+}
+
+/*
+ * Walk the blocks of a GIF without decoding it: the number of frames and
+ * the NETSCAPE2.0 loop count, as the times the animation plays (0 for
+ * forever; a GIF without the extension plays once). False if not a GIF.
+ */
+static bool gif_scan(const unsigned char *p, size_t size, int *frames, int *loops) {
+    *frames = 0;
+    *loops = 1;
+    if (size < 13 || memcmp(p, "GIF8", 4) != 0) return false;
+
+    size_t pos = 13;
+    if (p[10] & 0x80) pos += 3u << ((p[10] & 7) + 1);   /* Global colour table */
+
+    while (pos < size) {
+        unsigned char block = p[pos++];
+        if (block == 0x21 && pos < size) {
+            unsigned char label = p[pos++];
+            if (label == 0xFF && pos + 16 <= size && p[pos] == 11 &&
+                memcmp(p + pos + 1, "NETSCAPE2.0", 11) == 0 && p[pos + 12] == 3 &&
+                p[pos + 13] == 1) {
+                /* Repeats after the first play */
+                int repeats = p[pos + 14] | (p[pos + 15] << 8);
+                *loops = (repeats == 0) ? 0 : (repeats < 65535 ? repeats + 1 : 65535);
+            }
+        } else if (block == 0x2C && pos + 9 <= size) {
+            unsigned char flags = p[pos + 8];
+            pos += 9;
+            if (flags & 0x80) pos += 3u << ((flags & 7) + 1);   /* Local colour table */
+            pos++;                                               /* LZW code size */
+            (*frames)++;
+        } else {
+            break;      /* Trailer or damage */
+        }
+        /* Data sub-blocks of the extension or image */
+        while (pos < size && p[pos] != 0) pos += (size_t)p[pos] + 1;
+        pos++;
+    }
+    return true;
+}
+
+/* Every frame of an animated GIF, composed as shown, stacked in image->data */
+static bool load_animation(const unsigned char *buffer, size_t size, int loops,
+                           ImageData *image) {
+    int frames, channels;
+    image->data = stbi_load_gif_from_memory(buffer, (int)size, &image->delays, &image->width,
+                                            &image->height, &frames, &channels, 4);
+    if (!image->data) return false;
+
+    image->channels = 4;
+    image->frames = frames;
+    image->loops = loops;
+    return true;
+}
+
+bool converter_load_image_from_memory(const unsigned char *buffer, size_t size,
+                                      ImageData *image) {
+    if (!buffer || !image) return false;
 
     memset(image, 0, sizeof(ImageData));
 
-    /* Check file exists and get size */
-    image->file_size = get_file_size(filepath);
-    if (image->file_size == 0) {
+    /* stb_image takes an int length */
+    if (size == 0 || size > INT_MAX) {
         return false;
     }
+    image->file_size = size;
+
+    int frames, loops;
+    if (gif_scan(buffer, size, &frames, &loops) && frames > 1) {
+        return load_animation(buffer, size, loops, image);
+    }
 
-    /* Load image with stb_image (force RGBA) */
-    image->data = stbi_load(filepath, &image->width, &image->height,
-                            &image->channels, 4);
+    /* Keep the source's channel layout instead of forcing RGBA */
+    int file_channels;
+    if (!stbi_info_from_memory(buffer, (int)size, &image->width, &image->height,
+                               &file_channels)) {
+        return false;
+    }
+    int channels = decode_channels(file_channels);
 
+    image->data = stbi_load_from_memory(buffer, (int)size, &image->width,
+                                        &image->height, &file_channels, channels);
     if (!image->data) {
         return false;
     }
+    image->channels = channels;
+    drop_opaque_alpha(image);
 
-    /* Store filepath */
-    strncpy(image->filepath, filepath, sizeof(image->filepath) - 1);
-    image->channels = 4; /* We forced RGBA */
+    return true;
+}
+
+bool converter_read_file(const char *filepath, FileBuffer *file, bool prefetch) {
+    if (!filepath || !file) return false;
+
+    memset(file, 0, sizeof(FileBuffer));
+
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    /* Check it is a regular, non-empty file and get size */
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+
+    /*
+     * Map the file read-only: no stdio buffering and no intermediate copy
+     * of the encoded bytes.
+     */
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+        close(fd);
+
+        /* One forward pass over the whole file: read ahead aggressively */
+        posix_madvise(mapping, size, POSIX_MADV_SEQUENTIAL);
+        posix_madvise(mapping, size, POSIX_MADV_WILLNEED);
+
+        file->data = mapping;
+        file->size = size;
+        file->mapped = true;
+        if (prefetch) {
+            converter_prefetch_file(file);
+        }
+        return true;
+    }
+
+    /* Filesystems without mmap support */
+    unsigned char *data = malloc(size);
+    if (!data) {
+        close(fd);
+        return false;
+    }
+    bool ok = read_all(fd, data, size);
+    close(fd);
+    if (!ok) {
+        free(data);
+        return false;
+    }
 
+    file->data = data;
+    file->size = size;
     return true;
 }
 
-void converter_free_image(ImageData *image) {
-    if (image && image->data) {
-        stbi_image_free(image->data);
-        image->data = NULL;
+void converter_prefetch_file(const FileBuffer *file) {
+    if (!file || !file->data || !file->mapped) return;
+
+    /* Fault every page in now, so the decode never waits on the disk */
+    const volatile unsigned char *bytes = file->data;
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0) page = 4096;
+    unsigned char sink = 0;
+    for (size_t i = 0; i < file->size; i += (size_t)page) sink ^= bytes[i];
+    (void)sink;
+}
+
+void converter_release_file(FileBuffer *file) {
+    if (!file || !file->data) return;
+
+    if (file->mapped) {
+        munmap(file->data, file->size);
+    } else {
+        free(file->data);
     }
+    memset(file, 0, sizeof(FileBuffer));
 }
 
-ConversionResult converter_to_webp(const ImageData *image,
-                                    const char *output_path,
-                                    const ConversionParams *params) {
-    ConversionResult result = {0};
+/* Reflink source_path to a new temp_path: its blocks are shared copy-on-write */
+static bool clone_file(const char *source_path, const char *temp_path) {
+#if defined(__APPLE__)
+    return clonefile(source_path, temp_path, 0) == 0;
+#elif defined(__linux__) && defined(FICLONE)
+    int source = open(source_path, O_RDONLY | O_CLOEXEC);
+    if (source < 0) return false;
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    bool ok = fd >= 0 && ioctl(fd, FICLONE, source) == 0;
+    if (fd >= 0) {
+        if (close(fd) != 0) ok = false;
+        if (!ok) unlink(temp_path);
+    }
+    close(source);
+    return ok;
+#else
+    (void)source_path;
+    (void)temp_path;
+    return false;
+#endif
+}
 
-    if (!image || !image->data || !output_path || !params) {
-        result.success = false;
-        snprintf(result.error_message, sizeof(result.error_message),
-                "Invalid parameters");
-        return result;
+/* Write the bytes of source_path to a new temp_path */
+static bool copy_bytes(const char *source_path, const char *temp_path) {
+    FileBuffer file;
+    if (!converter_read_file(source_path, &file, true)) return false;
+
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    bool ok = fd >= 0 && write_all(fd, file.data, file.size);
+    if (fd >= 0) {
+        if (close(fd) != 0) ok = false;
+        if (!ok) unlink(temp_path);
     }
 
-    WebPConfig config;
-    WebPPicture picture;
-    WebPMemoryWriter writer;
+    converter_release_file(&file);
+    return ok;
+}
 
-    /* Initialize WebP config */
-    if (!WebPConfigInit(&config)) {
-        result.success = false;
-        snprintf(result.error_message, sizeof(result.error_message),
-                "Failed to initialize WebP config");
-        return result;
+CopyMethod converter_copy_file(const char *source_path, const char *output_path) {
+    char temp_path[1024];
+    if (!make_temp_path(output_path, temp_path, sizeof(temp_path))) return COPY_FAILED;
+
+    TraceSpan span = trace_begin(TRACE_WRITE);
+
+    /*
+     * A hard link is safe to hand out: outputs are only ever replaced by
+     * renaming a new file over them, never rewritten in place.
+     */
+    CopyMethod method = COPY_FAILED;
+    if (clone_file(source_path, temp_path)) {
+        method = COPY_REFLINK;
+    } else if (link(source_path, temp_path) == 0) {
+        method = COPY_HARDLINK;
+    } else if (copy_bytes(source_path, temp_path)) {
+        method = COPY_BYTES;
     }
 
-    /* Set encoding parameters */
-    config.quality = params->quality;
-    config.method = params->method;
-    config.lossless = params->lossless ? 1 : 0;
-    config.alpha_quality = (int)params->alpha_quality;
-    config.filter_strength = params->filter_strength;
-    config.filter_sharpness = params->filter_sharpness;
-    config.preprocessing = params->preprocessing;
+    if (method != COPY_FAILED) {
+        if (rename(temp_path, output_path) != 0) method = COPY_FAILED;
+        /* Also left behind when output_path already was a link to source_path */
+        unlink(temp_path);
+    }
 
-    /* For lossless mode, quality controls compression/speed tradeoff */
-    if (params->lossless) {
-        config.quality = 100.0f;
+    trace_end(span);
+    return method;
+}
+
+const char* converter_copy_method_name(CopyMethod method) {
+    switch (method) {
+        case COPY_REFLINK:  return "reflink";
+        case COPY_HARDLINK: return "hardlink";
+        case COPY_BYTES:    return "copy";
+        default:            return "none";
     }
+}
 
-    /* Validate config */
-    if (!WebPValidateConfig(&config)) {
-        result.success = false;
-        snprintf(result.error_message, sizeof(result.error_message),
-                "Invalid WebP configuration");
-        return result;
+bool converter_load_image(const char *filepath, ImageData *image) {
+    if (!filepath || !image) return false;
+
+    memset(image, 0, sizeof(ImageData));
+
+    FileBuffer file;
+    if (!converter_read_file(filepath, &file, false)) {
+        return false;
     }
 
-    /* Initialize picture */
-    if (!WebPPictureInit(&picture)) {
-        result.success = false;
-        snprintf(result.error_message, sizeof(result.error_message),
-                "Failed to initialize WebP picture");
-        return result;
+    bool ok = converter_load_image_from_memory(file.data, file.size, image);
+    converter_release_file(&file);
+
+    if (!ok) {
+        return false;
     }
 
-    picture.width = image->width;
-    picture.height = image->height;
-    picture.use_argb = 1;
+    /* Store filepath */
+    strncpy(image->filepath, filepath, sizeof(image->filepath) - 1);
 
-    /* Allocate picture buffer */
-    if (!WebPPictureAlloc(&picture)) {
-        result.success = false;
-        snprintf(result.error_message, sizeof(result.error_message),
-                "Failed to allocate WebP picture buffer");
-        return result;
+    return true;
+}
+
+bool converter_probe_image(const char *filepath, ImageData *image) {
+    if (!filepath || !image) return false;
+
+    memset(image, 0, sizeof(ImageData));
+
+    image->file_size = get_file_size(filepath);
+    if (image->file_size == 0) {
+        return false;
     }
 
-    /* Import RGBA data */
-    if (!WebPPictureImportRGBA(&picture, image->data, image->width * 4)) {
-        WebPPictureFree(&picture);
-        result.success = false;
-        snprintf(result.error_message, sizeof(result.error_message),
-                "Failed to import image data");
-        return result;
+    /* Parses only the header; GIFs are walked for their frame count */
+    char lower_ext[16];
+    lower_extension(filepath, lower_ext);
+    if (strcmp(lower_ext, "gif") == 0) {
+        FileBuffer file;
+        if (!converter_read_file(filepath, &file, false)) return false;
+        bool ok = converter_probe_image_from_memory(file.data, file.size, image);
+        converter_release_file(&file);
+        if (!ok) return false;
+    } else if (!stbi_info(filepath, &image->width, &image->height, &image->channels)) {
+        return false;
     }
 
-    /* Setup memory writer */
-    WebPMemoryWriterInit(&writer);
-    picture.writer = WebPMemoryWrite;
-    picture.custom_ptr = &writer;
+    strncpy(image->filepath, filepath, sizeof(image->filepath) - 1);
 
-    /* Encode */
-    int encode_ok = WebPEncode(&config, &picture);
-    WebPPictureFree(&picture);
+    return true;
+}
 
-    if (!encode_ok) {
-        WebPMemoryWriterClear(&writer);
-        result.success = false;
-        snprintf(result.error_message, sizeof(result.error_message),
-                "WebP encoding failed (error code: %d)", picture.error_code);
-        return result;
+bool converter_probe_image_from_memory(const unsigned char *buffer, size_t size,
+                                       ImageData *image) {
+    if (!buffer || !image) return false;
+
+    memset(image, 0, sizeof(ImageData));
+
+    if (size == 0 || size > INT_MAX) {
+        return false;
     }
+    image->file_size = size;
 
-    /* Write to file */
-    FILE *fp = fopen(output_path, "wb");
-    if (!fp) {
-        WebPMemoryWriterClear(&writer);
-        result.success = false;
-        snprintf(result.error_message, sizeof(result.error_message),
-                "Failed to open output file: %s", output_path);
-        return result;
+    if (!stbi_info_from_memory(buffer, (int)size, &image->width, &image->height,
+                               &image->channels)) {
+        return false;
     }
 
-    size_t written = fwrite(writer.mem, 1, writer.size, fp);
-    fclose(fp);
+    int frames, loops;
+    if (gif_scan(buffer, size, &frames, &loops) && frames > 1) {
+        image->channels = 4;
+        image->frames = frames;
+        image->loops = loops;
+    }
+    return true;
+}
 
-    if (written != writer.size) {
-        WebPMemoryWriterClear(&writer);
-        result.success = false;
-        snprintf(result.error_message, sizeof(result.error_message),
-                "Failed to write output file");
-        return result;
+/*
+ * Peak heap use per pixel, measured with libwebp 1.2 on 2-12 megapixel
+ * images and rounded up. Decoding holds the raw scanlines next to the
+ * output; lossy encoding needs the YUV picture plus per-macroblock state,
+ * and from method 3 on a token buffer; alpha goes through its own
+ * lossless encode; lossless needs hash chains and backward references.
+ */
+#define PEAK_DECODE_SLACK_BPP 1.5
+#define PEAK_LOSSY_BPP 3.5
+#define PEAK_TOKENS_BPP 10.0
+#define PEAK_ALPHA_BPP 5.0
+#define PEAK_ARGB_BPP 4.0
+#define PEAK_LOSSLESS_BPP 48.0
+
+size_t converter_predict_peak(const ImageData *probe, const ConversionParams *params) {
+    if (!probe || !params) return 0;
+
+    double pixels = (double)probe->width * probe->height;
+    int channels = decode_channels(probe->channels);
+    bool alpha = channels == 4;
+
+    /* Decoding: raw scanlines and the converted output at once */
+    double decode = pixels * (2 * channels + PEAK_DECODE_SLACK_BPP);
+
+    /* One lossy encode: picture, encoder state and the alpha plane */
+    double lossy = pixels * PEAK_LOSSY_BPP;
+    if (params->method >= 3) lossy += pixels * PEAK_TOKENS_BPP;
+    if (alpha) lossy += pixels * PEAK_ALPHA_BPP;
+
+    double encode;
+    if (params->target_mode == TARGET_SIZE && params->target_size > 0) {
+        encode = TARGET_SEARCH_WIDTH * lossy;
+    } else if (is_metric_mode(params->target_mode)) {
+        /* Each trial is decoded back; the source luma is shared */
+        encode = TARGET_SEARCH_WIDTH * (lossy + pixels * channels) + pixels;
+    } else if (params->best_of) {
+        /* Both encodes at once, each with its own picture */
+        encode = pixels * (PEAK_ARGB_BPP + PEAK_LOSSLESS_BPP) + lossy + pixels * PEAK_ARGB_BPP;
+    } else if (params->lossless || params->auto_content) {
+        /* Auto may pick lossless for any image: budget for it */
+        encode = pixels * (PEAK_ARGB_BPP + PEAK_LOSSLESS_BPP);
+    } else {
+        encode = lossy;
+        if (alpha || (params->preprocessing & 2)) encode += pixels * PEAK_ARGB_BPP;
     }
 
-    /* Success! */
-    result.success = true;
-    result.output_size = writer.size;
-    result.compression_ratio = (float)image->file_size / (float)writer.size;
+    if (probe->frames > 1) {
+        /*
+         * stb_image grows one buffer frame by frame (a realloc may copy
+         * it), and every canvas is kept through the encode. Frames are
+         * encoded a core at a time, each frame's picture at most whole.
+         */
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        double in_flight = cores > 1 ? (double)cores : 1.0;
+        if (in_flight > probe->frames) in_flight = probe->frames;
+        double canvases = pixels * 4 * probe->frames;
+        double frame = params->lossless || params->best_of
+                     ? pixels * (PEAK_ARGB_BPP + PEAK_LOSSLESS_BPP)
+                     : pixels * (PEAK_LOSSY_BPP + PEAK_ALPHA_BPP + PEAK_ARGB_BPP) +
+                       (params->method >= 3 ? pixels * PEAK_TOKENS_BPP : 0);
+        decode = 2 * canvases + pixels * (4 + PEAK_DECODE_SLACK_BPP);
+        encode = in_flight * frame;
+        channels = 4 * probe->frames;
+    }
 
-    WebPMemoryWriterClear(&writer);
-    return result;
+    double held = pixels * channels + encode;
+    double peak = (held > decode) ? held : decode;
+    return (size_t)peak + probe->file_size;
 }
 
-size_t converter_estimate_size(const ImageData *image, const ConversionParams *params) {
-    if (!image || !params) return 0;
+void converter_free_image(ImageData *image) {
+    if (!image) return;
+
+    if (image->data) {
+        stbi_image_free(image->data);
+        image->data = NULL;
+    }
+    if (image->delays) {
+        stbi_image_free(image->delays);
+        image->delays = NULL;
+    }
+}
 
-    size_t raw_size = (size_t)image->width * image->height * 4;
+ConverterContext* converter_context_create(void) {
+    ConverterContext *ctx = calloc(1, sizeof(ConverterContext));
+    if (!ctx) return NULL;
 
-    if (params->lossless) {
-        /* Lossless typically achieves 15-40% of raw size */
-        float method_factor = 0.4f - (params->method / 6.0f) * 0.2f;
-        return (size_t)(raw_size * method_factor);
+    ctx->output_buffer = malloc(OUTPUT_BUFFER_SIZE);
+    if (!ctx->output_buffer) {
+        free(ctx);
+        return NULL;
     }
+    ctx->threads = 1;
+
+    return ctx;
+}
+
+void converter_context_set_threads(ConverterContext *ctx, int threads) {
+    if (ctx) ctx->threads = threads > 1 ? threads : 1;
+}
 
-    /* Lossy estimation - calibrated from real tests */
-    /* Quality 0: ~0.1% of raw, Quality 50: ~0.6%, Quality 100: ~2.5% */
-    float qf = params->quality / 100.0f;
-    float base_ratio = 0.001f + qf * qf * 0.025f;
+void converter_context_destroy(ConverterContext *ctx) {
+    if (!ctx) return;
 
-    /* Higher method = slightly smaller files */
-    float method_factor = 1.0f - (params->method / 6.0f) * 0.1f;
+    free(ctx->argb);
+    free(ctx->output_buffer);
+    for (int i = 0; i <= TARGET_SEARCH_WIDTH; i++) {
+        free(ctx->search_outputs[i].data);
+    }
+    for (int i = 0; i < TARGET_SEARCH_WIDTH; i++) {
+        free(ctx->search_pixels[i].data);
+    }
+    free(ctx->source_luma.data);
+    free(ctx);
+}
 
-    return (size_t)(raw_size * base_ratio * method_factor);
+/* libwebp preset for a content class */
+static WebPPreset content_preset(ContentClass content) {
+    switch (content) {
+        case CONTENT_PHOTO:   return WEBP_PRESET_PHOTO;
+        case CONTENT_PICTURE: return WEBP_PRESET_PICTURE;
+        case CONTENT_DRAWING: return WEBP_PRESET_DRAWING;
+        case CONTENT_ICON:    return WEBP_PRESET_ICON;
+        case CONTENT_TEXT:    return WEBP_PRESET_TEXT;
+        default:              return WEBP_PRESET_DEFAULT;
+    }
+}
+
+/* Validated WebPConfig for params */
+static bool build_config(const ConversionParams *params, WebPConfig *config) {
+    if (params->content_hint != CONTENT_NONE) {
+        /* The preset's filter, SNS and segment settings stand in for ours */
+        if (!WebPConfigPreset(config, content_preset(params->content_hint), params->quality)) {
+            return false;
+        }
+    } else {
+        if (!WebPConfigInit(config)) {
+            return false;
+        }
+        config->filter_strength = params->filter_strength;
+        config->filter_sharpness = params->filter_sharpness;
+        config->preprocessing = params->preprocessing;
+    }
+
+    /* Set encoding parameters */
+    config->quality = params->quality;
+    config->method = params->method;
+    config->lossless = params->lossless ? 1 : 0;
+    config->alpha_quality = (int)params->alpha_quality;
+
+    /* For lossless mode, quality controls compression/speed tradeoff */
+    if (params->lossless) {
+        config->quality = 100.0f;
+    }
+
+    return WebPValidateConfig(config) != 0;
+}
+
+/* Build (or reuse) the validated WebPConfig for params */
+static bool context_prepare_config(ConverterContext *ctx, const ConversionParams *params) {
+    if (ctx->config_valid && converter_params_equal(&ctx->config_params, params)) {
+        return true;
+    }
+    ctx->config_valid = false;
+
+    if (!build_config(params, &ctx->config)) {
+        return false;
+    }
+
+    ctx->config_params = *params;
+    ctx->config_valid = true;
+    return true;
+}
+
+/* One band of rows packed into ARGB, possibly on a helper thread */
+typedef struct {
+    const unsigned char *src;
+    uint32_t *dst;
+    size_t pixels;
+    int channels;
+    pthread_t thread;
+    bool threaded;
+} PackBand;
+
+static void* pack_band(void *arg) {
+    PackBand *band = arg;
+    const unsigned char *src = band->src;
+    uint32_t *dst = band->dst;
+
+    if (band->channels == 4) {
+        for (size_t i = 0; i < band->pixels; i++, src += 4) {
+            dst[i] = ((uint32_t)src[3] << 24) | ((uint32_t)src[0] << 16) |
+                     ((uint32_t)src[1] << 8) | (uint32_t)src[2];
+        }
+    } else {
+        for (size_t i = 0; i < band->pixels; i++, src += 3) {
+            dst[i] = 0xFF000000u | ((uint32_t)src[0] << 16) |
+                     ((uint32_t)src[1] << 8) | (uint32_t)src[2];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Pack RGB/RGBA into ARGB, split into row bands over up to threads cores
+ * (the caller packs the first band). A band whose thread cannot be
+ * started is packed by the caller.
+ */
+static void pack_argb(const ImageData *image, uint32_t *argb, int threads) {
+    size_t pixels = (size_t)image->width * image->height;
+    int bands = threads < PACK_MAX_BANDS ? threads : PACK_MAX_BANDS;
+    if ((size_t)bands > pixels / PACK_BAND_PIXELS) bands = (int)(pixels / PACK_BAND_PIXELS);
+    if (bands > image->height) bands = image->height;
+    if (bands < 1) bands = 1;
+
+    PackBand band[PACK_MAX_BANDS];
+    for (int i = 0; i < bands; i++) {
+        int first_row = (int)((long long)image->height * i / bands);
+        int last_row = (int)((long long)image->height * (i + 1) / bands);
+        size_t offset = (size_t)first_row * image->width;
+        band[i].src = image->data + offset * image->channels;
+        band[i].dst = argb + offset;
+        band[i].pixels = (size_t)(last_row - first_row) * image->width;
+        band[i].channels = image->channels;
+        band[i].threaded = false;
+    }
+
+    for (int i = 1; i < bands; i++) {
+        band[i].threaded = pthread_create(&band[i].thread, NULL, pack_band, &band[i]) == 0;
+        if (!band[i].threaded) pack_band(&band[i]);
+    }
+    pack_band(&band[0]);
+    for (int i = 1; i < bands; i++) {
+        if (band[i].threaded) pthread_join(band[i].thread, NULL);
+    }
+}
+
+/*
+ * Hand the pixels to libwebp. Opaque RGB sources headed for lossy encoding
+ * go straight to YUV420 through WebPPictureImportRGB, so no ARGB plane and
+ * no alpha plane are ever built. Everything else is packed into the
+ * recycled ARGB plane (in bands when the context has several cores) and
+ * passed as a view.
+ */
+static bool context_import(ConverterContext *ctx, const ImageData *image,
+                           const WebPConfig *config, WebPPicture *picture) {
+    picture->width = image->width;
+    picture->height = image->height;
+
+    /* Dithering (preprocessing bit 2) is only applied on the ARGB path */
+    if (image->channels == 3 && !config->lossless && !(config->preprocessing & 2)) {
+        picture->use_argb = 0;
+        return WebPPictureImportRGB(picture, image->data, image->width * 3) != 0;
+    }
+
+    size_t pixels = (size_t)image->width * image->height;
+
+    if (pixels > ctx->argb_capacity) {
+        uint32_t *argb = malloc(pixels * sizeof(uint32_t));
+        if (!argb) return false;
+        free(ctx->argb);
+        ctx->argb = argb;
+        ctx->argb_capacity = pixels;
+        ctx->allocations++;
+    }
+
+    pack_argb(image, ctx->argb, ctx->threads);
+
+    /* A view on our buffer: WebPPictureFree() will not release it */
+    picture->use_argb = 1;
+    picture->argb = ctx->argb;
+    picture->argb_stride = image->width;
+
+    return true;
+}
+
+/* Write an already encoded bitstream through the temp-file/rename path */
+static bool write_output_file(ConverterContext *ctx, const char *output_path,
+                              const unsigned char *data, size_t size, double *write_ms) {
+    double start = converter_now_ms();
+    FileWriter writer;
+    bool ok = file_writer_open(&writer, output_path, ctx->output_buffer);
+    TraceSpan span = trace_begin(TRACE_WRITE);
+    bool written = ok && write_all(writer.fd, data, size);
+    trace_end(span);
+    if (ok && !written) {
+        file_writer_abort(&writer);
+        ok = false;
+    } else if (ok) {
+        writer.size = size;
+        ok = file_writer_commit(&writer, output_path);
+    }
+    *write_ms += converter_now_ms() - start;
+    return ok;
+}
+
+/* Bytes of the planes a picture holds (its own or viewed) */
+static size_t picture_bytes(const WebPPicture *picture) {
+    size_t rows = (size_t)picture->height;
+    size_t uv_rows = (rows + 1) / 2;
+    size_t bytes = 0;
+
+    if (picture->argb) bytes += (size_t)picture->argb_stride * rows * sizeof(uint32_t);
+    if (picture->y) bytes += (size_t)picture->y_stride * rows;
+    if (picture->u) bytes += (size_t)picture->uv_stride * uv_rows * 2;
+    if (picture->a) bytes += (size_t)picture->a_stride * rows;
+    return bytes;
+}
+
+static void copy_stats(const WebPAuxStats *aux, EncoderStats *stats) {
+    for (int i = 0; i < 5; i++) stats->psnr[i] = aux->PSNR[i];
+    for (int i = 0; i < 2; i++) stats->header_bytes[i] = aux->header_bytes[i];
+    for (int i = 0; i < 4; i++) {
+        stats->segment_bytes[i] = aux->segment_size[i];
+        stats->segment_quant[i] = aux->segment_quant[i];
+    }
+    for (int i = 0; i < 3; i++) stats->block_count[i] = aux->block_count[i];
+    stats->alpha_bytes = aux->alpha_data_size;
+    stats->lossless_bytes = aux->lossless_size;
+}
+
+static int memory_output_append(MemoryOutput *out, const uint8_t *data, size_t data_size) {
+    if (out->size + data_size > out->limit) {
+        out->over_limit = true;
+        return 0; /* Over budget: no point finishing this encode */
+    }
+    if (out->size + data_size > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity * 2 : 64 * 1024;
+        while (capacity < out->size + data_size) capacity *= 2;
+        unsigned char *grown = realloc(out->data, capacity);
+        if (!grown) return 0;
+        out->data = grown;
+        out->capacity = capacity;
+        out->allocations++;
+    }
+    memcpy(out->data + out->size, data, data_size);
+    out->size += data_size;
+
+    return 1;
+}
+
+static int memory_output_write(const uint8_t *data, size_t data_size, const WebPPicture *picture) {
+    return memory_output_append((MemoryOutput *)picture->custom_ptr, data, data_size);
+}
+
+/* Where an encode's progress_hook reports to */
+typedef struct {
+    const ConversionProgress *progress;
+    float base;             /* Fraction of the conversion done before this encode */
+    float span;             /* Fraction this encode covers */
+    bool report;            /* Only the converting thread calls report */
+} EncodeProgress;
+
+static bool conversion_cancelled(const ConversionProgress *progress) {
+    return progress && progress->cancel &&
+           atomic_load_explicit(progress->cancel, memory_order_relaxed);
+}
+
+static void report_progress(const ConversionProgress *progress, float fraction) {
+    if (progress && progress->report) progress->report(fraction, progress->user_data);
+}
+
+/* Pass percent of an encode on; 0 once cancelled */
+static int encode_step(const EncodeProgress *state, int percent) {
+    if (conversion_cancelled(state->progress)) return 0;
+    if (state->report) {
+        report_progress(state->progress, state->base + state->span * (float)percent / 100.0f);
+    }
+    return 1;
+}
+
+/* WebPProgressHook: pass the fraction on, and abort the encode once cancelled */
+static int encode_progress(int percent, const WebPPicture *picture) {
+    return encode_step((const EncodeProgress *)picture->user_data, percent);
+}
+
+static void set_cancelled(ConversionResult *result) {
+    result->success = false;
+    result->cancelled = true;
+    snprintf(result->error_message, sizeof(result->error_message), "Cancelled");
+}
+
+/* Grow a scratch buffer to at least size bytes */
+static bool pixel_buffer_reserve(PixelBuffer *buffer, size_t size) {
+    if (buffer->capacity >= size) return true;
+
+    unsigned char *grown = realloc(buffer->data, size);
+    if (!grown) return false;
+    buffer->data = grown;
+    buffer->capacity = size;
+    buffer->allocations++;
+    return true;
+}
+
+/* State shared read-only by the candidates of a search */
+typedef struct {
+    const ImageData *image;
+    TargetMode mode;
+    size_t target_size;
+    float target_metric;
+    const unsigned char *source_luma;   /* Metric modes only */
+    const ConversionProgress *progress; /* May be NULL */
+    int trace_file;                     /* Timeline tag for trial threads */
+} SearchShared;
+
+/* One trial encode of a search round */
+typedef struct {
+    const SearchShared *shared;
+    WebPConfig config;
+    int quality;
+    MemoryOutput output;
+    PixelBuffer *pixels;    /* Decoded trial (metric modes) */
+    float metric;
+    bool ok;                /* Met the target (fits the size or reaches the metric) */
+    WebPEncodingError error; /* Why it failed, unless it only outgrew the size */
+    bool unscored;          /* Encoded, but could not be decoded and scored */
+    WebPAuxStats aux;
+    EncodeProgress progress;
+    size_t picture_bytes;   /* Planes the trial's picture held */
+    double import_ms, encode_ms;
+    pthread_t thread;
+    bool threaded;
+} SearchCandidate;
+
+/* Decode a trial and score it against the source luma */
+static bool score_candidate(SearchCandidate *c) {
+    const SearchShared *shared = c->shared;
+    const ImageData *image = shared->image;
+    size_t pixels = (size_t)image->width * image->height;
+    size_t size = pixels * image->channels;
+
+    if (!pixel_buffer_reserve(c->pixels, size)) return false;
+
+    TraceSpan span = trace_begin(TRACE_SCORE);
+    uint8_t *decoded = (image->channels == 4)
+        ? WebPDecodeRGBAInto(c->output.data, c->output.size, c->pixels->data, size, image->width * 4)
+        : WebPDecodeRGBInto(c->output.data, c->output.size, c->pixels->data, size, image->width * 3);
+    if (!decoded) {
+        trace_end(span);
+        return false;
+    }
+
+    metrics_luma(decoded, image->channels, image->width, image->height, decoded);
+    c->metric = (shared->mode == TARGET_SSIM)
+        ? (float)metrics_ssim(shared->source_luma, decoded, image->width, image->height)
+        : (float)metrics_psnr(shared->source_luma, decoded, pixels);
+    trace_end(span);
+    return true;
+}
+
+static void* encode_candidate(void *arg) {
+    SearchCandidate *c = arg;
+    const ImageData *image = c->shared->image;
+
+    c->ok = false;
+    c->error = VP8_ENC_OK;
+    c->unscored = false;
+    c->metric = 0.0f;
+    c->output.size = 0;
+    c->output.over_limit = false;
+    c->picture_bytes = 0;
+    c->import_ms = c->encode_ms = 0.0;
+    trace_set_file(c->shared->trace_file);
+
+    /* Each trial owns its picture; the source pixels are shared read-only */
+    WebPPicture picture;
+    if (!WebPPictureInit(&picture)) return NULL;
+    picture.use_argb = 0;
+    picture.width = image->width;
+    picture.height = image->height;
+
+    double start = converter_now_ms();
+    TraceSpan span = trace_begin(TRACE_IMPORT);
+    int imported = (image->channels == 4)
+        ? WebPPictureImportRGBA(&picture, image->data, image->width * 4)
+        : WebPPictureImportRGB(&picture, image->data, image->width * 3);
+    trace_end(span);
+    c->import_ms = converter_now_ms() - start;
+
+    bool encoded = false;
+    if (imported) {
+        picture.writer = memory_output_write;
+        picture.custom_ptr = &c->output;
+        picture.stats = &c->aux;
+        if (c->shared->progress) {
+            picture.progress_hook = encode_progress;
+            picture.user_data = &c->progress;
+        }
+        span = trace_begin(TRACE_ENCODE);
+        encoded = WebPEncode(&c->config, &picture) != 0;
+        trace_end(span);
+    }
+    WebPEncodingError error = picture.error_code;
+    c->picture_bytes = picture_bytes(&picture);
+    WebPPictureFree(&picture);
+
+    /*
+     * Only the writer's abort at the size budget says "too big"; libwebp
+     * reports that as BAD_WRITE, or on the lossy path leaves the code at
+     * OK. Any other failure (an unset code is then the writer's realloc)
+     * is an error of its own.
+     */
+    if (!encoded) {
+        bool too_big = c->output.over_limit &&
+                       (error == VP8_ENC_ERROR_BAD_WRITE || error == VP8_ENC_OK);
+        if (!too_big) c->error = (error != VP8_ENC_OK) ? error : VP8_ENC_ERROR_OUT_OF_MEMORY;
+    } else if (c->shared->mode == TARGET_SIZE) {
+        c->ok = true;
+    } else if (score_candidate(c)) {
+        c->ok = c->metric >= c->shared->target_metric;
+    } else {
+        c->unscored = true;
+    }
+    c->encode_ms = converter_now_ms() - start - c->import_ms;
+
+    return NULL;
+}
+
+static void* search_thread_main(void *arg) {
+    trace_set_thread_name("search trial");
+    return encode_candidate(arg);
+}
+
+/* Encode all candidates concurrently (the caller runs the first one) */
+static void encode_candidates(SearchCandidate *candidates, int count) {
+    for (int i = 1; i < count; i++) {
+        candidates[i].threaded =
+            pthread_create(&candidates[i].thread, NULL, search_thread_main, &candidates[i]) == 0;
+        if (!candidates[i].threaded) encode_candidate(&candidates[i]);
+    }
+    encode_candidate(&candidates[0]);
+    for (int i = 1; i < count; i++) {
+        if (candidates[i].threaded) pthread_join(candidates[i].thread, NULL);
+    }
+}
+
+/*
+ * Target modes search integer lossy quality for a monotonic target:
+ * TARGET_SIZE wants the highest quality whose output fits target_size,
+ * TARGET_SSIM/PSNR the lowest one whose decoded output reaches
+ * target_metric. Either way the qualities split into a low side and a
+ * high side; each round encodes one quality per core the encode was
+ * given (up to TARGET_SEARCH_WIDTH), spread over the open bracket
+ * (lo, hi) in parallel, and narrows it to the nearest candidates on each
+ * side, so 0..100 is settled in about three rounds on four cores and
+ * seven on one. Size trials that outgrow the budget are aborted by their
+ * writer, metric trials share the source luma, and the answer's bytes
+ * are written as is. Progress counts the bracket narrowed on a log
+ * scale, each round covering the share it is expected to narrow.
+ */
+static ConversionResult encode_target(ConverterContext *ctx, const ImageData *image,
+                                      const char *output_path,
+                                      const ConversionParams *params,
+                                      const ConversionProgress *progress) {
+    ConversionResult result = {0};
+    bool metric_mode = is_metric_mode(params->target_mode);
+
+    SearchShared shared = {
+        .image = image,
+        .mode = params->target_mode,
+        .target_size = params->target_size,
+        .target_metric = params->target_metric,
+        .progress = progress,
+        .trace_file = trace_current_file()
+    };
+
+    /* The source is reduced to luma once, not once per trial */
+    if (metric_mode) {
+        size_t pixels = (size_t)image->width * image->height;
+        if (!pixel_buffer_reserve(&ctx->source_luma, pixels)) {
+            result.success = false;
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "Memory allocation failed");
+            return result;
+        }
+        metrics_luma(image->data, image->channels, image->width, image->height,
+                     ctx->source_luma.data);
+        shared.source_luma = ctx->source_luma.data;
+    }
+
+    /* Trial buffers are borrowed from the context and handed back after */
+    SearchCandidate candidates[TARGET_SEARCH_WIDTH];
+    memset(candidates, 0, sizeof(candidates));
+    for (int i = 0; i < TARGET_SEARCH_WIDTH; i++) {
+        candidates[i].output = ctx->search_outputs[i];
+        candidates[i].pixels = &ctx->search_pixels[i];
+    }
+    MemoryOutput best = ctx->search_outputs[TARGET_SEARCH_WIDTH];
+    best.size = 0;
+    int best_quality = -1;
+    float best_metric = 0.0f;
+    WebPAuxStats best_aux;
+    memset(&best_aux, 0, sizeof(best_aux));
+
+    size_t image_bytes = (size_t)image->width * image->height * image->channels;
+
+    int lo = -1;    /* Highest quality known to be on the low side */
+    int hi = 101;   /* Lowest quality above lo known to be on the high side */
+    bool cancelled = false;
+    const SearchCandidate *failed = NULL;
+    int width = ctx->threads < TARGET_SEARCH_WIDTH ? ctx->threads : TARGET_SEARCH_WIDTH;
+
+    while (hi - lo > 1) {
+        if (conversion_cancelled(progress)) {
+            cancelled = true;
+            break;
+        }
+
+        int count = hi - lo - 1;
+        if (count > width) count = width;
+
+        float done = 1.0f - logf((float)(hi - lo)) / logf(102.0f);
+        float share = logf((float)(count + 1)) / logf(102.0f);
+        if (done + share > 1.0f) share = 1.0f - done;
+
+        for (int i = 0; i < count; i++) {
+            SearchCandidate *c = &candidates[i];
+            c->shared = &shared;
+            c->config = ctx->config;
+            c->config.lossless = 0;
+            c->config.thread_level = 0;     /* The trials are the parallelism */
+            c->quality = lo + (hi - lo) * (i + 1) / (count + 1);
+            c->config.quality = (float)c->quality;
+            c->output.limit = metric_mode ? SIZE_MAX : params->target_size;
+            c->progress = (EncodeProgress){ progress, done, share, i == 0 };
+        }
+
+        double round_start = converter_now_ms();
+        encode_candidates(candidates, count);
+        double round_ms = converter_now_ms() - round_start;
+
+        /* Trials run side by side: charge the round's wall time, not their sum */
+        double import_ms = 0.0;
+        size_t held = image_bytes + best.capacity + ctx->source_luma.capacity;
+        for (int i = 0; i < count; i++) {
+            SearchCandidate *c = &candidates[i];
+            ctx->allocations += c->output.allocations;
+            c->output.allocations = 0;
+            if (c->import_ms > import_ms) import_ms = c->import_ms;
+            held += c->picture_bytes + c->output.capacity + c->pixels->capacity;
+        }
+        result.timings.import_ms += import_ms;
+        result.timings.encode_ms += round_ms - import_ms;
+        if (held > result.peak_bytes) result.peak_bytes = held;
+
+        /* Aborted trials say nothing about the target */
+        if (conversion_cancelled(progress)) {
+            cancelled = true;
+            break;
+        }
+
+        /* Nor do failed ones: a quality they could not judge fails the file */
+        for (int i = 0; i < count && !failed; i++) {
+            if (candidates[i].error != VP8_ENC_OK || candidates[i].unscored) {
+                failed = &candidates[i];
+            }
+        }
+        if (failed) break;
+
+        /* Fitting a size holds for low qualities, reaching a metric for high ones */
+        int new_lo = lo, new_hi = hi;
+        for (int i = 0; i < count; i++) {
+            bool low_side = metric_mode ? !candidates[i].ok : candidates[i].ok;
+            if (low_side && candidates[i].quality > new_lo) {
+                new_lo = candidates[i].quality;
+            }
+        }
+        for (int i = count - 1; i >= 0; i--) {
+            bool low_side = metric_mode ? !candidates[i].ok : candidates[i].ok;
+            if (!low_side && candidates[i].quality > new_lo) {
+                new_hi = candidates[i].quality;
+            }
+        }
+
+        /*
+         * Keep the answer's bytes and recycle the other buffers next
+         * round. If quality 100 misses a metric floor it is kept as the
+         * closest result there is.
+         */
+        int answer = metric_mode ? new_hi : new_lo;
+        for (int i = 0; i < count; i++) {
+            SearchCandidate *c = &candidates[i];
+            bool keep = (c->ok && c->quality == answer && answer != best_quality) ||
+                        (metric_mode && c->quality == 100 && best_quality < 0 &&
+                         c->output.size > 0);
+            if (keep) {
+                MemoryOutput swap = best;
+                best = c->output;
+                c->output = swap;
+                best_quality = c->quality;
+                best_metric = c->metric;
+                best_aux = c->aux;
+            }
+        }
+        lo = new_lo;
+        hi = new_hi;
+    }
+
+    for (int i = 0; i < TARGET_SEARCH_WIDTH; i++) {
+        ctx->search_outputs[i] = candidates[i].output;
+        ctx->allocations += ctx->search_pixels[i].allocations;
+        ctx->search_pixels[i].allocations = 0;
+    }
+    ctx->search_outputs[TARGET_SEARCH_WIDTH] = best;
+    ctx->allocations += ctx->source_luma.allocations;
+    ctx->source_luma.allocations = 0;
+
+    result.allocations = ctx->allocations;
+
+    if (cancelled) {
+        set_cancelled(&result);
+        return result;
+    }
+
+    if (failed) {
+        result.success = false;
+        if (failed->unscored) {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "Failed to decode trial at quality %d", failed->quality);
+        } else {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "WebP encoding failed (error code: %d)", failed->error);
+        }
+        return result;
+    }
+
+    if (best_quality < 0) {
+        result.success = false;
+        if (metric_mode) {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "Trial encode failed");
+        } else {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "Cannot fit in %zu bytes even at quality 0", params->target_size);
+        }
+        return result;
+    }
+
+    if (!write_output_file(ctx, output_path, best.data, best.size, &result.timings.write_ms)) {
+        result.success = false;
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Failed to write output file");
+        return result;
+    }
+
+    result.success = true;
+    result.output_size = best.size;
+    result.compression_ratio = (float)image->file_size / (float)best.size;
+    result.quality = (float)best_quality;
+    result.metric = best_metric;
+    copy_stats(&best_aux, &result.stats);
+    report_progress(progress, 1.0f);
+
+    return result;
+}
+
+/* State shared by the two encodes of a best-of race */
+typedef struct {
+    const ImageData *image;
+    const ConversionProgress *progress; /* May be NULL */
+    atomic_size_t bound;                /* Smallest finished (or announced) size so far */
+    int trace_file;
+} Race;
+
+/* One side of the race */
+typedef struct {
+    Race *race;
+    ConverterContext *ctx;              /* Lossless side: packs into ctx->argb */
+    WebPConfig config;
+    MemoryOutput output;
+    size_t announced;                   /* File size from the RIFF header, 0 until written */
+    WebPAuxStats aux;
+    EncodeProgress progress;
+    size_t picture_bytes;
+    double import_ms, encode_ms;
+    bool ok;
+    WebPEncodingError error;
+    pthread_t thread;
+    bool threaded;
+} RaceEntrant;
+
+/* Lower the race bound to size unless a smaller one is already there */
+static void race_lower_bound(Race *race, size_t size) {
+    size_t bound = atomic_load(&race->bound);
+    while (size < bound && !atomic_compare_exchange_weak(&race->bound, &bound, size)) {
+    }
+}
+
+/*
+ * Writer of a race entrant. libwebp starts every file with its RIFF
+ * header, which holds the final size, so an encode already beaten by the
+ * other one stops before its payload is copied.
+ */
+static int race_output_write(const uint8_t *data, size_t data_size, const WebPPicture *picture) {
+    RaceEntrant *e = (RaceEntrant *)picture->custom_ptr;
+
+    if (e->output.size == 0 && data_size >= 8 && memcmp(data, "RIFF", 4) == 0) {
+        e->announced = ((size_t)data[4] | ((size_t)data[5] << 8) |
+                        ((size_t)data[6] << 16) | ((size_t)data[7] << 24)) + 8;
+        if (e->announced > atomic_load(&e->race->bound)) return 0;
+    }
+    if (e->output.size + data_size > atomic_load(&e->race->bound)) return 0;
+    return memory_output_append(&e->output, data, data_size);
+}
+
+/*
+ * Progress hook of a race entrant: cancellation only. libwebp writes
+ * nothing before the encode is done, so its checkpoints cannot tell a
+ * loser yet; that is left to race_output_write().
+ */
+static int race_progress(int percent, const WebPPicture *picture) {
+    RaceEntrant *e = (RaceEntrant *)picture->user_data;
+    return encode_step(&e->progress, percent);
+}
+
+static void* race_encode(void *arg) {
+    RaceEntrant *e = arg;
+    const ImageData *image = e->race->image;
+
+    e->ok = false;
+    e->output.size = 0;
+    e->announced = 0;
+    e->picture_bytes = 0;
+    e->import_ms = e->encode_ms = 0.0;
+    trace_set_file(e->race->trace_file);
+
+    WebPPicture picture;
+    if (!WebPPictureInit(&picture)) return NULL;
+
+    /*
+     * Lossless may rewrite transparent pixels in place, so only it uses
+     * the context's ARGB plane; the lossy side imports into a picture of
+     * its own (ARGB when dithering, which needs it).
+     */
+    double start = converter_now_ms();
+    TraceSpan span = trace_begin(TRACE_IMPORT);
+    bool imported;
+    if (e->config.lossless) {
+        imported = context_import(e->ctx, image, &e->config, &picture);
+    } else {
+        picture.use_argb = (e->config.preprocessing & 2) ? 1 : 0;
+        picture.width = image->width;
+        picture.height = image->height;
+        imported = (image->channels == 4)
+            ? WebPPictureImportRGBA(&picture, image->data, image->width * 4) != 0
+            : WebPPictureImportRGB(&picture, image->data, image->width * 3) != 0;
+    }
+    trace_end(span);
+    e->import_ms = converter_now_ms() - start;
+
+    if (imported) {
+        picture.writer = race_output_write;
+        picture.custom_ptr = e;
+        picture.stats = &e->aux;
+        picture.progress_hook = race_progress;
+        picture.user_data = e;
+        span = trace_begin(TRACE_ENCODE);
+        e->ok = WebPEncode(&e->config, &picture) != 0;
+        trace_end(span);
+    }
+    e->error = picture.error_code;
+    e->picture_bytes = picture_bytes(&picture);
+    WebPPictureFree(&picture);
+    e->encode_ms = converter_now_ms() - start - e->import_ms;
+
+    if (e->ok) race_lower_bound(e->race, e->output.size);
+    return NULL;
+}
+
+static void* race_thread_main(void *arg) {
+    trace_set_thread_name("best-of lossy");
+    return race_encode(arg);
+}
+
+/*
+ * Best-of mode: encode the image lossy (at the given quality) and
+ * lossless, and write whichever is smaller. With two cores or more the
+ * lossy encode runs on a helper thread beside the lossless one; otherwise
+ * lossy goes first, as it is the quicker one and bounds the other. Either
+ * way the first to finish sets the size to beat. libwebp only emits the
+ * bitstream once encoding is done, so the other side cannot be stopped
+ * early: its encode runs to the end, and it is cut off at its RIFF header,
+ * which announces the final size, before the payload is copied. Only the
+ * winner is written.
+ */
+static ConversionResult encode_best_of(ConverterContext *ctx, const ImageData *image,
+                                       const char *output_path,
+                                       const ConversionParams *params,
+                                       const ConversionProgress *progress) {
+    ConversionResult result = {0};
+
+    Race race = { .image = image, .progress = progress, .trace_file = trace_current_file() };
+    atomic_init(&race.bound, SIZE_MAX);
+
+    /* Outputs are borrowed from the target search slots and handed back after */
+    RaceEntrant entrants[2];
+    memset(entrants, 0, sizeof(entrants));
+    bool concurrent = ctx->threads >= 2;
+    for (int i = 0; i < 2; i++) {
+        RaceEntrant *e = &entrants[i];
+        e->race = &race;
+        e->ctx = ctx;
+        e->config = ctx->config;
+        e->config.lossless = i;
+        e->config.thread_level = ctx->threads > 2;
+        e->output = ctx->search_outputs[i];
+        e->output.limit = SIZE_MAX;
+    }
+    /* Lossless quality is its effort setting, as in build_config() */
+    entrants[0].config.quality = params->quality;
+    entrants[1].config.quality = 100.0f;
+
+    RaceEntrant *lossy = &entrants[0];
+    RaceEntrant *lossless = &entrants[1];
+    double start = converter_now_ms();
+    if (concurrent) {
+        /* Lossless is the long one: its progress is the conversion's */
+        lossy->progress = (EncodeProgress){ progress, 0.0f, 0.0f, false };
+        lossless->progress = (EncodeProgress){ progress, 0.0f, 1.0f, true };
+        lossy->threaded = pthread_create(&lossy->thread, NULL, race_thread_main, lossy) == 0;
+        if (!lossy->threaded) race_encode(lossy);
+        race_encode(lossless);
+        if (lossy->threaded) pthread_join(lossy->thread, NULL);
+    } else {
+        lossy->progress = (EncodeProgress){ progress, 0.0f, 0.25f, true };
+        lossless->progress = (EncodeProgress){ progress, 0.25f, 0.75f, true };
+        race_encode(lossy);
+        if (!conversion_cancelled(progress)) race_encode(lossless);
+    }
+    double race_ms = converter_now_ms() - start;
+
+    /* Side by side, the longer import is the one the wall time includes */
+    double import_ms = lossless->import_ms;
+    if (!concurrent) import_ms += lossy->import_ms;
+    else if (lossy->import_ms > import_ms) import_ms = lossy->import_ms;
+    result.timings.import_ms = import_ms;
+    result.timings.encode_ms = race_ms - import_ms;
+    result.peak_bytes = (size_t)image->width * image->height * image->channels +
+                        lossy->picture_bytes + lossless->picture_bytes +
+                        lossy->output.capacity + lossless->output.capacity;
+
+    for (int i = 0; i < 2; i++) {
+        ctx->allocations += entrants[i].output.allocations;
+        entrants[i].output.allocations = 0;
+        ctx->search_outputs[i] = entrants[i].output;
+    }
+    result.allocations = ctx->allocations;
+
+    if (conversion_cancelled(progress)) {
+        set_cancelled(&result);
+        return result;
+    }
+
+    /* Ties go to lossless: same size, exact pixels */
+    RaceEntrant *winner = NULL;
+    if (lossless->ok && (!lossy->ok || lossless->output.size <= lossy->output.size)) {
+        winner = lossless;
+    } else if (lossy->ok) {
+        winner = lossy;
+    }
+    if (!winner) {
+        result.success = false;
+        snprintf(result.error_message, sizeof(result.error_message),
+                "WebP encoding failed (error code: %d)", lossless->error);
+        return result;
+    }
+    RaceEntrant *loser = (winner == lossy) ? lossless : lossy;
+
+    if (!write_output_file(ctx, output_path, winner->output.data, winner->output.size,
+                           &result.timings.write_ms)) {
+        result.success = false;
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Failed to write output file");
+        return result;
+    }
+
+    result.success = true;
+    result.output_size = winner->output.size;
+    result.compression_ratio = (float)image->file_size / (float)winner->output.size;
+    result.quality = winner->config.quality;
+    result.lossless = winner == lossless;
+    result.runner_up_size = loser->ok ? loser->output.size : loser->announced;
+    copy_stats(&winner->aux, &result.stats);
+    report_progress(progress, 1.0f);
+
+    return result;
+}
+
+/*
+ * Animated GIFs: frames are diffed and encoded across the context's
+ * cores by anim_encode(), then written like a search result. Target
+ * modes do not apply; best_of picks lossy or lossless per frame.
+ */
+static ConversionResult encode_animation(ConverterContext *ctx, const ImageData *image,
+                                         const char *output_path,
+                                         const ConversionParams *params,
+                                         const ConversionProgress *progress) {
+    ConversionResult result = {0};
+
+    WebPConfig config = ctx->config;
+    if (params->target_mode != TARGET_QUALITY) {
+        config.lossless = 0;
+        config.quality = params->quality;
+    }
+
+    double start = converter_now_ms();
+    AnimResult anim;
+    bool encoded = anim_encode(image, &config, params, ctx->threads, progress, &anim);
+    result.timings.import_ms = anim.prepare_ms;
+    result.timings.encode_ms = converter_now_ms() - start - anim.prepare_ms;
+    result.peak_bytes = anim.peak_bytes;
+
+    if (!encoded) {
+        result.success = false;
+        if (anim.cancelled) {
+            set_cancelled(&result);
+        } else {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "Animation encoding failed");
+        }
+        return result;
+    }
+
+    bool written = write_output_file(ctx, output_path, anim.data, anim.size,
+                                     &result.timings.write_ms);
+    free(anim.data);
+    if (!written) {
+        result.success = false;
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Failed to write output file");
+        return result;
+    }
+
+    result.success = true;
+    result.output_size = anim.size;
+    result.compression_ratio = (float)image->file_size / (float)anim.size;
+    result.quality = anim.lossless ? 100.0f : config.quality;
+    result.lossless = anim.lossless;
+    result.frames = anim.frames;
+    report_progress(progress, 1.0f);
+
+    return result;
+}
+
+/* Choose lossless and the preset hint from the image content (auto_content) */
+static ContentClass apply_content(const ImageData *image, const ConversionParams *params,
+                                  ConversionParams *chosen) {
+    *chosen = *params;
+    chosen->auto_content = false;
+
+    ContentAnalysis analysis;
+    if (!content_analyze(image, &analysis)) return params->content_hint;
+
+    chosen->content_hint = analysis.content;
+    /* Target modes search lossy qualities: only the hint applies there */
+    if (params->target_mode == TARGET_QUALITY) {
+        chosen->lossless = analysis.lossless;
+    }
+    return analysis.content;
+}
+
+static ConversionResult context_encode(ConverterContext *ctx,
+                                       const ImageData *image,
+                                       const char *output_path,
+                                       const ConversionParams *params,
+                                       const ConversionProgress *progress) {
+    ConversionResult result = {0};
+
+    if (!ctx || !image || !image->data || !output_path || !params ||
+        (image->channels != 3 && image->channels != 4)) {
+        result.success = false;
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Invalid parameters");
+        return result;
+    }
+
+    ctx->allocations = 0;
+
+    WebPPicture picture;
+    FileWriter writer;
+
+    /* Initialize (or reuse) WebP config */
+    if (!context_prepare_config(ctx, params)) {
+        result.success = false;
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Invalid WebP configuration");
+        return result;
+    }
+
+    /* Spare cores: libwebp's own threads (analysis, filtering, alpha, lossless) */
+    ctx->config.thread_level = ctx->threads > 1;
+    result.threads = ctx->threads;
+
+    /* Animations are encoded at the given quality, a frame per core */
+    if (image->frames > 1) {
+        result = encode_animation(ctx, image, output_path, params, progress);
+        result.threads = ctx->threads;
+        return result;
+    }
+
+    if ((params->target_mode == TARGET_SIZE && params->target_size > 0) ||
+        is_metric_mode(params->target_mode)) {
+        result = encode_target(ctx, image, output_path, params, progress);
+        result.threads = ctx->threads;
+        return result;
+    }
+
+    if (params->best_of) {
+        result = encode_best_of(ctx, image, output_path, params, progress);
+        result.threads = ctx->threads;
+        return result;
+    }
+
+    if (conversion_cancelled(progress)) {
+        set_cancelled(&result);
+        return result;
+    }
+
+    /* Initialize picture */
+    if (!WebPPictureInit(&picture)) {
+        result.success = false;
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Failed to initialize WebP picture");
+        return result;
+    }
+
+    /* Import pixel data */
+    double start = converter_now_ms();
+    TraceSpan span = trace_begin(TRACE_IMPORT);
+    bool imported = context_import(ctx, image, &ctx->config, &picture);
+    trace_end(span);
+    result.timings.import_ms = converter_now_ms() - start;
+    if (!imported) {
+        WebPPictureFree(&picture);
+        result.success = false;
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Failed to import image data");
+        return result;
+    }
+
+    /* Stream straight to a temp file next to the output */
+    if (!file_writer_open(&writer, output_path, ctx->output_buffer)) {
+        WebPPictureFree(&picture);
+        result.success = false;
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Failed to open output file: %s", output_path);
+        return result;
+    }
+    WebPAuxStats aux;
+    EncodeProgress encode_state = { progress, 0.0f, 1.0f, true };
+    picture.writer = file_writer_write;
+    picture.custom_ptr = &writer;
+    picture.stats = &aux;
+    if (progress) {
+        picture.progress_hook = encode_progress;
+        picture.user_data = &encode_state;
+    }
+
+    /* Encode (the writer streams out as it goes: that part counts as writing) */
+    start = converter_now_ms();
+    double opened_ms = writer.write_ms;
+    span = trace_begin(TRACE_ENCODE);
+    int encode_ok = WebPEncode(&ctx->config, &picture);
+    trace_end(span);
+    result.timings.encode_ms = converter_now_ms() - start - (writer.write_ms - opened_ms);
+    WebPEncodingError error_code = picture.error_code;
+    result.peak_bytes = (size_t)image->width * image->height * image->channels +
+                        picture_bytes(&picture) + OUTPUT_BUFFER_SIZE;
+    WebPPictureFree(&picture);
+
+    result.allocations = ctx->allocations;
+
+    if (!encode_ok) {
+        file_writer_abort(&writer);
+        result.success = false;
+        if (error_code == VP8_ENC_ERROR_USER_ABORT && conversion_cancelled(progress)) {
+            set_cancelled(&result);
+        } else if (writer.write_failed) {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "Failed to write output file");
+        } else {
+            snprintf(result.error_message, sizeof(result.error_message),
+                    "WebP encoding failed (error code: %d)", error_code);
+        }
+        return result;
+    }
+
+    bool committed = file_writer_commit(&writer, output_path);
+    result.timings.write_ms = writer.write_ms;
+    if (!committed) {
+        result.success = false;
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Failed to write output file");
+        return result;
+    }
+
+    /* Success! */
+    result.success = true;
+    result.output_size = writer.size;
+    result.compression_ratio = (float)image->file_size / (float)writer.size;
+    result.quality = ctx->config.quality;
+    result.lossless = ctx->config.lossless != 0;
+    copy_stats(&aux, &result.stats);
+    report_progress(progress, 1.0f);
+
+    return result;
+}
+
+ConversionResult converter_context_to_webp(ConverterContext *ctx,
+                                           const ImageData *image,
+                                           const char *output_path,
+                                           const ConversionParams *params,
+                                           const ConversionProgress *progress) {
+    if (!params || !params->auto_content || !image || !image->data) {
+        ConversionResult result = context_encode(ctx, image, output_path, params, progress);
+        if (params) result.content = params->content_hint;
+        return result;
+    }
+
+    double start = converter_now_ms();
+    TraceSpan span = trace_begin(TRACE_ANALYZE);
+    ConversionParams chosen;
+    ContentClass content = apply_content(image, params, &chosen);
+    trace_end(span);
+    double analyze_ms = converter_now_ms() - start;
+
+    ConversionResult result = context_encode(ctx, image, output_path, &chosen, progress);
+    result.content = content;
+    result.timings.analyze_ms = analyze_ms;
+    return result;
+}
+
+ConversionResult converter_to_webp(const ImageData *image,
+                                    const char *output_path,
+                                    const ConversionParams *params,
+                                    const ConversionProgress *progress) {
+    ConversionResult result = {0};
+
+    ConverterContext *ctx = converter_context_create();
+    if (!ctx) {
+        result.success = false;
+        snprintf(result.error_message, sizeof(result.error_message),
+                "Out of memory");
+        return result;
+    }
+
+    /* A one-off conversion has the machine to itself */
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    converter_context_set_threads(ctx, cores > 1 ? (int)cores : 1);
+
+    result = converter_context_to_webp(ctx, image, output_path, params, progress);
+    converter_context_destroy(ctx);
+
+    return result;
+}
+
+/* Trial encodes for estimates only need the byte count */
+static int count_writer(const uint8_t *data, size_t data_size, const WebPPicture *picture) {
+    *(size_t *)picture->custom_ptr += data_size;
+    return 1;
+}
+
+static bool estimate_cancelled(const atomic_bool *cancel) {
+    return cancel && atomic_load_explicit(cancel, memory_order_relaxed);
+}
+
+/* Lets a cancel request stop a trial encode part way through */
+static int estimate_progress(int percent, const WebPPicture *picture) {
+    return !estimate_cancelled((const atomic_bool *)picture->user_data);
+}
+
+/* Encoded size of a w x h RGB/RGBA block, 0 on failure or cancel */
+static size_t encode_pixels(const uint8_t *pixels, int channels, int w, int h, int stride,
+                            const WebPConfig *config, const atomic_bool *cancel) {
+    WebPPicture picture;
+    if (!WebPPictureInit(&picture)) return 0;
+    picture.use_argb = config->lossless;
+    picture.width = w;
+    picture.height = h;
+
+    int imported = (channels == 4)
+        ? WebPPictureImportRGBA(&picture, pixels, stride)
+        : WebPPictureImportRGB(&picture, pixels, stride);
+
+    size_t size = 0;
+    if (imported) {
+        picture.writer = count_writer;
+        picture.custom_ptr = &size;
+        picture.progress_hook = estimate_progress;
+        picture.user_data = (void *)cancel;
+        if (!WebPEncode(config, &picture)) size = 0;
+    }
+    WebPPictureFree(&picture);
+
+    return size;
+}
+
+bool converter_estimate_size(const ImageData *image, const ConversionParams *params,
+                             const atomic_bool *cancel, SizeEstimate *estimate) {
+    if (!image || !image->data || !params || !estimate) return false;
+
+    ConversionParams chosen = *params;
+    if (params->auto_content) apply_content(image, params, &chosen);
+
+    /* Animations: the real encode, on one core, stopping with cancel */
+    if (image->frames > 1) {
+        WebPConfig config;
+        if (!build_config(&chosen, &config)) return false;
+        if (chosen.target_mode != TARGET_QUALITY) config.lossless = 0;
+        ConversionProgress progress = { NULL, NULL, cancel };
+        AnimResult anim;
+        if (!anim_encode(image, &config, &chosen, 1, &progress, &anim)) return false;
+        free(anim.data);
+        estimate->bytes = anim.size;
+        estimate->stddev = 0;
+        return true;
+    }
+
+    /* Best-of writes the smaller of the two encodes */
+    if (chosen.best_of && chosen.target_mode == TARGET_QUALITY) {
+        SizeEstimate lossy, lossless;
+        chosen.best_of = false;
+        chosen.lossless = false;
+        if (!converter_estimate_size(image, &chosen, cancel, &lossy)) return false;
+        chosen.lossless = true;
+        if (!converter_estimate_size(image, &chosen, cancel, &lossless)) return false;
+        *estimate = (lossless.bytes <= lossy.bytes) ? lossless : lossy;
+        return true;
+    }
+
+    WebPConfig config;
+    if (!build_config(&chosen, &config)) return false;
+
+    int channels = image->channels;
+    int stride = image->width * channels;
+    double pixels = (double)image->width * image->height;
+
+    /* Small images: a full encode costs little more than the samples would */
+    if (pixels <= ESTIMATE_FULL_PIXELS) {
+        size_t size = encode_pixels(image->data, channels, image->width, image->height,
+                                    stride, &config, cancel);
+        if (size == 0) return false;
+        estimate->bytes = size;
+        estimate->stddev = 0;
+        return true;
+    }
+
+    /*
+     * Sample full-width strips of ESTIMATE_STRIP_ROWS rows, about
+     * ESTIMATE_SAMPLE_FRACTION of the image, one from each of a set of
+     * equal horizontal bands at a pseudo-random offset inside it (a fixed
+     * position would favour the centre of the band). Strips are stacked
+     * into ESTIMATE_MOSAICS mosaics, strip i going to mosaic i % MOSAICS, so
+     * each mosaic covers the whole height. Every mosaic is one encode; the
+     * mean payload per pixel is scaled to the image and the spread between
+     * mosaics gives the standard error. Lossless estimates lean high:
+     * strips cannot reuse matches from elsewhere in the image.
+     */
+    int strip_rows = ESTIMATE_STRIP_ROWS;
+    int strips = (int)(image->height * ESTIMATE_SAMPLE_FRACTION / strip_rows);
+    strips = (strips + ESTIMATE_MOSAICS - 1) / ESTIMATE_MOSAICS * ESTIMATE_MOSAICS;
+    if (strips < ESTIMATE_MOSAICS) strips = ESTIMATE_MOSAICS;
+    while (strips * strip_rows > image->height && strip_rows > 1) strip_rows /= 2;
+
+    int per_mosaic = strips / ESTIMATE_MOSAICS;
+    int mosaic_h = per_mosaic * strip_rows;
+    uint8_t *mosaic = malloc((size_t)stride * mosaic_h);
+    if (!mosaic) return false;
+
+    uint32_t seed = (uint32_t)image->width * 2654435761u ^ (uint32_t)image->height;
+    double band = (double)image->height / strips;
+
+    double bpp[ESTIMATE_MOSAICS];
+    for (int m = 0; m < ESTIMATE_MOSAICS; m++) {
+        for (int k = 0; k < per_mosaic; k++) {
+            int strip = m + k * ESTIMATE_MOSAICS;
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            int slack = (int)band - strip_rows;
+            int y = (int)(strip * band) + (slack > 0 ? (int)(seed % (uint32_t)(slack + 1)) : 0);
+            if (y + strip_rows > image->height) y = image->height - strip_rows;
+            memcpy(mosaic + (size_t)k * strip_rows * stride,
+                   image->data + (size_t)y * stride, (size_t)strip_rows * stride);
+        }
+
+        size_t size = encode_pixels(mosaic, channels, image->width, mosaic_h, stride,
+                                    &config, cancel);
+        if (size == 0) {
+            free(mosaic);
+            return false;
+        }
+        double payload = size > ESTIMATE_CONTAINER_BYTES ? size - ESTIMATE_CONTAINER_BYTES : 0;
+        bpp[m] = payload / ((double)image->width * mosaic_h);
+    }
+    free(mosaic);
+
+    double mean = 0.0;
+    for (int m = 0; m < ESTIMATE_MOSAICS; m++) mean += bpp[m];
+    mean /= ESTIMATE_MOSAICS;
+
+    double variance = 0.0;
+    for (int m = 0; m < ESTIMATE_MOSAICS; m++) variance += (bpp[m] - mean) * (bpp[m] - mean);
+    variance /= (ESTIMATE_MOSAICS - 1);
+
+    estimate->bytes = (size_t)(mean * pixels) + ESTIMATE_CONTAINER_BYTES;
+    estimate->stddev = (size_t)(sqrt(variance / ESTIMATE_MOSAICS) * pixels);
+    return true;
 }
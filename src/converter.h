@@ -9,6 +9,25 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdatomic.h>
+
+/* How the encoder quality is chosen */
+typedef enum {
+    TARGET_QUALITY,         /* Use quality as given */
+    TARGET_SIZE,            /* Highest lossy quality whose output fits target_size */
+    TARGET_SSIM,            /* Lowest lossy quality reaching SSIM >= target_metric */
+    TARGET_PSNR             /* Lowest lossy quality reaching PSNR >= target_metric (dB) */
+} TargetMode;
+
+/* Kind of image, as seen by the content analysis (see content.h) */
+typedef enum {
+    CONTENT_NONE,           /* Not analysed: use params as given */
+    CONTENT_PHOTO,          /* Camera images: lossy, WEBP_PRESET_PHOTO */
+    CONTENT_PICTURE,        /* Renders, cut-outs with soft alpha: lossy, WEBP_PRESET_PICTURE */
+    CONTENT_DRAWING,        /* Logos, line art, few colours: lossless, WEBP_PRESET_DRAWING */
+    CONTENT_ICON,           /* Small images with few colours: lossless, WEBP_PRESET_ICON */
+    CONTENT_TEXT            /* Screenshots and scanned text: lossless, WEBP_PRESET_TEXT */
+} ContentClass;
 
 /* Conversion parameters */
 typedef struct {
@@ -19,42 +38,215 @@ typedef struct {
     int filter_strength;    /* 0-100, deblocking filter strength */
     int filter_sharpness;   /* 0-7, filter sharpness */
     int preprocessing;      /* 0-2, preprocessing filter */
+    TargetMode target_mode;
+    size_t target_size;     /* Byte budget per file (TARGET_SIZE) */
+    float target_metric;    /* SSIM (0-1) or PSNR (dB) floor */
+    bool auto_content;      /* Analyse each image and pick lossless and content_hint */
+    bool best_of;           /* Encode lossy and lossless at once, keep the smaller */
+    int keyframe_interval;  /* Animations: full frame at least every N frames (0 = first only) */
+    bool minimize_size;     /* Animations: also try every frame whole, keep the smaller */
+    ContentClass content_hint; /* libwebp preset to start from (CONTENT_NONE: defaults) */
 } ConversionParams;
 
 /* Image data structure */
 typedef struct {
-    unsigned char *data;    /* RGBA pixel data */
+    unsigned char *data;    /* RGB or RGBA pixel data (see channels) */
     int width;
     int height;
-    int channels;           /* Number of channels (3=RGB, 4=RGBA) */
+    int channels;           /* 3=RGB, 4=RGBA (only if some pixel is transparent) */
     char filepath[512];     /* Source file path */
     size_t file_size;       /* Original file size in bytes */
+    int frames;             /* Animated GIFs: frames stacked in data, RGBA (0 or 1: a still) */
+    int *delays;            /* Display time of each frame in ms (animations only) */
+    int loops;              /* Times the animation plays, 0 = forever */
 } ImageData;
 
+/* Wall time of each conversion stage, in milliseconds */
+typedef struct {
+    double read_ms;         /* Reading the file (batch engine only) */
+    double decode_ms;       /* Decoding it to pixels (batch engine only) */
+    double analyze_ms;      /* Content analysis (auto_content only) */
+    double import_ms;       /* Handing the pixels to libwebp (ARGB/YUV conversion) */
+    double encode_ms;       /* Encoding, less the time spent writing */
+    double write_ms;        /* Creating, writing and renaming the output file */
+} StageTimings;
+
+/* Encoder statistics of the written bitstream (libwebp's WebPAuxStats) */
+typedef struct {
+    float psnr[5];          /* Y, U, V, all and alpha PSNR in dB (lossy only) */
+    int header_bytes[2];    /* Partition 0 header and mode bytes */
+    int segment_bytes[4];   /* Residual bytes per segment */
+    int segment_quant[4];   /* Quantizer per segment */
+    int block_count[3];     /* Intra 4x4, intra 16x16 and skipped macroblocks */
+    int alpha_bytes;        /* Compressed alpha data */
+    int lossless_bytes;     /* Lossless bitstream (lossless only) */
+} EncoderStats;
+
 /* Conversion result */
 typedef struct {
     bool success;
     char error_message[256];
     size_t output_size;     /* Output file size in bytes */
     float compression_ratio; /* Original size / output size */
+    int allocations;        /* Converter buffer allocations for this image */
+    float quality;          /* Quality used (the search winner in target modes) */
+    float metric;           /* SSIM or PSNR achieved (TARGET_SSIM/TARGET_PSNR) */
+    StageTimings timings;
+    size_t peak_bytes;      /* Pixel, picture and output buffers held at once
+                               (libwebp's internal encoder state not included) */
+    EncoderStats stats;
+    int threads;            /* Cores the conversion was given */
+    ContentClass content;   /* Class encoded as (auto_content or content_hint) */
+    bool lossless;          /* Encoded lossless (auto_content or best_of may choose either) */
+    size_t runner_up_size;  /* best_of: the losing encode's size (0 if it never got that far) */
+    int frames;             /* Animations: frames written (identical ones merged) */
+    bool cancelled;         /* Stopped through ConversionProgress (no output left) */
 } ConversionResult;
 
+/*
+ * Progress and cancellation of one conversion. report (may be NULL) gets
+ * the fraction of the image done so far, 0-1, on the converting thread.
+ * Setting *cancel (may be NULL) stops the encode at libwebp's next
+ * progress checkpoint: the conversion frees what it holds, leaves no
+ * output file and returns with cancelled set.
+ */
+typedef struct {
+    void (*report)(float fraction, void *user_data);
+    void *user_data;
+    const atomic_bool *cancel;
+} ConversionProgress;
+
+/* Estimated output size of one image */
+typedef struct {
+    size_t bytes;
+    size_t stddev;          /* Standard error of bytes (0 when encoded whole) */
+} SizeEstimate;
+
+/*
+ * Reusable encoder state. Each worker thread owns one and passes it to
+ * converter_context_to_webp() for every image: the validated config for
+ * the last params and the picture/output buffers are kept, so a steady
+ * stream of same-sized images makes no allocations (see allocations).
+ */
+typedef struct ConverterContext ConverterContext;
+
+/* Monotonic clock in milliseconds, for stage timings */
+double converter_now_ms(void);
+
+/*
+ * Peak resident set size of the process, in bytes. On Linux this is the
+ * high-water mark converter_reset_peak_rss() restarts; elsewhere it only
+ * grows.
+ */
+size_t converter_peak_rss(void);
+
+/* Restart the peak from the current resident size, where supported */
+void converter_reset_peak_rss(void);
+
 /* Initialize default parameters */
 void converter_init_params(ConversionParams *params);
 
+/* Same settings, compared field by field (padding bytes are unspecified) */
+bool converter_params_equal(const ConversionParams *a, const ConversionParams *b);
+
+/* Encoded bytes of an input file, mapped read-only when possible */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    bool mapped;            /* Released with munmap rather than free */
+} FileBuffer;
+
+/*
+ * Read a whole file. With prefetch every page is faulted in before
+ * returning, so a later decode does not wait on the disk.
+ */
+bool converter_read_file(const char *filepath, FileBuffer *file, bool prefetch);
+
+/* Fault in the pages of a mapped file read without prefetch */
+void converter_prefetch_file(const FileBuffer *file);
+
+/* Release a buffer from converter_read_file() */
+void converter_release_file(FileBuffer *file);
+
+/* How converter_copy_file() produced its output */
+typedef enum {
+    COPY_FAILED,
+    COPY_REFLINK,               /* Copy-on-write clone, no data written */
+    COPY_HARDLINK,              /* Second name for the same file */
+    COPY_BYTES                  /* Plain copy */
+} CopyMethod;
+
+/*
+ * Give output_path the contents of an existing file, as cheaply as the
+ * file system allows: a reflink, else a hard link, else a copy. Goes
+ * through a temp file and rename like every other output.
+ */
+CopyMethod converter_copy_file(const char *source_path, const char *output_path);
+
+/* "reflink", "hardlink", "copy" (or "none") */
+const char* converter_copy_method_name(CopyMethod method);
+
 /* Load an image from file (supports PNG, JPEG, BMP, GIF) */
 bool converter_load_image(const char *filepath, ImageData *image);
 
+/*
+ * Decode an encoded image already held in memory. The buffer is only read
+ * during the call; file_size is set to size and filepath is left empty.
+ */
+bool converter_load_image_from_memory(const unsigned char *buffer, size_t size,
+                                      ImageData *image);
+
+/*
+ * Read dimensions, channel count and file size without decoding pixels.
+ * image->data is left NULL, so converter_free_image() is not needed.
+ */
+bool converter_probe_image(const char *filepath, ImageData *image);
+
+/* converter_probe_image() on an encoded image already held in memory */
+bool converter_probe_image_from_memory(const unsigned char *buffer, size_t size,
+                                       ImageData *image);
+
+/*
+ * Predicted peak heap use, in bytes, of decoding and converting a probed
+ * image with params (the encoded file included). Errs on the high side.
+ */
+size_t converter_predict_peak(const ImageData *probe, const ConversionParams *params);
+
 /* Free image data */
 void converter_free_image(ImageData *image);
 
-/* Convert image to WebP and save to file */
+/* Convert image to WebP and save to file, using every core; progress may be NULL */
 ConversionResult converter_to_webp(const ImageData *image,
                                     const char *output_path,
-                                    const ConversionParams *params);
+                                    const ConversionParams *params,
+                                    const ConversionProgress *progress);
+
+/* Create / destroy a reusable encoder context (not thread-safe, one per thread) */
+ConverterContext* converter_context_create(void);
+void converter_context_destroy(ConverterContext *ctx);
 
-/* Estimate output size (rough approximation) */
-size_t converter_estimate_size(const ImageData *image, const ConversionParams *params);
+/*
+ * Cores one conversion with ctx may use (default 1). Above 1, libwebp's
+ * internal threading is enabled and the ARGB packing of alpha and
+ * lossless sources is split into row bands. Output is unchanged.
+ */
+void converter_context_set_threads(ConverterContext *ctx, int threads);
+
+/* Same as converter_to_webp(), recycling ctx's config and buffers */
+ConversionResult converter_context_to_webp(ConverterContext *ctx,
+                                           const ImageData *image,
+                                           const char *output_path,
+                                           const ConversionParams *params,
+                                           const ConversionProgress *progress);
+
+/*
+ * Estimate the output size by trial-encoding strips spread over the
+ * image with the real params (small images are encoded whole). Returns
+ * false on failure or once cancel is set, which also stops an encode
+ * part way.
+ */
+bool converter_estimate_size(const ImageData *image, const ConversionParams *params,
+                             const atomic_bool *cancel, SizeEstimate *estimate);
 
 /* Get supported file extensions */
 const char* converter_get_supported_extensions(void);
@@ -0,0 +1,506 @@
+/*
+ * WebP Converter - Synthetic benchmark corpus implementation
+ *
+ * Every image is drawn from its own splitmix64 stream, seeded from its
+ * kind and size, with integer math (and correctly rounded sqrt), so the
+ * files are byte-identical across runs and machines.
+ */
+
+#include "corpus.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* Compressed bytes gathered before they go out as one IDAT chunk */
+#define PNG_CHUNK_SIZE (1 << 20)
+
+/* Longest match deflate can express */
+#define DEFLATE_MAX_RUN 258
+
+static const int CORPUS_DIMENSIONS[CORPUS_SIZE_COUNT][2] = {
+    [CORPUS_TINY]   = { 48, 48 },
+    [CORPUS_SMALL]  = { 400, 300 },
+    [CORPUS_MEDIUM] = { 1600, 1200 },
+    [CORPUS_LARGE]  = { 4000, 3000 },
+    [CORPUS_HUGE]   = { 8192, 6144 },
+};
+
+typedef struct {
+    uint64_t state;
+} Rng;
+
+/* splitmix64 */
+static uint64_t rng_next(Rng *rng) {
+    uint64_t z = (rng->state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static int rng_range(Rng *rng, int n) {
+    return n > 0 ? (int)(rng_next(rng) % (uint64_t)n) : 0;
+}
+
+static unsigned char clamp_byte(int value) {
+    return (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+const char* corpus_kind_name(CorpusKind kind) {
+    switch (kind) {
+        case CORPUS_PHOTO:    return "photo";
+        case CORPUS_GRADIENT: return "gradient";
+        case CORPUS_FLAT:     return "flat";
+        case CORPUS_TEXT:     return "text";
+        case CORPUS_ALPHA:    return "alpha";
+        default:              return "unknown";
+    }
+}
+
+void corpus_describe(CorpusKind kind, CorpusSize size, CorpusImage *image) {
+    memset(image, 0, sizeof(CorpusImage));
+    image->kind = kind;
+    image->size = size;
+    image->width = CORPUS_DIMENSIONS[size][0];
+    image->height = CORPUS_DIMENSIONS[size][1];
+    image->channels = (kind == CORPUS_ALPHA) ? 4 : 3;
+    snprintf(image->name, sizeof(image->name), "%s-%dx%d.png",
+             corpus_kind_name(kind), image->width, image->height);
+}
+
+/* Grid of random values, one every cell pixels, for value noise */
+typedef struct {
+    unsigned char *values;
+    int columns;
+    int cell;
+} NoiseGrid;
+
+static bool grid_init(NoiseGrid *grid, Rng *rng, int width, int height, int cell) {
+    grid->cell = cell;
+    grid->columns = width / cell + 2;
+    int rows = height / cell + 2;
+    grid->values = malloc((size_t)grid->columns * rows);
+    if (!grid->values) return false;
+    for (int i = 0; i < grid->columns * rows; i++) {
+        grid->values[i] = (unsigned char)rng_next(rng);
+    }
+    return true;
+}
+
+/* Bilinear value noise at (x, y), 0..255 * cell * cell */
+static int grid_sample(const NoiseGrid *grid, int x, int y) {
+    int gx = x / grid->cell, gy = y / grid->cell;
+    int fx = x % grid->cell, fy = y % grid->cell;
+    int cell = grid->cell;
+    const unsigned char *row = grid->values + (size_t)gy * grid->columns + gx;
+    int top = row[0] * (cell - fx) + row[1] * fx;
+    int bottom = row[grid->columns] * (cell - fx) + row[grid->columns + 1] * fx;
+    return top * (cell - fy) + bottom * fy;
+}
+
+/* Two octaves of value noise per channel, plus per-pixel grain */
+static bool draw_photo(unsigned char *pixels, int width, int height, Rng *rng) {
+    int coarse = width / 16 > 8 ? width / 16 : 8;
+    int fine = width / 128 > 4 ? width / 128 : 4;
+    NoiseGrid grids[6] = {{0}};
+    bool ok = true;
+    for (int i = 0; i < 6 && ok; i++) {
+        ok = grid_init(&grids[i], rng, width, height, i < 3 ? coarse : fine);
+    }
+
+    for (int y = 0; ok && y < height; y++) {
+        unsigned char *p = pixels + (size_t)y * width * 3;
+        for (int x = 0; x < width; x++) {
+            uint64_t grain = rng_next(rng);
+            for (int c = 0; c < 3; c++) {
+                int low = grid_sample(&grids[c], x, y) / (coarse * coarse);
+                int high = grid_sample(&grids[3 + c], x, y) / (fine * fine);
+                int noise = (int)((grain >> (c * 8)) & 15) - 8;
+                p[c] = clamp_byte((low * 3 + high) / 4 + noise);
+            }
+            p += 3;
+        }
+    }
+
+    for (int i = 0; i < 6; i++) free(grids[i].values);
+    return ok;
+}
+
+/* Red across, green down, blue with the distance from the centre */
+static void draw_gradient(unsigned char *pixels, int width, int height) {
+    int64_t cx = width / 2, cy = height / 2;
+    int64_t reach = cx * cx + cy * cy;
+    for (int y = 0; y < height; y++) {
+        unsigned char *p = pixels + (size_t)y * width * 3;
+        for (int x = 0; x < width; x++) {
+            int64_t dx = x - cx, dy = y - cy;
+            p[0] = (unsigned char)(x * 255 / (width > 1 ? width - 1 : 1));
+            p[1] = (unsigned char)(y * 255 / (height > 1 ? height - 1 : 1));
+            p[2] = (unsigned char)((dx * dx + dy * dy) * 255 / (reach ? reach : 1));
+            p += 3;
+        }
+    }
+}
+
+/* Rectangles in an eight-colour palette */
+static void draw_flat(unsigned char *pixels, int width, int height, Rng *rng) {
+    unsigned char palette[8][3];
+    for (int i = 0; i < 8; i++) {
+        uint64_t bits = rng_next(rng);
+        for (int c = 0; c < 3; c++) palette[i][c] = (unsigned char)(bits >> (c * 8));
+    }
+
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+        memcpy(pixels + i * 3, palette[0], 3);
+    }
+
+    for (int r = 0; r < 40; r++) {
+        int w = 1 + rng_range(rng, width / 3), h = 1 + rng_range(rng, height / 3);
+        int x0 = rng_range(rng, width - w + 1), y0 = rng_range(rng, height - h + 1);
+        const unsigned char *color = palette[1 + rng_range(rng, 7)];
+        for (int y = y0; y < y0 + h; y++) {
+            unsigned char *p = pixels + ((size_t)y * width + x0) * 3;
+            for (int x = 0; x < w; x++, p += 3) memcpy(p, color, 3);
+        }
+    }
+}
+
+/* Lines of random 5x7 glyphs, scaled with the page */
+static void draw_text(unsigned char *pixels, int width, int height, Rng *rng) {
+    memset(pixels, 242, (size_t)width * height * 3);
+
+    int scale = 1 + width / 1000;
+    int cell_w = 6 * scale, cell_h = 10 * scale;
+    int margin = 2 * cell_w;
+
+    for (int top = margin / 2; top + cell_h <= height; top += cell_h) {
+        for (int left = margin; left + cell_w <= width - margin; left += cell_w) {
+            uint64_t glyph = rng_next(rng);
+            if ((glyph >> 60) < 3) continue;   /* Space */
+            for (int gy = 0; gy < 7; gy++) {
+                for (int gx = 0; gx < 5; gx++) {
+                    if (!((glyph >> (gy * 5 + gx)) & 1)) continue;
+                    for (int sy = 0; sy < scale; sy++) {
+                        unsigned char *p = pixels +
+                            ((size_t)(top + gy * scale + sy) * width + left + gx * scale) * 3;
+                        memset(p, 28, (size_t)scale * 3);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Shaded discs with soft edges, over a transparent background */
+static void draw_alpha(unsigned char *pixels, int width, int height, Rng *rng) {
+    memset(pixels, 0, (size_t)width * height * 4);
+
+    int shortest = width < height ? width : height;
+    for (int d = 0; d < 12; d++) {
+        int radius = shortest / 12 + rng_range(rng, shortest / 6 + 1);
+        if (radius < 2) radius = 2;
+        int cx = rng_range(rng, width), cy = rng_range(rng, height);
+        uint64_t bits = rng_next(rng);
+        int color[3] = { (int)(bits & 255), (int)((bits >> 8) & 255), (int)((bits >> 16) & 255) };
+
+        int x0 = cx - radius < 0 ? 0 : cx - radius;
+        int x1 = cx + radius >= width ? width - 1 : cx + radius;
+        int y0 = cy - radius < 0 ? 0 : cy - radius;
+        int y1 = cy + radius >= height ? height - 1 : cy + radius;
+        int64_t r2 = (int64_t)radius * radius;
+
+        for (int y = y0; y <= y1; y++) {
+            unsigned char *p = pixels + ((size_t)y * width + x0) * 4;
+            for (int x = x0; x <= x1; x++, p += 4) {
+                int64_t dx = x - cx, dy = y - cy;
+                int64_t d2 = dx * dx + dy * dy;
+                if (d2 >= r2) continue;
+
+                /* 0..256 from the centre to the rim; the outer 30% fades out */
+                int t = (int)(sqrt((double)d2 / (double)r2) * 256.0);
+                int a = t < 179 ? 255 : 255 * (256 - t) / 77;
+                int shade = 256 - t / 4;
+
+                /* Source over destination, straight alpha */
+                int da = p[3] * (255 - a) / 255;
+                int out_a = a + da;
+                if (out_a == 0) continue;
+                for (int c = 0; c < 3; c++) {
+                    int src = color[c] * shade / 256;
+                    p[c] = clamp_byte((src * a + p[c] * da) / out_a);
+                }
+                p[3] = (unsigned char)out_a;
+            }
+        }
+    }
+}
+
+unsigned char* corpus_generate(const CorpusImage *image) {
+    size_t size = (size_t)image->width * image->height * image->channels;
+    unsigned char *pixels = malloc(size);
+    if (!pixels) return NULL;
+
+    Rng rng = { (uint64_t)(image->kind + 1) * 1000003u + (uint64_t)image->size };
+    switch (image->kind) {
+        case CORPUS_PHOTO:
+            if (!draw_photo(pixels, image->width, image->height, &rng)) {
+                free(pixels);
+                return NULL;
+            }
+            break;
+        case CORPUS_GRADIENT: draw_gradient(pixels, image->width, image->height); break;
+        case CORPUS_FLAT:     draw_flat(pixels, image->width, image->height, &rng); break;
+        case CORPUS_TEXT:     draw_text(pixels, image->width, image->height, &rng); break;
+        default:              draw_alpha(pixels, image->width, image->height, &rng); break;
+    }
+    return pixels;
+}
+
+bool corpus_prepare(const CorpusImage *image, const char *dir, char *path, size_t size) {
+    int n = snprintf(path, size, "%s/%s", dir, image->name);
+    if (n < 0 || (size_t)n >= size) return false;
+
+    struct stat st;
+    if (stat(path, &st) == 0 && st.st_size > 0) return true;
+
+    unsigned char *pixels = corpus_generate(image);
+    if (!pixels) return false;
+
+    /* Written aside first, so an interrupted run leaves no truncated file to reuse */
+    char temp[1024];
+    n = snprintf(temp, sizeof(temp), "%s.tmp", path);
+    bool ok = n >= 0 && (size_t)n < sizeof(temp) &&
+              corpus_write_png(temp, pixels, image->width, image->height, image->channels) &&
+              rename(temp, path) == 0;
+    if (!ok) remove(temp);
+
+    free(pixels);
+    return ok;
+}
+
+/* PNG output: zlib stream of one fixed-Huffman deflate block, split into IDAT chunks */
+typedef struct {
+    FILE *file;
+    uint32_t crc_table[256];
+    unsigned char *chunk;
+    size_t used;
+    uint64_t bits;
+    int bit_count;
+    uint32_t adler_a, adler_b;
+    int last;               /* Last byte fed to deflate, -1 before the first */
+    uint16_t codes[288];    /* Fixed literal/length codes, bit-reversed */
+    uint8_t lengths[288];
+    bool failed;
+} PngWriter;
+
+static uint32_t crc_update(const PngWriter *writer, uint32_t crc, const unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        crc = writer->crc_table[(crc ^ data[i]) & 255] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void put_u32(unsigned char *out, uint32_t value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+static void write_chunk(PngWriter *writer, const char *type, const unsigned char *data, size_t size) {
+    unsigned char header[8], trailer[4];
+    put_u32(header, (uint32_t)size);
+    memcpy(header + 4, type, 4);
+    uint32_t crc = crc_update(writer, 0xFFFFFFFFu, header + 4, 4);
+    crc = crc_update(writer, crc, data, size);
+    put_u32(trailer, crc ^ 0xFFFFFFFFu);
+
+    if (fwrite(header, 1, 8, writer->file) != 8 ||
+        (size > 0 && fwrite(data, 1, size, writer->file) != size) ||
+        fwrite(trailer, 1, 4, writer->file) != 4) {
+        writer->failed = true;
+    }
+}
+
+static void push_byte(PngWriter *writer, unsigned char byte) {
+    writer->chunk[writer->used++] = byte;
+    if (writer->used == PNG_CHUNK_SIZE) {
+        write_chunk(writer, "IDAT", writer->chunk, writer->used);
+        writer->used = 0;
+    }
+}
+
+static void put_bits(PngWriter *writer, uint32_t value, int count) {
+    writer->bits |= (uint64_t)value << writer->bit_count;
+    writer->bit_count += count;
+    while (writer->bit_count >= 8) {
+        push_byte(writer, (unsigned char)writer->bits);
+        writer->bits >>= 8;
+        writer->bit_count -= 8;
+    }
+}
+
+static void put_symbol(PngWriter *writer, int symbol) {
+    put_bits(writer, writer->codes[symbol], writer->lengths[symbol]);
+}
+
+/* A run of the last byte: length code, extra bits, then distance 1 (code 0) */
+static void put_run(PngWriter *writer, int length) {
+    static const int base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const int extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                   3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    int i = 28;
+    while (base[i] > length) i--;
+    put_symbol(writer, 257 + i);
+    if (extra[i]) put_bits(writer, (uint32_t)(length - base[i]), extra[i]);
+    put_bits(writer, 0, 5);
+}
+
+static void deflate_bytes(PngWriter *writer, const unsigned char *data, size_t size) {
+    /* Adler-32, reduced before the sums can overflow */
+    for (size_t done = 0; done < size; ) {
+        size_t n = size - done < 5552 ? size - done : 5552;
+        for (size_t i = 0; i < n; i++) {
+            writer->adler_a += data[done + i];
+            writer->adler_b += writer->adler_a;
+        }
+        writer->adler_a %= 65521;
+        writer->adler_b %= 65521;
+        done += n;
+    }
+
+    size_t i = 0;
+    while (i < size) {
+        if (data[i] == writer->last) {
+            size_t run = 1;
+            while (i + run < size && run < DEFLATE_MAX_RUN && data[i + run] == writer->last) run++;
+            if (run >= 3) {
+                put_run(writer, (int)run);
+                i += run;
+                continue;
+            }
+        }
+        put_symbol(writer, data[i]);
+        writer->last = data[i];
+        i++;
+    }
+}
+
+static uint32_t reverse_bits(uint32_t value, int count) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < count; i++) {
+        reversed = (reversed << 1) | (value & 1);
+        value >>= 1;
+    }
+    return reversed;
+}
+
+static void png_writer_init(PngWriter *writer, FILE *file, unsigned char *chunk) {
+    memset(writer, 0, sizeof(PngWriter));
+    writer->file = file;
+    writer->chunk = chunk;
+    writer->adler_a = 1;
+    writer->last = -1;
+
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        writer->crc_table[n] = c;
+    }
+
+    /* RFC 1951, 3.2.6 */
+    for (int symbol = 0; symbol < 288; symbol++) {
+        uint32_t code;
+        int length;
+        if (symbol < 144)      { code = 0x30 + symbol;          length = 8; }
+        else if (symbol < 256) { code = 0x190 + symbol - 144;   length = 9; }
+        else if (symbol < 280) { code = symbol - 256;           length = 7; }
+        else                   { code = 0xC0 + symbol - 280;    length = 8; }
+        writer->codes[symbol] = (uint16_t)reverse_bits(code, length);
+        writer->lengths[symbol] = (uint8_t)length;
+    }
+}
+
+/* Sum of the filtered bytes taken as signed, the usual PNG filter heuristic */
+static uint64_t filter_cost(const unsigned char *row, size_t size) {
+    uint64_t cost = 0;
+    for (size_t i = 0; i < size; i++) {
+        cost += row[i] < 128 ? row[i] : 256 - row[i];
+    }
+    return cost;
+}
+
+bool corpus_write_png(const char *path, const unsigned char *pixels,
+                      int width, int height, int channels) {
+    size_t stride = (size_t)width * channels;
+    unsigned char *chunk = malloc(PNG_CHUNK_SIZE);
+    unsigned char *filtered = malloc(2 * (stride + 1));
+    FILE *file = fopen(path, "wb");
+    if (!chunk || !filtered || !file) {
+        free(chunk);
+        free(filtered);
+        if (file) fclose(file);
+        return false;
+    }
+
+    PngWriter writer;
+    png_writer_init(&writer, file, chunk);
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    if (fwrite(signature, 1, 8, file) != 8) writer.failed = true;
+
+    unsigned char header[13];
+    put_u32(header, (uint32_t)width);
+    put_u32(header + 4, (uint32_t)height);
+    header[8] = 8;                              /* Bit depth */
+    header[9] = channels == 4 ? 6 : 2;          /* RGBA or RGB */
+    header[10] = header[11] = header[12] = 0;   /* Deflate, adaptive filters, no interlace */
+    write_chunk(&writer, "IHDR", header, sizeof(header));
+
+    /* zlib header (deflate, 32K window, fastest), then one final fixed-Huffman block */
+    push_byte(&writer, 0x78);
+    push_byte(&writer, 0x01);
+    put_bits(&writer, 1, 1);
+    put_bits(&writer, 1, 2);
+
+    unsigned char *sub = filtered, *up = filtered + stride + 1;
+    for (int y = 0; y < height && !writer.failed; y++) {
+        const unsigned char *row = pixels + (size_t)y * stride;
+        const unsigned char *above = y > 0 ? row - stride : NULL;
+
+        sub[0] = 1;
+        up[0] = 2;
+        for (size_t i = 0; i < stride; i++) {
+            sub[1 + i] = (unsigned char)(row[i] - (i >= (size_t)channels ? row[i - channels] : 0));
+            up[1 + i] = (unsigned char)(row[i] - (above ? above[i] : 0));
+        }
+
+        uint64_t none_cost = filter_cost(row, stride);
+        uint64_t sub_cost = filter_cost(sub + 1, stride);
+        uint64_t up_cost = filter_cost(up + 1, stride);
+        if (none_cost <= sub_cost && none_cost <= up_cost) {
+            static const unsigned char none = 0;
+            deflate_bytes(&writer, &none, 1);
+            deflate_bytes(&writer, row, stride);
+        } else {
+            deflate_bytes(&writer, sub_cost <= up_cost ? sub : up, stride + 1);
+        }
+    }
+
+    put_symbol(&writer, 256);
+    if (writer.bit_count > 0) put_bits(&writer, 0, 8 - writer.bit_count);
+    unsigned char adler[4];
+    put_u32(adler, (writer.adler_b << 16) | writer.adler_a);
+    for (int i = 0; i < 4; i++) push_byte(&writer, adler[i]);
+    if (writer.used > 0) write_chunk(&writer, "IDAT", chunk, writer.used);
+    write_chunk(&writer, "IEND", NULL, 0);
+
+    bool ok = !writer.failed;
+    if (fclose(file) != 0) ok = false;
+    free(chunk);
+    free(filtered);
+    return ok;
+}
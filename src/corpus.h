@@ -0,0 +1,68 @@
+/*
+ * WebP Converter - Synthetic benchmark corpus
+ * Deterministic test images of the kinds the converter meets (photos,
+ * gradients, flat graphics, text, alpha cut-outs), from icon size to
+ * 50 megapixels, written as PNG files so a benchmark goes through the
+ * same loading path as real inputs.
+ */
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    CORPUS_PHOTO,           /* Smooth noise with grain, RGB */
+    CORPUS_GRADIENT,        /* Linear and radial ramps, RGB */
+    CORPUS_FLAT,            /* Overlapping rectangles in a few colours, RGB */
+    CORPUS_TEXT,            /* Dark glyphs on a light page, RGB */
+    CORPUS_ALPHA,           /* Soft-edged discs on a transparent background, RGBA */
+    CORPUS_KIND_COUNT
+} CorpusKind;
+
+typedef enum {
+    CORPUS_TINY,            /* 48x48 */
+    CORPUS_SMALL,           /* 400x300 */
+    CORPUS_MEDIUM,          /* 1600x1200, 1.9 MP */
+    CORPUS_LARGE,           /* 4000x3000, 12 MP */
+    CORPUS_HUGE,            /* 8192x6144, 50 MP */
+    CORPUS_SIZE_COUNT
+} CorpusSize;
+
+/* One image of the corpus */
+typedef struct {
+    CorpusKind kind;
+    CorpusSize size;
+    int width;
+    int height;
+    int channels;           /* 3 or 4 */
+    char name[64];          /* "photo-4000x3000.png" */
+} CorpusImage;
+
+const char* corpus_kind_name(CorpusKind kind);
+
+/* Dimensions and file name of one image */
+void corpus_describe(CorpusKind kind, CorpusSize size, CorpusImage *image);
+
+/*
+ * Pixels of image (width * height * channels bytes, to free()), the same
+ * on every run and platform. NULL on OOM.
+ */
+unsigned char* corpus_generate(const CorpusImage *image);
+
+/*
+ * Path of image in dir (written to path), generating the file unless a
+ * previous run left it there. Returns false if it cannot be written.
+ */
+bool corpus_prepare(const CorpusImage *image, const char *dir, char *path, size_t size);
+
+/*
+ * Write 8-bit RGB or RGBA pixels as a PNG. Rows get the cheapest of the
+ * None, Sub and Up filters and byte runs are deflated, so flat images
+ * stay small while noise is stored at about its raw size.
+ */
+bool corpus_write_png(const char *path, const unsigned char *pixels,
+                      int width, int height, int channels);
+
+#endif /* CORPUS_H */
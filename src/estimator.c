@@ -0,0 +1,268 @@
+/*
+ * WebP Converter - Background batch size estimator implementation
+ */
+
+#include "estimator.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+/* Two-sided 95% normal quantile */
+#define ESTIMATOR_Z95 1.96
+
+struct Estimator {
+    pthread_t thread;
+    bool thread_started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stopping;
+    bool pending;               /* Files or params changed since the last run started */
+    atomic_bool cancel;         /* Tells the running trial encode to give up */
+    unsigned generation;        /* Bumped on every change, tags published results */
+
+    /* Batch (guarded by lock): evenly spaced samples plus totals of all files */
+    char *sample_paths[ESTIMATOR_MAX_SAMPLES];
+    size_t sample_sizes[ESTIMATOR_MAX_SAMPLES];
+    int samples;
+    double total_bytes;         /* Sum of input sizes */
+    double total_squares;       /* Sum of squared input sizes */
+
+    ConversionParams params;
+    bool has_params;
+
+    /* Latest result (guarded by lock) */
+    BatchEstimate estimate;
+    bool has_estimate;
+};
+
+/* Running sums of one run */
+typedef struct {
+    int sampled;
+    double processed_bytes, processed_squares;  /* Inputs seen, including failed loads */
+    double input, output;       /* Inputs and estimates of sampled files that loaded */
+    double output_variance;     /* Sum of squared standard errors */
+    double ratio_sum, ratio_squares;
+    int ratios;
+} RunTotals;
+
+/*
+ * Scale the output/input ratio of the sampled files to the rest of the
+ * batch. Each unsampled file is taken to vary around the mean ratio as
+ * much as the samples do, and the mean itself carries its standard error;
+ * with a single sample the ratio is treated as 100% uncertain.
+ */
+static BatchEstimate extrapolate(const RunTotals *t, double total_bytes, double total_squares,
+                                 int samples) {
+    BatchEstimate estimate = { .sampled = t->sampled, .samples = samples,
+                               .done = t->sampled == samples };
+
+    double ratio = t->input > 0 ? t->output / t->input : 0.0;
+    double ratio_variance = ratio * ratio;
+    if (t->ratios > 1) {
+        double mean = t->ratio_sum / t->ratios;
+        ratio_variance = (t->ratio_squares - t->ratios * mean * mean) / (t->ratios - 1);
+        if (ratio_variance < 0) ratio_variance = 0;
+    }
+
+    double rest = total_bytes - t->processed_bytes;
+    double rest_squares = total_squares - t->processed_squares;
+    if (rest < 0) rest = 0;
+    if (rest_squares < 0) rest_squares = 0;
+
+    double bytes = t->output + ratio * rest;
+    double variance = t->output_variance + ratio_variance * rest_squares;
+    if (t->ratios > 0) variance += ratio_variance / t->ratios * rest * rest;
+
+    double margin = ESTIMATOR_Z95 * sqrt(variance);
+    estimate.bytes = (size_t)bytes;
+    estimate.low = bytes > margin ? (size_t)(bytes - margin) : 0;
+    estimate.high = (size_t)(bytes + margin);
+    return estimate;
+}
+
+static void run(Estimator *estimator, unsigned generation, char **paths, const size_t *sizes,
+                int samples, double total_bytes, double total_squares,
+                const ConversionParams *params) {
+    RunTotals totals = {0};
+
+    for (int i = 0; i < samples; i++) {
+        if (atomic_load(&estimator->cancel)) return;
+
+        double size = (double)sizes[i];
+        totals.processed_bytes += size;
+        totals.processed_squares += size * size;
+
+        ImageData image;
+        SizeEstimate file;
+        if (converter_load_image(paths[i], &image)) {
+            bool ok = converter_estimate_size(&image, params, &estimator->cancel, &file);
+            converter_free_image(&image);
+            if (!ok && atomic_load(&estimator->cancel)) return;
+
+            /* A file that fails here will fail to convert too: it adds nothing */
+            if (ok && size > 0) {
+                totals.input += size;
+                totals.output += file.bytes;
+                totals.output_variance += (double)file.stddev * file.stddev;
+                double ratio = file.bytes / size;
+                totals.ratio_sum += ratio;
+                totals.ratio_squares += ratio * ratio;
+                totals.ratios++;
+            }
+        }
+        totals.sampled++;
+
+        BatchEstimate estimate = extrapolate(&totals, total_bytes, total_squares, samples);
+        pthread_mutex_lock(&estimator->lock);
+        if (estimator->generation == generation) {
+            estimator->estimate = estimate;
+            estimator->has_estimate = true;
+        }
+        pthread_mutex_unlock(&estimator->lock);
+    }
+}
+
+static void* estimator_main(void *arg) {
+    Estimator *estimator = arg;
+
+    pthread_mutex_lock(&estimator->lock);
+    for (;;) {
+        while (!estimator->pending && !estimator->stopping) {
+            pthread_cond_wait(&estimator->wake, &estimator->lock);
+        }
+        if (estimator->stopping) break;
+
+        estimator->pending = false;
+        atomic_store(&estimator->cancel, false);
+        if (!estimator->has_params || estimator->samples == 0) continue;
+
+        /* Work on a copy so the batch can be replaced while we encode */
+        unsigned generation = estimator->generation;
+        int samples = estimator->samples;
+        char *paths[ESTIMATOR_MAX_SAMPLES];
+        size_t sizes[ESTIMATOR_MAX_SAMPLES];
+        for (int i = 0; i < samples; i++) {
+            paths[i] = strdup(estimator->sample_paths[i]);
+            sizes[i] = estimator->sample_sizes[i];
+        }
+        double total_bytes = estimator->total_bytes;
+        double total_squares = estimator->total_squares;
+        ConversionParams params = estimator->params;
+        pthread_mutex_unlock(&estimator->lock);
+
+        bool copied = true;
+        for (int i = 0; i < samples; i++) copied = copied && paths[i];
+        if (copied) {
+            run(estimator, generation, paths, sizes, samples, total_bytes, total_squares, &params);
+        }
+        for (int i = 0; i < samples; i++) free(paths[i]);
+
+        pthread_mutex_lock(&estimator->lock);
+    }
+    pthread_mutex_unlock(&estimator->lock);
+
+    return NULL;
+}
+
+Estimator* estimator_create(void) {
+    Estimator *estimator = calloc(1, sizeof(Estimator));
+    if (!estimator) return NULL;
+
+    pthread_mutex_init(&estimator->lock, NULL);
+    pthread_cond_init(&estimator->wake, NULL);
+    atomic_init(&estimator->cancel, false);
+
+    if (pthread_create(&estimator->thread, NULL, estimator_main, estimator) != 0) {
+        estimator_destroy(estimator);
+        return NULL;
+    }
+    estimator->thread_started = true;
+
+    return estimator;
+}
+
+void estimator_destroy(Estimator *estimator) {
+    if (!estimator) return;
+
+    if (estimator->thread_started) {
+        pthread_mutex_lock(&estimator->lock);
+        estimator->stopping = true;
+        atomic_store(&estimator->cancel, true);
+        pthread_cond_signal(&estimator->wake);
+        pthread_mutex_unlock(&estimator->lock);
+        pthread_join(estimator->thread, NULL);
+    }
+
+    for (int i = 0; i < estimator->samples; i++) {
+        free(estimator->sample_paths[i]);
+    }
+    pthread_mutex_destroy(&estimator->lock);
+    pthread_cond_destroy(&estimator->wake);
+    free(estimator);
+}
+
+/* Called with the lock held: drop the current result and start over */
+static void restart(Estimator *estimator) {
+    estimator->generation++;
+    estimator->has_estimate = false;
+    estimator->pending = true;
+    atomic_store(&estimator->cancel, true);
+    pthread_cond_signal(&estimator->wake);
+}
+
+void estimator_set_files(Estimator *estimator, const char *const *paths,
+                         const size_t *sizes, int count) {
+    if (!estimator) return;
+
+    pthread_mutex_lock(&estimator->lock);
+
+    for (int i = 0; i < estimator->samples; i++) {
+        free(estimator->sample_paths[i]);
+    }
+    estimator->samples = 0;
+    estimator->total_bytes = 0;
+    estimator->total_squares = 0;
+
+    for (int i = 0; i < count; i++) {
+        double size = (double)sizes[i];
+        estimator->total_bytes += size;
+        estimator->total_squares += size * size;
+    }
+
+    /* Evenly spaced samples, so a sorted or grouped list is still covered */
+    int samples = count < ESTIMATOR_MAX_SAMPLES ? count : ESTIMATOR_MAX_SAMPLES;
+    for (int i = 0; i < samples; i++) {
+        int index = (int)(((long long)i * 2 + 1) * count / (samples * 2));
+        char *path = strdup(paths[index]);
+        if (!path) break;
+        estimator->sample_paths[estimator->samples] = path;
+        estimator->sample_sizes[estimator->samples] = sizes[index];
+        estimator->samples++;
+    }
+
+    restart(estimator);
+    pthread_mutex_unlock(&estimator->lock);
+}
+
+void estimator_set_params(Estimator *estimator, const ConversionParams *params) {
+    if (!estimator || !params) return;
+
+    pthread_mutex_lock(&estimator->lock);
+    estimator->params = *params;
+    estimator->has_params = true;
+    restart(estimator);
+    pthread_mutex_unlock(&estimator->lock);
+}
+
+bool estimator_get(Estimator *estimator, BatchEstimate *estimate) {
+    if (!estimator || !estimate) return false;
+
+    pthread_mutex_lock(&estimator->lock);
+    bool has_estimate = estimator->has_estimate;
+    if (has_estimate) *estimate = estimator->estimate;
+    pthread_mutex_unlock(&estimator->lock);
+
+    return has_estimate;
+}
@@ -0,0 +1,43 @@
+/*
+ * WebP Converter - Background batch size estimator
+ * Trial-encodes a sample of the batch on its own thread and extrapolates
+ * to the whole batch with a confidence interval. Any change of files or
+ * params cancels the run in progress and starts over.
+ */
+
+#ifndef ESTIMATOR_H
+#define ESTIMATOR_H
+
+#include "converter.h"
+
+/* Files trial-encoded at most per run; the rest are extrapolated */
+#define ESTIMATOR_MAX_SAMPLES 32
+
+/* Estimated output of a whole batch */
+typedef struct {
+    size_t bytes;           /* Point estimate */
+    size_t low, high;       /* ~95% confidence interval */
+    int sampled;            /* Files trial-encoded so far */
+    int samples;            /* Files the run will trial-encode */
+    bool done;              /* Every sample is in */
+} BatchEstimate;
+
+typedef struct Estimator Estimator;
+
+/* Create an idle estimator and its thread */
+Estimator* estimator_create(void);
+
+/* Cancel any run and join the thread */
+void estimator_destroy(Estimator *estimator);
+
+/* Replace the batch (paths and input sizes are copied) and restart */
+void estimator_set_files(Estimator *estimator, const char *const *paths,
+                         const size_t *sizes, int count);
+
+/* Replace the params and restart */
+void estimator_set_params(Estimator *estimator, const ConversionParams *params);
+
+/* Latest estimate for the current files and params; false until the first sample */
+bool estimator_get(Estimator *estimator, BatchEstimate *estimate);
+
+#endif /* ESTIMATOR_H */
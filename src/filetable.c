@@ -0,0 +1,209 @@
+/*
+ * WebP Converter - File table implementation
+ */
+
+#include "filetable.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Arena block size; longer strings get a block of their own */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/* Entries the columns start with */
+#define TABLE_INITIAL_CAPACITY 256
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+static void arena_free(StringArena *arena) {
+    ArenaBlock *block = arena->blocks;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+    arena->bytes = 0;
+}
+
+/* Copy of s that stays put until the arena is freed */
+static const char* arena_strdup(StringArena *arena, const char *s) {
+    size_t len = strlen(s) + 1;
+    ArenaBlock *block = arena->blocks;
+
+    if (!block || block->size - block->used < len) {
+        size_t size = (len > ARENA_BLOCK_SIZE) ? len : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + size);
+        if (!block) return NULL;
+        block->used = 0;
+        block->size = size;
+        /* The current block keeps taking short strings unless this one is oversized */
+        if (size > ARENA_BLOCK_SIZE && arena->blocks) {
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        } else {
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
+    }
+
+    char *copy = block->data + block->used;
+    memcpy(copy, s, len);
+    block->used += len;
+    arena->bytes += len;
+    return copy;
+}
+
+static uint32_t hash_path(const char *path) {
+    return util_hash_fnv1a(path, strlen(path));
+}
+
+/* Slot holding path, or the free slot where it would go */
+static size_t find_slot(const FileTable *table, const char *path, uint32_t hash) {
+    size_t mask = table->slot_count - 1;
+    size_t slot = hash & mask;
+    while (table->slots[slot]) {
+        int index = table->slots[slot] - 1;
+        if (table->hashes[index] == hash && strcmp(table->input_paths[index], path) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Rebuild the hash set with slot_count slots */
+static bool rehash(FileTable *table, size_t slot_count) {
+    int32_t *slots = calloc(slot_count, sizeof(int32_t));
+    if (!slots) return false;
+
+    size_t mask = slot_count - 1;
+    for (int i = 0; i < table->count; i++) {
+        size_t slot = table->hashes[i] & mask;
+        while (slots[slot]) slot = (slot + 1) & mask;
+        slots[slot] = i + 1;
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->slot_count = slot_count;
+    return true;
+}
+
+#define GROW_COLUMN(column, capacity) do { \
+    void *grown = realloc((void *)table->column, sizeof(*table->column) * (capacity)); \
+    if (!grown) return false; \
+    table->column = grown; \
+} while (0)
+
+static bool grow(FileTable *table) {
+    int capacity = table->capacity ? table->capacity * 2 : TABLE_INITIAL_CAPACITY;
+
+    GROW_COLUMN(input_paths, capacity);
+    GROW_COLUMN(output_paths, capacity);
+    GROW_COLUMN(names, capacity);
+    GROW_COLUMN(relative_paths, capacity);
+    GROW_COLUMN(file_sizes, capacity);
+    GROW_COLUMN(widths, capacity);
+    GROW_COLUMN(heights, capacity);
+    GROW_COLUMN(channels, capacity);
+    GROW_COLUMN(output_sizes, capacity);
+    GROW_COLUMN(status, capacity);
+    GROW_COLUMN(hashes, capacity);
+
+    table->capacity = capacity;
+    return true;
+}
+
+#undef GROW_COLUMN
+
+void filetable_init(FileTable *table) {
+    memset(table, 0, sizeof(FileTable));
+}
+
+void filetable_free(FileTable *table) {
+    free((void *)table->input_paths);
+    free((void *)table->output_paths);
+    free((void *)table->names);
+    free((void *)table->relative_paths);
+    free(table->file_sizes);
+    free(table->widths);
+    free(table->heights);
+    free(table->channels);
+    free(table->output_sizes);
+    free(table->status);
+    free(table->hashes);
+    free(table->slots);
+    arena_free(&table->paths);
+    arena_free(&table->outputs);
+    memset(table, 0, sizeof(FileTable));
+}
+
+void filetable_clear(FileTable *table) {
+    table->count = 0;
+    table->total_size = 0;
+    if (table->slots) memset(table->slots, 0, sizeof(int32_t) * table->slot_count);
+    arena_free(&table->paths);
+    arena_free(&table->outputs);
+}
+
+int filetable_find(const FileTable *table, const char *path) {
+    if (table->count == 0) return -1;
+    size_t slot = find_slot(table, path, hash_path(path));
+    return table->slots[slot] - 1;
+}
+
+int filetable_add(FileTable *table, const char *path, const char *relative) {
+    uint32_t hash = hash_path(path);
+
+    /* Keep the hash set at most half full */
+    if ((size_t)(table->count + 1) * 2 > table->slot_count) {
+        if (!rehash(table, table->slot_count ? table->slot_count * 2 : TABLE_INITIAL_CAPACITY * 2)) {
+            return -1;
+        }
+    }
+
+    size_t slot = find_slot(table, path, hash);
+    if (table->slots[slot]) return -1;
+
+    if (table->count == table->capacity && !grow(table)) return -1;
+
+    const char *copy = arena_strdup(&table->paths, path);
+    if (!copy) return -1;
+
+    int index = table->count++;
+    const char *slash = strrchr(copy, '/');
+    table->input_paths[index] = copy;
+    table->output_paths[index] = NULL;
+    table->names[index] = slash ? slash + 1 : copy;
+    table->relative_paths[index] = relative ? copy + (relative - path) : table->names[index];
+    table->file_sizes[index] = 0;
+    table->widths[index] = 0;
+    table->heights[index] = 0;
+    table->channels[index] = 0;
+    table->output_sizes[index] = 0;
+    table->status[index] = FILE_PENDING;
+    table->hashes[index] = hash;
+    table->slots[slot] = index + 1;
+    return index;
+}
+
+bool filetable_set_output(FileTable *table, int index, const char *path) {
+    if (index < 0 || index >= table->count) return false;
+    const char *copy = arena_strdup(&table->outputs, path);
+    if (!copy) return false;
+    table->output_paths[index] = copy;
+    return true;
+}
+
+void filetable_reset_outputs(FileTable *table) {
+    arena_free(&table->outputs);
+    for (int i = 0; i < table->count; i++) {
+        table->output_paths[i] = NULL;
+    }
+}
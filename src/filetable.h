@@ -0,0 +1,87 @@
+/*
+ * WebP Converter - File table
+ * The list of files queued in the app, stored column by column so that
+ * hundreds of thousands of entries stay compact: paths are interned in
+ * an append-only arena and a hash set keyed on the path rejects
+ * duplicates in constant time.
+ */
+
+#ifndef FILETABLE_H
+#define FILETABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Conversion state of one file */
+typedef enum {
+    FILE_PENDING,
+    FILE_CONVERTED,
+    FILE_FAILED
+} FileStatus;
+
+/* Strings copied into blocks that never move (internal) */
+typedef struct ArenaBlock ArenaBlock;
+typedef struct {
+    ArenaBlock *blocks;
+    size_t bytes;           /* Bytes handed out */
+} StringArena;
+
+/*
+ * One column per field, count entries each. Pointers into the columns
+ * are invalidated by filetable_add(); the strings themselves are not,
+ * until the table is cleared.
+ */
+typedef struct {
+    int count;
+    int capacity;
+
+    const char **input_paths;
+    const char **output_paths;  /* NULL until filetable_set_output() */
+    const char **names;         /* File name part of input_paths[i] */
+    const char **relative_paths;/* Tail of input_paths[i] mirrored under an output folder */
+    size_t *file_sizes;
+    int *widths;                /* From the image header (0 if unreadable) */
+    int *heights;
+    uint8_t *channels;
+    size_t *output_sizes;
+    uint8_t *status;            /* FileStatus */
+    uint32_t *hashes;           /* Hash of input_paths[i] */
+
+    size_t total_size;          /* Sum of file_sizes, kept by the caller */
+
+    /* Duplicate check: open addressing, slot holds index + 1 (0 is free) */
+    int32_t *slots;
+    size_t slot_count;          /* Power of two, at least twice count */
+
+    StringArena paths;
+    StringArena outputs;
+} FileTable;
+
+/* Empty table (a zeroed FileTable is also valid) */
+void filetable_init(FileTable *table);
+
+/* Release every column and string */
+void filetable_free(FileTable *table);
+
+/* Drop every entry, keeping the columns for reuse */
+void filetable_clear(FileTable *table);
+
+/*
+ * Append path with its other fields zeroed. relative is the tail of path
+ * (from a folder that was added) to recreate under an output folder, or
+ * NULL for the file name alone.
+ * Returns the new index, or -1 if path is already listed (or on OOM).
+ */
+int filetable_add(FileTable *table, const char *path, const char *relative);
+
+/* Index of path, or -1 */
+int filetable_find(const FileTable *table, const char *path);
+
+/* Set the output path of entry index; false on OOM */
+bool filetable_set_output(FileTable *table, int index, const char *path);
+
+/* Forget every output path, before they are all set again */
+void filetable_reset_outputs(FileTable *table);
+
+#endif /* FILETABLE_H */
@@ -0,0 +1,449 @@
+/*
+ * WebP Converter - Incremental build manifest implementation
+ *
+ * The manifest is a text file, one output per line:
+ *
+ *   <input hash> <params hash> <output size> <output path>
+ *
+ * with the hashes in hex and the path relative to the manifest's
+ * directory. In memory, entries are indexed twice: by output path (is
+ * this output current?) and by input and params hash (was this exact
+ * encode done somewhere else?).
+ */
+
+#include "manifest.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <webp/encode.h>
+
+/* First line of the file; bump when the format or the encoder's output changes */
+#define MANIFEST_MAGIC "webp-manifest 1"
+
+/* Longest line read back (longer ones are dropped) */
+#define MANIFEST_LINE_MAX 4096
+
+typedef struct {
+    char *path;             /* Relative to the manifest's directory */
+    uint64_t input_hash;
+    uint64_t params_hash;
+    size_t size;
+} ManifestEntry;
+
+struct Manifest {
+    char *file_path;
+    char *dir;              /* Directory of file_path, "" for the current one */
+    size_t dir_len;
+
+    ManifestEntry *entries;
+    int count;
+    int capacity;
+
+    /* Open addressing on entry index + 1 (0 is free), kept at most half full */
+    int32_t *by_path;
+    int32_t *by_key;
+    size_t slot_count;
+    size_t keys_used;       /* Slots of by_key taken, stale ones included */
+};
+
+/* XXH64 */
+#define PRIME64_1 11400714785074694791ULL
+#define PRIME64_2 14029467366897019727ULL
+#define PRIME64_3 1609587929392839161ULL
+#define PRIME64_4 9650029242287828579ULL
+#define PRIME64_5 2870177450012600261ULL
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t value) {
+    acc ^= xxh_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t manifest_hash(const void *data, size_t size) {
+    const unsigned char *p = data;
+    const unsigned char *end = p + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        /* Four independent lanes per 32-byte stripe */
+        uint64_t v1 = PRIME64_1 + PRIME64_2;
+        uint64_t v2 = PRIME64_2;
+        uint64_t v3 = 0;
+        uint64_t v4 = 0 - PRIME64_1;
+        const unsigned char *limit = end - 32;
+        do {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxh_merge(hash, v1);
+        hash = xxh_merge(hash, v2);
+        hash = xxh_merge(hash, v3);
+        hash = xxh_merge(hash, v4);
+    } else {
+        hash = PRIME64_5;
+    }
+
+    hash += (uint64_t)size;
+    for (; p + 8 <= end; p += 8) {
+        hash ^= xxh_round(0, read64(p));
+        hash = rotl64(hash, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        hash ^= (uint64_t)read32(p) * PRIME64_1;
+        hash = rotl64(hash, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= (uint64_t)*p * PRIME64_5;
+        hash = rotl64(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t manifest_params_hash(const ConversionParams *params) {
+    /*
+     * Field by field, so struct padding never enters the hash; the
+     * list matches the one converter_params_equal compares.
+     */
+    double fields[] = {
+        (double)WebPGetEncoderVersion(),
+        params->quality,
+        params->method,
+        params->lossless,
+        params->alpha_quality,
+        params->filter_strength,
+        params->filter_sharpness,
+        params->preprocessing,
+        params->target_mode,
+        (double)params->target_size,
+        params->target_metric,
+        params->auto_content,
+        params->best_of,
+        params->keyframe_interval,
+        params->minimize_size,
+        params->content_hint,
+    };
+    return manifest_hash(fields, sizeof(fields));
+}
+
+/* The part of output_path stored in the manifest */
+static const char* stored_path(const Manifest *manifest, const char *output_path) {
+    if (manifest->dir_len > 0 && strncmp(output_path, manifest->dir, manifest->dir_len) == 0 &&
+        output_path[manifest->dir_len] == '/') {
+        output_path += manifest->dir_len;
+        while (*output_path == '/') output_path++;
+    }
+    return output_path;
+}
+
+/* Path of a stored entry as seen from the current directory */
+static bool full_path(const Manifest *manifest, const char *stored, char *path, size_t size) {
+    int n = (manifest->dir_len > 0 && stored[0] != '/')
+          ? snprintf(path, size, "%s/%s", manifest->dir, stored)
+          : snprintf(path, size, "%s", stored);
+    return n >= 0 && (size_t)n < size;
+}
+
+static size_t key_slot(uint64_t input_hash, uint64_t params_hash, size_t mask) {
+    return (size_t)((input_hash ^ (params_hash * PRIME64_1)) >> 17) & mask;
+}
+
+/* Slot of the entry stored as path, or the free slot where it would go */
+static size_t path_slot(const Manifest *manifest, const char *path) {
+    size_t mask = manifest->slot_count - 1;
+    size_t slot = util_hash_fnv1a(path, strlen(path)) & mask;
+    while (manifest->by_path[slot] &&
+           strcmp(manifest->entries[manifest->by_path[slot] - 1].path, path) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static void index_key(Manifest *manifest, int index) {
+    const ManifestEntry *entry = &manifest->entries[index];
+    size_t mask = manifest->slot_count - 1;
+    size_t slot = key_slot(entry->input_hash, entry->params_hash, mask);
+    while (manifest->by_key[slot]) slot = (slot + 1) & mask;
+    manifest->by_key[slot] = index + 1;
+    manifest->keys_used++;
+}
+
+/* Double the slots and index every entry again */
+static bool reindex(Manifest *manifest) {
+    size_t slot_count = manifest->slot_count ? manifest->slot_count * 2 : 256;
+    int32_t *by_path = calloc(slot_count, sizeof(int32_t));
+    int32_t *by_key = calloc(slot_count, sizeof(int32_t));
+    if (!by_path || !by_key) {
+        free(by_path);
+        free(by_key);
+        return false;
+    }
+
+    free(manifest->by_path);
+    free(manifest->by_key);
+    manifest->by_path = by_path;
+    manifest->by_key = by_key;
+    manifest->slot_count = slot_count;
+    manifest->keys_used = 0;
+
+    for (int i = 0; i < manifest->count; i++) {
+        manifest->by_path[path_slot(manifest, manifest->entries[i].path)] = i + 1;
+        index_key(manifest, i);
+    }
+    return true;
+}
+
+/* Add or update the entry for a stored path */
+static bool put_entry(Manifest *manifest, const char *path, uint64_t input_hash,
+                      uint64_t params_hash, size_t size) {
+    if ((manifest->keys_used + 1) * 2 > manifest->slot_count && !reindex(manifest)) {
+        return false;
+    }
+
+    size_t slot = path_slot(manifest, path);
+    int index;
+    bool new_key = true;
+    if (manifest->by_path[slot]) {
+        index = manifest->by_path[slot] - 1;
+        const ManifestEntry *entry = &manifest->entries[index];
+        new_key = entry->input_hash != input_hash || entry->params_hash != params_hash;
+    } else {
+        if (manifest->count == manifest->capacity) {
+            int capacity = manifest->capacity ? manifest->capacity * 2 : 256;
+            ManifestEntry *entries = realloc(manifest->entries, sizeof(ManifestEntry) * capacity);
+            if (!entries) return false;
+            manifest->entries = entries;
+            manifest->capacity = capacity;
+        }
+        char *copy = strdup(path);
+        if (!copy) return false;
+        index = manifest->count++;
+        manifest->entries[index].path = copy;
+        manifest->by_path[slot] = index + 1;
+    }
+
+    ManifestEntry *entry = &manifest->entries[index];
+    entry->input_hash = input_hash;
+    entry->params_hash = params_hash;
+    entry->size = size;
+
+    /* A replaced key keeps its old slot, which lookups pass over as it no longer matches */
+    if (new_key) index_key(manifest, index);
+    return true;
+}
+
+Manifest* manifest_load(const char *path) {
+    Manifest *manifest = calloc(1, sizeof(Manifest));
+    if (!manifest) return NULL;
+
+    manifest->file_path = strdup(path);
+    manifest->dir = strdup(path);
+    if (!manifest->file_path || !manifest->dir || !reindex(manifest)) {
+        manifest_free(manifest);
+        return NULL;
+    }
+    char *slash = strrchr(manifest->dir, '/');
+    if (slash) {
+        while (slash > manifest->dir && slash[-1] == '/') slash--;
+        *(slash == manifest->dir ? slash + 1 : slash) = '\0';
+    } else {
+        manifest->dir[0] = '\0';
+    }
+    manifest->dir_len = strlen(manifest->dir);
+
+    FILE *file = fopen(path, "r");
+    if (!file) return manifest;
+
+    char *line = malloc(MANIFEST_LINE_MAX);
+    bool valid = line && fgets(line, MANIFEST_LINE_MAX, file) &&
+                 strncmp(line, MANIFEST_MAGIC, strlen(MANIFEST_MAGIC)) == 0;
+
+    /* Another version: start over, every output gets rebuilt once */
+    while (valid && fgets(line, MANIFEST_LINE_MAX, file)) {
+        size_t len = strlen(line);
+        if (len == 0 || line[len - 1] != '\n') {
+            /* Too long: skip the rest of it */
+            int c;
+            while (len > 0 && (c = fgetc(file)) != EOF && c != '\n') {}
+            continue;
+        }
+        line[len - 1] = '\0';
+
+        unsigned long long input_hash, params_hash, size;
+        int offset = 0;
+        if (sscanf(line, "%16llx %16llx %llu %n", &input_hash, &params_hash, &size, &offset) != 3 ||
+            offset == 0 || line[offset] == '\0') {
+            continue;
+        }
+        if (!put_entry(manifest, line + offset, input_hash, params_hash, (size_t)size)) break;
+    }
+
+    free(line);
+    fclose(file);
+    return manifest;
+}
+
+bool manifest_save(const Manifest *manifest) {
+    char temp_path[1100];
+    int n = snprintf(temp_path, sizeof(temp_path), "%s.tmp", manifest->file_path);
+    if (n < 0 || (size_t)n >= sizeof(temp_path)) return false;
+
+    FILE *file = fopen(temp_path, "w");
+    if (!file) return false;
+
+    fprintf(file, "%s\n", MANIFEST_MAGIC);
+    for (int i = 0; i < manifest->count; i++) {
+        const ManifestEntry *entry = &manifest->entries[i];
+        if (strchr(entry->path, '\n')) continue;
+        fprintf(file, "%016llx %016llx %llu %s\n",
+                (unsigned long long)entry->input_hash, (unsigned long long)entry->params_hash,
+                (unsigned long long)entry->size, entry->path);
+    }
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (ok && rename(temp_path, manifest->file_path) != 0) ok = false;
+    if (!ok) remove(temp_path);
+    return ok;
+}
+
+void manifest_free(Manifest *manifest) {
+    if (!manifest) return;
+    for (int i = 0; i < manifest->count; i++) {
+        free(manifest->entries[i].path);
+    }
+    free(manifest->entries);
+    free(manifest->by_path);
+    free(manifest->by_key);
+    free(manifest->file_path);
+    free(manifest->dir);
+    free(manifest);
+}
+
+/* True if the output of entry is on disk with the size recorded */
+static bool entry_intact(const Manifest *manifest, const ManifestEntry *entry,
+                         char *path, size_t size) {
+    struct stat st;
+    return full_path(manifest, entry->path, path, size) &&
+           stat(path, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size == entry->size;
+}
+
+bool manifest_is_current(const Manifest *manifest, const char *output_path,
+                         uint64_t input_hash, uint64_t params_hash, size_t *output_size) {
+    size_t slot = path_slot(manifest, stored_path(manifest, output_path));
+    if (!manifest->by_path[slot]) return false;
+
+    const ManifestEntry *entry = &manifest->entries[manifest->by_path[slot] - 1];
+    char path[2048];
+    if (entry->input_hash != input_hash || entry->params_hash != params_hash ||
+        !entry_intact(manifest, entry, path, sizeof(path))) {
+        return false;
+    }
+    *output_size = entry->size;
+    return true;
+}
+
+bool manifest_find_copy(const Manifest *manifest, const char *output_path,
+                        uint64_t input_hash, uint64_t params_hash,
+                        char *source, size_t size, size_t *output_size) {
+    const char *own = stored_path(manifest, output_path);
+    size_t mask = manifest->slot_count - 1;
+
+    for (size_t slot = key_slot(input_hash, params_hash, mask); manifest->by_key[slot];
+         slot = (slot + 1) & mask) {
+        const ManifestEntry *entry = &manifest->entries[manifest->by_key[slot] - 1];
+        if (entry->input_hash != input_hash || entry->params_hash != params_hash ||
+            strcmp(entry->path, own) == 0) {
+            continue;
+        }
+        if (entry_intact(manifest, entry, source, size)) {
+            *output_size = entry->size;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool manifest_record(Manifest *manifest, const char *output_path,
+                     uint64_t input_hash, uint64_t params_hash, size_t output_size) {
+    return put_entry(manifest, stored_path(manifest, output_path),
+                     input_hash, params_hash, output_size);
+}
+
+bool manifest_default_path(const char *output_dir, const char *const *output_paths, int count,
+                           char *path, size_t size) {
+    int n;
+    if (output_dir && output_dir[0]) {
+        n = snprintf(path, size, "%s/%s", output_dir, MANIFEST_FILE_NAME);
+        return n >= 0 && (size_t)n < size;
+    }
+    if (count <= 0) return false;
+
+    /* Longest directory prefix (ending at a '/') shared by every output */
+    const char *first = output_paths[0];
+    const char *slash = strrchr(first, '/');
+    size_t prefix = slash ? (size_t)(slash - first) : 0;
+
+    for (int i = 1; i < count && prefix > 0; i++) {
+        const char *other = output_paths[i];
+        size_t same = 0;
+        while (same < prefix && other[same] == first[same]) same++;
+        if (same == prefix && other[same] == '/') continue;
+
+        /*
+         * The directories differ at or before same (out/a vs out/ab), even
+         * when first has a '/' there: back to the separator before it
+         */
+        if (same > 0) same--;
+        while (same > 0 && first[same] != '/') same--;
+        prefix = same;
+    }
+
+    /* Stored paths are relative to it: refuse a directory some output is not under */
+    for (int i = 0; i < count && prefix > 0; i++) {
+        if (strncmp(output_paths[i], first, prefix) != 0 || output_paths[i][prefix] != '/') {
+            return false;
+        }
+    }
+
+    if (prefix == 0) {
+        n = snprintf(path, size, "%s%s", first[0] == '/' ? "/" : "", MANIFEST_FILE_NAME);
+    } else {
+        n = snprintf(path, size, "%.*s/%s", (int)prefix, first, MANIFEST_FILE_NAME);
+    }
+    return n >= 0 && (size_t)n < size;
+}
@@ -0,0 +1,69 @@
+/*
+ * WebP Converter - Incremental build manifest
+ * Remembers, for every output written, the hash of the input it came
+ * from and of the params it was encoded with, so a later batch can skip
+ * the files whose output is still up to date and copy outputs that an
+ * identical input already produced.
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "converter.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* File name of the manifest, in the output folder */
+#define MANIFEST_FILE_NAME ".webp-manifest"
+
+typedef struct Manifest Manifest;
+
+/*
+ * Load the manifest at path. A missing or unreadable file gives an empty
+ * manifest that will be written there. Returns NULL on OOM.
+ */
+Manifest* manifest_load(const char *path);
+
+/* Write the manifest back (through a temp file and rename) */
+bool manifest_save(const Manifest *manifest);
+
+void manifest_free(Manifest *manifest);
+
+/*
+ * True if output_path was built from input_hash with params_hash and is
+ * still there with the size recorded (returned in output_size).
+ * Safe to call from several threads while no entry is being recorded.
+ */
+bool manifest_is_current(const Manifest *manifest, const char *output_path,
+                         uint64_t input_hash, uint64_t params_hash, size_t *output_size);
+
+/*
+ * Some other output built from the same input and params that is still
+ * intact: its path goes to source (of size bytes), its size to
+ * output_size. Same threading rules as manifest_is_current().
+ */
+bool manifest_find_copy(const Manifest *manifest, const char *output_path,
+                        uint64_t input_hash, uint64_t params_hash,
+                        char *source, size_t size, size_t *output_size);
+
+/* Record (or replace) the entry for output_path */
+bool manifest_record(Manifest *manifest, const char *output_path,
+                     uint64_t input_hash, uint64_t params_hash, size_t output_size);
+
+/* 64-bit content hash (XXH64, seed 0) */
+uint64_t manifest_hash(const void *data, size_t size);
+
+/* Hash of everything in params that changes the output bytes, and of the libwebp version */
+uint64_t manifest_params_hash(const ConversionParams *params);
+
+/*
+ * Default manifest location for a set of outputs: in output_dir when
+ * given, else in the deepest directory that holds all of them. False if
+ * the path does not fit in size, or (a safeguard) some output is not
+ * under that directory.
+ */
+bool manifest_default_path(const char *output_dir, const char *const *output_paths, int count,
+                           char *path, size_t size);
+
+#endif /* MANIFEST_H */
@@ -0,0 +1,183 @@
+/*
+ * WebP Converter - Image quality metrics implementation
+ */
+
+#include "metrics.h"
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+/* Horizontal adds (vaddvq, vaddlvq) only exist on AArch64; ARMv7 uses the scalar sums */
+#include <arm_neon.h>
+#endif
+
+/* SSIM window and stabilising constants for 8-bit samples */
+#define SSIM_BLOCK 8
+#define SSIM_C1 (0.01 * 255 * 0.01 * 255)
+#define SSIM_C2 (0.03 * 255 * 0.03 * 255)
+
+/* Sums over one window of both planes */
+typedef struct {
+    uint32_t a, b;
+    uint32_t aa, bb, ab;
+    uint32_t count;
+} BlockStats;
+
+void metrics_luma(const uint8_t *pixels, int channels, int width, int height, uint8_t *luma) {
+    size_t count = (size_t)width * height;
+
+    /* Forward in-place is safe: pixel i is read before luma[i] is written */
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *p = pixels + i * channels;
+        uint32_t y = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+        if (channels == 4) {
+            y = (y * p[3] + 127) / 255;
+        }
+        luma[i] = (uint8_t)y;
+    }
+}
+
+/* Window of any size, for the right and bottom edges */
+static void block_stats_scalar(const uint8_t *a, const uint8_t *b, int stride,
+                               int w, int h, BlockStats *s) {
+    *s = (BlockStats){ .count = (uint32_t)(w * h) };
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            uint32_t va = a[y * stride + x], vb = b[y * stride + x];
+            s->a += va;
+            s->b += vb;
+            s->aa += va * va;
+            s->bb += vb * vb;
+            s->ab += va * vb;
+        }
+    }
+}
+
+/* Full 8x8 window */
+static void block_stats_8x8(const uint8_t *a, const uint8_t *b, int stride, BlockStats *s) {
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sa = zero, sb = zero, saa = zero, sbb = zero, sab = zero;
+
+    for (int y = 0; y < SSIM_BLOCK; y++) {
+        __m128i va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(a + y * stride)), zero);
+        __m128i vb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(b + y * stride)), zero);
+        sa = _mm_add_epi16(sa, va);
+        sb = _mm_add_epi16(sb, vb);
+        saa = _mm_add_epi32(saa, _mm_madd_epi16(va, va));
+        sbb = _mm_add_epi32(sbb, _mm_madd_epi16(vb, vb));
+        sab = _mm_add_epi32(sab, _mm_madd_epi16(va, vb));
+    }
+
+    /* Widen the 16-bit sums, then reduce all five vectors */
+    sa = _mm_madd_epi16(sa, _mm_set1_epi16(1));
+    sb = _mm_madd_epi16(sb, _mm_set1_epi16(1));
+    uint32_t lanes[5][4];
+    _mm_storeu_si128((__m128i *)lanes[0], sa);
+    _mm_storeu_si128((__m128i *)lanes[1], sb);
+    _mm_storeu_si128((__m128i *)lanes[2], saa);
+    _mm_storeu_si128((__m128i *)lanes[3], sbb);
+    _mm_storeu_si128((__m128i *)lanes[4], sab);
+    uint32_t sums[5];
+    for (int i = 0; i < 5; i++) {
+        sums[i] = lanes[i][0] + lanes[i][1] + lanes[i][2] + lanes[i][3];
+    }
+    *s = (BlockStats){ sums[0], sums[1], sums[2], sums[3], sums[4], SSIM_BLOCK * SSIM_BLOCK };
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint16x8_t sa = vdupq_n_u16(0), sb = vdupq_n_u16(0);
+    uint32x4_t saa = vdupq_n_u32(0), sbb = vdupq_n_u32(0), sab = vdupq_n_u32(0);
+
+    for (int y = 0; y < SSIM_BLOCK; y++) {
+        uint8x8_t va = vld1_u8(a + y * stride);
+        uint8x8_t vb = vld1_u8(b + y * stride);
+        sa = vaddw_u8(sa, va);
+        sb = vaddw_u8(sb, vb);
+        saa = vpadalq_u16(saa, vmull_u8(va, va));
+        sbb = vpadalq_u16(sbb, vmull_u8(vb, vb));
+        sab = vpadalq_u16(sab, vmull_u8(va, vb));
+    }
+    *s = (BlockStats){ vaddvq_u16(sa), vaddvq_u16(sb), vaddvq_u32(saa), vaddvq_u32(sbb),
+                       vaddvq_u32(sab), SSIM_BLOCK * SSIM_BLOCK };
+#else
+    block_stats_scalar(a, b, stride, SSIM_BLOCK, SSIM_BLOCK, s);
+#endif
+}
+
+static double block_ssim(const BlockStats *s) {
+    double n = s->count;
+    double mu_a = s->a / n, mu_b = s->b / n;
+    double var_a = s->aa / n - mu_a * mu_a;
+    double var_b = s->bb / n - mu_b * mu_b;
+    double cov = s->ab / n - mu_a * mu_b;
+
+    return ((2 * mu_a * mu_b + SSIM_C1) * (2 * cov + SSIM_C2)) /
+           ((mu_a * mu_a + mu_b * mu_b + SSIM_C1) * (var_a + var_b + SSIM_C2));
+}
+
+double metrics_ssim(const uint8_t *a, const uint8_t *b, int width, int height) {
+    if (width <= 0 || height <= 0) return 1.0;
+
+    double total = 0.0;
+    for (int y = 0; y < height; y += SSIM_BLOCK) {
+        int h = (height - y < SSIM_BLOCK) ? height - y : SSIM_BLOCK;
+        for (int x = 0; x < width; x += SSIM_BLOCK) {
+            int w = (width - x < SSIM_BLOCK) ? width - x : SSIM_BLOCK;
+            size_t offset = (size_t)y * width + x;
+            BlockStats s;
+            if (w == SSIM_BLOCK && h == SSIM_BLOCK) {
+                block_stats_8x8(a + offset, b + offset, width, &s);
+            } else {
+                block_stats_scalar(a + offset, b + offset, width, w, h, &s);
+            }
+            /* Edge windows count in proportion to their pixels */
+            total += block_ssim(&s) * s.count;
+        }
+    }
+    return total / ((double)width * height);
+}
+
+double metrics_psnr(const uint8_t *a, const uint8_t *b, size_t count) {
+    uint64_t sse = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    /* 32-bit lanes gain at most 4 * 255^2 per step: flush every 4096 steps */
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= count) {
+        __m128i acc = zero;
+        for (int step = 0; step < 4096 && i + 16 <= count; step++, i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sse += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    while (i + 16 <= count) {
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (int step = 0; step < 4096 && i + 16 <= count; step++, i += 16) {
+            uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(diff), vget_low_u8(diff)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(diff), vget_high_u8(diff)));
+        }
+        sse += vaddlvq_u32(acc);
+    }
+#endif
+
+    for (; i < count; i++) {
+        int d = (int)a[i] - (int)b[i];
+        sse += (uint64_t)(d * d);
+    }
+
+    if (sse == 0 || count == 0) return METRICS_PSNR_MAX;
+
+    double mse = (double)sse / (double)count;
+    double psnr = 10.0 * log10(255.0 * 255.0 / mse);
+    return psnr < METRICS_PSNR_MAX ? psnr : METRICS_PSNR_MAX;
+}
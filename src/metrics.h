@@ -0,0 +1,28 @@
+/*
+ * WebP Converter - Image quality metrics
+ * SSIM and PSNR between a source image and its decoded WebP
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* PSNR reported for identical planes */
+#define METRICS_PSNR_MAX 99.0
+
+/*
+ * BT.601 luma of an RGB (channels 3) or RGBA (channels 4) image,
+ * premultiplied by alpha so pixels that are fully transparent compare
+ * equal whatever colour they carry. luma may alias pixels.
+ */
+void metrics_luma(const uint8_t *pixels, int channels, int width, int height, uint8_t *luma);
+
+/* Mean SSIM of two luma planes over 8x8 blocks (0-1, 1 = identical) */
+double metrics_ssim(const uint8_t *a, const uint8_t *b, int width, int height);
+
+/* PSNR in dB of two planes of count bytes (METRICS_PSNR_MAX if identical) */
+double metrics_psnr(const uint8_t *a, const uint8_t *b, size_t count);
+
+#endif /* METRICS_H */
@@ -0,0 +1,250 @@
+/*
+ * WebP Converter - Worker thread pool implementation
+ */
+
+#include "pool.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+typedef struct {
+    PoolTaskFn fn;
+    void *arg;
+} PoolTask;
+
+typedef struct {
+    ThreadPool *pool;
+    int index;
+} PoolWorker;
+
+struct ThreadPool {
+    pthread_t *threads;
+    PoolWorker *workers;
+    int thread_count;
+
+    /* Circular task queue, grown by doubling */
+    PoolTask *tasks;
+    int capacity;
+    int head;
+    int count;
+
+    int active;             /* Tasks currently running */
+    bool stopping;
+
+    pthread_mutex_t lock;
+    pthread_cond_t has_work;
+    pthread_cond_t idle;
+};
+
+int pool_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static void* worker_main(void *arg) {
+    PoolWorker *worker = arg;
+    ThreadPool *pool = worker->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->count == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->has_work, &pool->lock);
+        }
+        if (pool->count == 0 && pool->stopping) break;
+
+        PoolTask task = pool->tasks[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count--;
+        pool->active++;
+        pthread_mutex_unlock(&pool->lock);
+
+        task.fn(task.arg, worker->index);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->active--;
+        if (pool->count == 0 && pool->active == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+ThreadPool* pool_create(int thread_count) {
+    if (thread_count <= 0) thread_count = pool_cpu_count();
+
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool) return NULL;
+
+    pool->capacity = 64;
+    pool->tasks = malloc(sizeof(PoolTask) * pool->capacity);
+    pool->threads = calloc(thread_count, sizeof(pthread_t));
+    pool->workers = calloc(thread_count, sizeof(PoolWorker));
+    if (!pool->tasks || !pool->threads || !pool->workers) {
+        free(pool->tasks);
+        free(pool->threads);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->has_work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (int i = 0; i < thread_count; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->workers[i]) != 0) {
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count == 0) {
+        pool_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void pool_destroy(ThreadPool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->has_work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->has_work);
+    pthread_cond_destroy(&pool->idle);
+
+    free(pool->tasks);
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
+
+bool pool_submit(ThreadPool *pool, PoolTaskFn fn, void *arg) {
+    if (!pool || !fn) return false;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->count == pool->capacity) {
+        /* Grow and unwrap the ring so head is back at 0 */
+        int new_capacity = pool->capacity * 2;
+        PoolTask *tasks = malloc(sizeof(PoolTask) * new_capacity);
+        if (!tasks) {
+            pthread_mutex_unlock(&pool->lock);
+            return false;
+        }
+        for (int i = 0; i < pool->count; i++) {
+            tasks[i] = pool->tasks[(pool->head + i) % pool->capacity];
+        }
+        free(pool->tasks);
+        pool->tasks = tasks;
+        pool->capacity = new_capacity;
+        pool->head = 0;
+    }
+
+    int tail = (pool->head + pool->count) % pool->capacity;
+    pool->tasks[tail].fn = fn;
+    pool->tasks[tail].arg = arg;
+    pool->count++;
+
+    pthread_cond_signal(&pool->has_work);
+    pthread_mutex_unlock(&pool->lock);
+
+    return true;
+}
+
+void pool_wait(ThreadPool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count > 0 || pool->active > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Shared state of one pool_parallel_for() call */
+typedef struct {
+    PoolForFn fn;
+    void *arg;
+    int count;
+    atomic_int next;        /* Next index to hand out */
+    int helpers_running;    /* Pool tasks that have not returned yet */
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+} ParallelFor;
+
+static void parallel_for_run(ParallelFor *pf, int worker) {
+    int index;
+    while ((index = atomic_fetch_add_explicit(&pf->next, 1, memory_order_relaxed)) < pf->count) {
+        pf->fn(pf->arg, index, worker);
+    }
+}
+
+static void parallel_for_task(void *arg, int worker) {
+    ParallelFor *pf = arg;
+    parallel_for_run(pf, worker);
+
+    pthread_mutex_lock(&pf->lock);
+    if (--pf->helpers_running == 0) {
+        pthread_cond_signal(&pf->done);
+    }
+    pthread_mutex_unlock(&pf->lock);
+}
+
+void pool_parallel_for(ThreadPool *pool, int count, PoolForFn fn, void *arg) {
+    if (count <= 0 || !fn) return;
+
+    int threads = pool_thread_count(pool);
+    if (count == 1 || threads == 0) {
+        for (int i = 0; i < count; i++) fn(arg, i, threads);
+        return;
+    }
+
+    ParallelFor pf = { .fn = fn, .arg = arg, .count = count };
+    atomic_init(&pf.next, 0);
+    pthread_mutex_init(&pf.lock, NULL);
+    pthread_cond_init(&pf.done, NULL);
+
+    /* The caller works too, so count - 1 helpers are enough */
+    int helpers = (count - 1 < threads) ? count - 1 : threads;
+    for (int i = 0; i < helpers; i++) {
+        pthread_mutex_lock(&pf.lock);
+        pf.helpers_running++;
+        pthread_mutex_unlock(&pf.lock);
+        if (!pool_submit(pool, parallel_for_task, &pf)) {
+            pthread_mutex_lock(&pf.lock);
+            pf.helpers_running--;
+            pthread_mutex_unlock(&pf.lock);
+            break;
+        }
+    }
+
+    parallel_for_run(&pf, threads);
+
+    pthread_mutex_lock(&pf.lock);
+    while (pf.helpers_running > 0) {
+        pthread_cond_wait(&pf.done, &pf.lock);
+    }
+    pthread_mutex_unlock(&pf.lock);
+
+    pthread_mutex_destroy(&pf.lock);
+    pthread_cond_destroy(&pf.done);
+}
+
+int pool_thread_count(const ThreadPool *pool) {
+    return pool ? pool->thread_count : 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * WebP Converter - Worker thread pool
+ * Fixed set of threads draining a FIFO task queue
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+
+/* Task callback; worker is the index (0..threads-1) of the running thread */
+typedef void (*PoolTaskFn)(void *arg, int worker);
+
+/* Loop body for pool_parallel_for(); worker is 0..threads (threads = caller) */
+typedef void (*PoolForFn)(void *arg, int index, int worker);
+
+typedef struct ThreadPool ThreadPool;
+
+/* Number of online CPU cores (at least 1) */
+int pool_cpu_count(void);
+
+/* Create a pool; thread_count <= 0 uses every core */
+ThreadPool* pool_create(int thread_count);
+
+/* Wait for queued tasks, stop and join all threads */
+void pool_destroy(ThreadPool *pool);
+
+/* Queue a task (the queue grows as needed) */
+bool pool_submit(ThreadPool *pool, PoolTaskFn fn, void *arg);
+
+/* Block until every submitted task has finished */
+void pool_wait(ThreadPool *pool);
+
+/*
+ * Run fn for every index in [0, count) on the pool and the calling thread,
+ * returning when all iterations are done. Must not be called from a task
+ * running on the same pool.
+ */
+void pool_parallel_for(ThreadPool *pool, int count, PoolForFn fn, void *arg);
+
+/* Number of worker threads */
+int pool_thread_count(const ThreadPool *pool);
+
+#endif /* POOL_H */
@@ -4,6 +4,7 @@
 
 #include "presets.h"
 #include <string.h>
+#include <ctype.h>
 
 static const Preset all_presets[PRESET_COUNT] = {
     /* Quality-based presets */
@@ -106,6 +107,21 @@ static const Preset all_presets[PRESET_COUNT] = {
             .filter_sharpness = 0,
             .preprocessing = 0
         }
+    },
+    {
+        .type = PRESET_AUTO,
+        .name = "Auto",
+        .description = "Lossless for graphics, lossy for photos",
+        .params = {
+            .quality = 80.0f,
+            .method = 4,
+            .lossless = false,
+            .alpha_quality = 90.0f,
+            .filter_strength = 60,
+            .filter_sharpness = 0,
+            .preprocessing = 0,
+            .auto_content = true
+        }
     }
 };
 
@@ -131,3 +147,21 @@ const char* presets_get_name(PresetType type) {
     const Preset *preset = presets_get(type);
     return preset->name;
 }
+
+bool presets_find(const char *name, PresetType *type) {
+    if (!name || !type) return false;
+
+    for (int i = 0; i < PRESET_COUNT; i++) {
+        const char *a = all_presets[i].name;
+        const char *b = name;
+        while (*a && *b && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+            a++;
+            b++;
+        }
+        if (*a == '\0' && *b == '\0') {
+            *type = all_presets[i].type;
+            return true;
+        }
+    }
+    return false;
+}
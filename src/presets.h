@@ -19,6 +19,7 @@ typedef enum {
     PRESET_WEB,
     PRESET_PHOTO,
     PRESET_THUMBNAIL,
+    PRESET_AUTO,            /* Lossless or lossy per image, from its content */
 
     PRESET_COUNT
 } PresetType;
@@ -43,4 +44,7 @@ void presets_apply(PresetType type, ConversionParams *params);
 /* Get preset name */
 const char* presets_get_name(PresetType type);
 
+/* Find a preset by name (case-insensitive), returns false if unknown */
+bool presets_find(const char *name, PresetType *type);
+
 #endif /* PRESETS_H */
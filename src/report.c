@@ -0,0 +1,179 @@
+/*
+ * WebP Converter - Batch report implementation
+ */
+
+#include "report.h"
+#include "content.h"
+#include "util.h"
+#include <stdio.h>
+#include <math.h>
+
+static const char* target_mode_name(TargetMode mode) {
+    switch (mode) {
+        case TARGET_SIZE: return "size";
+        case TARGET_SSIM: return "ssim";
+        case TARGET_PSNR: return "psnr";
+        default:          return "quality";
+    }
+}
+
+/* JSON has no infinities or NaN */
+static double json_number(double value) {
+    return isfinite(value) ? value : 0.0;
+}
+
+static void write_timings(FILE *out, const StageTimings *t) {
+    fprintf(out, "{\"read\": %.3f, \"decode\": %.3f, \"analyze\": %.3f, \"import\": %.3f, "
+                 "\"encode\": %.3f, \"write\": %.3f}",
+            t->read_ms, t->decode_ms, t->analyze_ms, t->import_ms, t->encode_ms, t->write_ms);
+}
+
+static void write_int_array(FILE *out, const int *values, int count) {
+    fputc('[', out);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%s%d", i ? ", " : "", values[i]);
+    }
+    fputc(']', out);
+}
+
+static void write_stats(FILE *out, const EncoderStats *s) {
+    fprintf(out, "{\"psnr\": {\"y\": %.2f, \"u\": %.2f, \"v\": %.2f, \"all\": %.2f, \"alpha\": %.2f}",
+            json_number(s->psnr[0]), json_number(s->psnr[1]), json_number(s->psnr[2]),
+            json_number(s->psnr[3]), json_number(s->psnr[4]));
+    fprintf(out, ", \"header_bytes\": ");
+    write_int_array(out, s->header_bytes, 2);
+    fprintf(out, ", \"segment_bytes\": ");
+    write_int_array(out, s->segment_bytes, 4);
+    fprintf(out, ", \"segment_quant\": ");
+    write_int_array(out, s->segment_quant, 4);
+    fprintf(out, ", \"blocks\": {\"intra4\": %d, \"intra16\": %d, \"skipped\": %d}",
+            s->block_count[0], s->block_count[1], s->block_count[2]);
+    fprintf(out, ", \"alpha_bytes\": %d, \"lossless_bytes\": %d}",
+            s->alpha_bytes, s->lossless_bytes);
+}
+
+static void write_job(FILE *out, const BatchJob *job) {
+    const ConversionResult *r = &job->result;
+
+    fprintf(out, "    {\"input\": ");
+    util_write_json_string(out, job->input_path);
+    fprintf(out, ", \"output\": ");
+    util_write_json_string(out, job->output_path);
+    fprintf(out, ", \"success\": %s", r->success ? "true" : "false");
+    if (job->reuse == BATCH_SKIPPED) {
+        fprintf(out, ", \"reuse\": \"up_to_date\"");
+    } else if (job->reuse != BATCH_REBUILT) {
+        /* Nothing was encoded for this file */
+        fprintf(out, ", \"reuse\": \"%s\", \"via\": \"%s\"",
+                job->reuse == BATCH_REUSED ? "copied" : "duplicate",
+                converter_copy_method_name(job->copy_method));
+    }
+    if (r->cancelled) {
+        fprintf(out, ", \"cancelled\": true");
+    } else if (!r->success) {
+        fprintf(out, ", \"error\": ");
+        util_write_json_string(out, r->error_message);
+    }
+    fprintf(out, ",\n     \"input_bytes\": %zu, \"output_bytes\": %zu, \"quality\": %.1f",
+            job->input_size, r->output_size, r->quality);
+    if (r->metric > 0) {
+        fprintf(out, ", \"metric\": %.4f", json_number(r->metric));
+    }
+    fprintf(out, ", \"predicted_bytes\": %zu, \"peak_bytes\": %zu, \"threads\": %d",
+            job->predicted_bytes, r->peak_bytes, r->threads);
+    if (r->frames > 0) {
+        fprintf(out, ", \"frames\": %d", r->frames);
+    }
+    if (job->effort.method >= 0) {
+        fprintf(out, ", \"method\": %d", job->effort.method);
+    }
+    if (job->effort.deadline) {
+        fprintf(out, ", \"deadline\": {\"seconds_left\": %.3f, \"predicted_seconds\": %.3f}",
+                job->effort.seconds_left, job->effort.predicted_seconds);
+    }
+    if (r->runner_up_size > 0) {
+        fprintf(out, ", \"best_of\": {\"winner\": \"%s\", \"runner_up_bytes\": %zu}",
+                r->lossless ? "lossless" : "lossy", r->runner_up_size);
+    }
+    if (r->content != CONTENT_NONE) {
+        fprintf(out, ", \"content\": \"%s\", \"lossless\": %s",
+                content_class_name(r->content), r->lossless ? "true" : "false");
+    }
+    fprintf(out, ",\n     \"timings_ms\": ");
+    write_timings(out, &r->timings);
+    if (r->success && job->reuse == BATCH_REBUILT) {
+        fprintf(out, ",\n     \"encoder\": ");
+        write_stats(out, &r->stats);
+    }
+    fprintf(out, "}");
+}
+
+bool report_write_json(const char *path, const BatchJob *jobs, int count,
+                       const ConversionParams *params, const BatchMemoryStats *memory) {
+    if (!path || !jobs || count < 0 || !params) return false;
+
+    FILE *out = fopen(path, "w");
+    if (!out) return false;
+
+    int converted = 0, failed = 0, cancelled = 0, duplicates = 0;
+    size_t input_bytes = 0, output_bytes = 0, duplicate_bytes = 0;
+    StageTimings total = {0};
+
+    fprintf(out, "{\n  \"version\": 1,\n");
+    fprintf(out, "  \"params\": {\"quality\": %.1f, \"method\": %d, \"lossless\": %s, "
+                 "\"auto\": %s, \"best_of\": %s, \"alpha_quality\": %.1f, "
+                 "\"target\": \"%s\", \"target_size\": %zu, "
+                 "\"target_metric\": %.4f},\n",
+            params->quality, params->method, params->lossless ? "true" : "false",
+            params->auto_content ? "true" : "false", params->best_of ? "true" : "false",
+            params->alpha_quality, target_mode_name(params->target_mode),
+            params->target_size, params->target_metric);
+
+    fprintf(out, "  \"files\": [\n");
+    for (int i = 0; i < count; i++) {
+        const BatchJob *job = &jobs[i];
+        write_job(out, job);
+        fprintf(out, i + 1 < count ? ",\n" : "\n");
+
+        if (job->result.success) {
+            converted++;
+            input_bytes += job->input_size;
+            output_bytes += job->result.output_size;
+            if (job->reuse == BATCH_DUPLICATE) {
+                duplicates++;
+                duplicate_bytes += job->input_size;
+            }
+        } else if (job->result.cancelled) {
+            cancelled++;
+        } else {
+            failed++;
+        }
+        total.read_ms += job->result.timings.read_ms;
+        total.decode_ms += job->result.timings.decode_ms;
+        total.analyze_ms += job->result.timings.analyze_ms;
+        total.import_ms += job->result.timings.import_ms;
+        total.encode_ms += job->result.timings.encode_ms;
+        total.write_ms += job->result.timings.write_ms;
+    }
+    fprintf(out, "  ],\n");
+
+    /* Summed over files: stages that ran in parallel add up past the batch time */
+    fprintf(out, "  \"totals\": {\"converted\": %d, \"failed\": %d, \"cancelled\": %d, "
+                 "\"input_bytes\": %zu, \"output_bytes\": %zu,\n             "
+                 "\"duplicates\": %d, \"duplicate_input_bytes\": %zu, \"timings_ms\": ",
+            converted, failed, cancelled, input_bytes, output_bytes, duplicates, duplicate_bytes);
+    write_timings(out, &total);
+    fprintf(out, "}");
+
+    if (memory) {
+        fprintf(out, ",\n  \"memory\": {\"budget\": %zu, \"predicted_peak\": %zu, "
+                     "\"measured_peak\": %zu, \"reordered\": %d}",
+                memory->budget, memory->predicted_peak, memory->measured_peak,
+                memory->reordered);
+    }
+    fprintf(out, "\n}\n");
+
+    bool ok = !ferror(out);
+    if (fclose(out) != 0) ok = false;
+    return ok;
+}
@@ -0,0 +1,19 @@
+/*
+ * WebP Converter - Batch report
+ * Writes the results of a finished batch (sizes, stage timings, peak
+ * memory and encoder statistics per file) as JSON for scripts and CI.
+ */
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "batch.h"
+
+/*
+ * Write jobs[0..count-1] and their totals to path. memory may be NULL.
+ * Returns false if the file cannot be written.
+ */
+bool report_write_json(const char *path, const BatchJob *jobs, int count,
+                       const ConversionParams *params, const BatchMemoryStats *memory);
+
+#endif /* REPORT_H */
@@ -0,0 +1,87 @@
+/*
+ * WebP Converter - Lock-free bounded queue implementation
+ *
+ * Classic sequence-numbered ring (D. Vyukov): each cell carries a counter
+ * so producers and consumers claim slots with a single CAS on their own
+ * position and never touch a lock.
+ */
+
+#include "ring.h"
+#include <stdlib.h>
+
+bool ring_init(Ring *ring, size_t min_capacity) {
+    size_t capacity = 2;
+    while (capacity < min_capacity) capacity <<= 1;
+
+    ring->cells = malloc(sizeof(RingCell) * capacity);
+    if (!ring->cells) return false;
+
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&ring->cells[i].sequence, i);
+        ring->cells[i].value = 0;
+    }
+    ring->mask = capacity - 1;
+    atomic_init(&ring->enqueue_pos, 0);
+    atomic_init(&ring->dequeue_pos, 0);
+
+    return true;
+}
+
+void ring_free(Ring *ring) {
+    free(ring->cells);
+    ring->cells = NULL;
+    ring->mask = 0;
+}
+
+bool ring_push(Ring *ring, uintptr_t value) {
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+
+    for (;;) {
+        RingCell *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                cell->value = value;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; /* Full */
+        } else {
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+bool ring_pop(Ring *ring, uintptr_t *value) {
+    size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+
+    for (;;) {
+        RingCell *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                *value = cell->value;
+                atomic_store_explicit(&cell->sequence, pos + ring->mask + 1,
+                                      memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; /* Empty */
+        } else {
+            pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+size_t ring_capacity(const Ring *ring) {
+    return ring->mask + 1;
+}
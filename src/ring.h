@@ -0,0 +1,42 @@
+/*
+ * WebP Converter - Lock-free bounded queue
+ * Multi-producer / multi-consumer ring of word-sized values
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* One slot; sequence tells producers/consumers whose turn it is */
+typedef struct {
+    atomic_size_t sequence;
+    uintptr_t value;
+} RingCell;
+
+typedef struct {
+    RingCell *cells;
+    size_t mask;
+    _Alignas(64) atomic_size_t enqueue_pos;
+    _Alignas(64) atomic_size_t dequeue_pos;
+} Ring;
+
+/* Allocate a ring holding at least min_capacity values (rounded up to 2^n) */
+bool ring_init(Ring *ring, size_t min_capacity);
+
+/* Free ring storage */
+void ring_free(Ring *ring);
+
+/* Push a value, returns false if the ring is full */
+bool ring_push(Ring *ring, uintptr_t value);
+
+/* Pop a value, returns false if the ring is empty */
+bool ring_pop(Ring *ring, uintptr_t *value);
+
+/* Capacity in values */
+size_t ring_capacity(const Ring *ring);
+
+#endif /* RING_H */
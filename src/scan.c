@@ -0,0 +1,418 @@
+/*
+ * WebP Converter - Directory scanner implementation
+ *
+ * The tree is read one level at a time: every directory of the level is
+ * an iteration of pool_parallel_for, and each worker collects the
+ * subdirectories (the next level) and images it finds in lists of its
+ * own. Entry types come from readdir's d_type where the file system
+ * fills it in, so regular files cost no stat; directories are stat'ed
+ * for their device and inode. Between levels the subdirectories found
+ * are checked against the directories already walked, so a symlink back
+ * up the tree (or a second link to the same folder) is read only once.
+ */
+
+#include "scan.h"
+#include "converter.h"
+#include "util.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Levels followed at most, a backstop for trees too deep to be real */
+#define SCAN_MAX_DEPTH 64
+
+/* Growable list of malloc'd paths */
+typedef struct {
+    char **items;
+    int count;
+    int capacity;
+    bool failed;            /* An allocation failed */
+} PathList;
+
+/* Identity of a directory, whatever path leads to it */
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    bool used;              /* Set slot of a VisitedSet */
+} DirId;
+
+/* A subdirectory found, and the directory it resolves to */
+typedef struct {
+    char *path;
+    DirId id;
+} FoundDir;
+
+/* Growable list of subdirectories found */
+typedef struct {
+    FoundDir *items;
+    int count;
+    int capacity;
+    bool failed;
+} DirList;
+
+/* Open-addressing set of the (device, inode) of the directories walked */
+typedef struct {
+    DirId *slots;
+    size_t slot_count;      /* Power of two */
+    size_t count;
+} VisitedSet;
+
+/* One level of the walk */
+typedef struct {
+    char **dirs;
+    DirList *next;          /* Per worker: subdirectories found */
+    PathList *files;        /* Per worker: images found */
+} ScanLevel;
+
+static void list_push(PathList *list, char *path) {
+    if (!path) {
+        list->failed = true;
+        return;
+    }
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        char **items = realloc(list->items, sizeof(char *) * capacity);
+        if (!items) {
+            free(path);
+            list->failed = true;
+            return;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = path;
+}
+
+static void list_free(PathList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+    free(list->items);
+    memset(list, 0, sizeof(PathList));
+}
+
+static void dirs_push(DirList *list, char *path, DirId id) {
+    if (!path) {
+        list->failed = true;
+        return;
+    }
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 16;
+        FoundDir *items = realloc(list->items, sizeof(FoundDir) * capacity);
+        if (!items) {
+            free(path);
+            list->failed = true;
+            return;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = (FoundDir){ path, id };
+}
+
+static void dirs_free(DirList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->items[i].path);
+    }
+    free(list->items);
+    memset(list, 0, sizeof(DirList));
+}
+
+static size_t visited_hash(DirId id) {
+    uint64_t hash = ((uint64_t)id.ino ^ ((uint64_t)id.dev << 32 | (uint64_t)id.dev >> 32)) *
+                    0x9E3779B97F4A7C15ull;
+    return (size_t)(hash ^ hash >> 32);
+}
+
+/*
+ * Add a directory to the set. Returns false if it was walked already,
+ * or (with *failed set) if the set cannot grow.
+ */
+static bool visited_add(VisitedSet *set, DirId id, bool *failed) {
+    if ((set->count + 1) * 2 > set->slot_count) {
+        size_t slot_count = set->slot_count ? set->slot_count * 2 : 64;
+        DirId *slots = calloc(slot_count, sizeof(DirId));
+        if (!slots) {
+            *failed = true;
+            return false;
+        }
+        for (size_t i = 0; i < set->slot_count; i++) {
+            if (!set->slots[i].used) continue;
+            size_t slot = visited_hash(set->slots[i]) & (slot_count - 1);
+            while (slots[slot].used) slot = (slot + 1) & (slot_count - 1);
+            slots[slot] = set->slots[i];
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->slot_count = slot_count;
+    }
+
+    size_t mask = set->slot_count - 1;
+    size_t slot = visited_hash(id) & mask;
+    while (set->slots[slot].used) {
+        if (set->slots[slot].dev == id.dev && set->slots[slot].ino == id.ino) return false;
+        slot = (slot + 1) & mask;
+    }
+    set->slots[slot] = (DirId){ id.dev, id.ino, true };
+    set->count++;
+    return true;
+}
+
+static char* join_path(const char *dir, const char *name) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    char *path = malloc(dir_len + name_len + 2);
+    if (!path) return NULL;
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+    return path;
+}
+
+/* Read one directory of the level */
+static void scan_one(void *arg, int index, int worker) {
+    ScanLevel *level = arg;
+    const char *dir_path = level->dirs[index];
+
+    int fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return;
+    }
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') continue;
+
+        bool is_dir = false, is_file = false;
+        struct stat st;
+#if defined(DT_DIR)
+        if (ent->d_type == DT_REG) {
+            is_file = true;
+        } else
+#endif
+        {
+            /* Directories (for their identity), symlinks, no d_type */
+            if (fstatat(fd, ent->d_name, &st, 0) != 0) continue;
+            is_dir = S_ISDIR(st.st_mode);
+            is_file = S_ISREG(st.st_mode);
+        }
+
+        if (is_dir) {
+            dirs_push(&level->next[worker], join_path(dir_path, ent->d_name),
+                      (DirId){ st.st_dev, st.st_ino, true });
+        } else if (is_file && converter_is_supported(ent->d_name)) {
+            list_push(&level->files[worker], join_path(dir_path, ent->d_name));
+        }
+    }
+
+    closedir(dir);
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int compare_found(const void *a, const void *b) {
+    return strcmp(((const FoundDir *)a)->path, ((const FoundDir *)b)->path);
+}
+
+bool scan_directory(ThreadPool *pool, const char *root, ScanResult *result) {
+    memset(result, 0, sizeof(ScanResult));
+
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+
+    /* Root without trailing slashes; base is where its own name starts */
+    char *top = strdup(root);
+    if (!top) return false;
+    size_t len = strlen(top);
+    while (len > 1 && top[len - 1] == '/') top[--len] = '\0';
+    const char *slash = strrchr(top, '/');
+    result->base = (slash && slash[1]) ? (size_t)(slash + 1 - top) : 0;
+
+    int workers = pool_thread_count(pool) + 1;
+    DirList *next = calloc(workers, sizeof(DirList));
+    PathList *files = calloc(workers, sizeof(PathList));
+    PathList current = {0};
+    DirList found = {0};
+    VisitedSet visited = {0};
+    bool failed = false;
+    bool ok = next && files;
+    if (ok) {
+        list_push(&current, top);
+        visited_add(&visited, (DirId){ st.st_dev, st.st_ino, true }, &failed);
+    } else {
+        free(top);
+    }
+
+    for (int depth = 0; ok && current.count > 0 && depth < SCAN_MAX_DEPTH; depth++) {
+        ScanLevel level = { current.items, next, files };
+        pool_parallel_for(pool, current.count, scan_one, &level);
+        list_free(&current);
+
+        /*
+         * The subdirectories found make up the next level, less those
+         * walked already, in path order so the same path always wins
+         */
+        for (int w = 0; w < workers; w++) {
+            ok = ok && !next[w].failed && !files[w].failed;
+            for (int i = 0; ok && i < next[w].count; i++) {
+                dirs_push(&found, next[w].items[i].path, next[w].items[i].id);
+            }
+            if (!ok) dirs_free(&next[w]);
+            next[w].count = 0;
+        }
+        ok = ok && !found.failed;
+        if (found.count > 0) qsort(found.items, found.count, sizeof(FoundDir), compare_found);
+        for (int i = 0; i < found.count; i++) {
+            if (ok && visited_add(&visited, found.items[i].id, &failed)) {
+                list_push(&current, found.items[i].path);
+            } else {
+                free(found.items[i].path);
+            }
+        }
+        found.count = 0;
+        ok = ok && !failed && !current.failed;
+    }
+    list_free(&current);
+    dirs_free(&found);
+    free(visited.slots);
+
+    /* Gather the images of every worker */
+    PathList all = {0};
+    for (int w = 0; ok && w < workers; w++) {
+        for (int i = 0; i < files[w].count; i++) {
+            list_push(&all, files[w].items[i]);
+        }
+        files[w].count = 0;
+        ok = !all.failed;
+    }
+    for (int w = 0; w < workers && next && files; w++) {
+        dirs_free(&next[w]);
+        list_free(&files[w]);
+    }
+    free(next);
+    free(files);
+
+    if (!ok) {
+        list_free(&all);
+        return false;
+    }
+
+    qsort(all.items, all.count, sizeof(char *), compare_paths);
+    result->paths = all.items;
+    result->count = all.count;
+    return true;
+}
+
+void scan_free(ScanResult *result) {
+    for (int i = 0; i < result->count; i++) {
+        free(result->paths[i]);
+    }
+    free(result->paths);
+    memset(result, 0, sizeof(ScanResult));
+}
+
+/* Open-addressing set of directory paths */
+struct DirCache {
+    char **slots;
+    size_t slot_count;      /* Power of two */
+    size_t count;
+};
+
+/* Slot holding path[0..len), or the free slot where it would go */
+static size_t dircache_slot(const DirCache *cache, const char *path, size_t len) {
+    size_t mask = cache->slot_count - 1;
+    size_t slot = util_hash_fnv1a(path, len) & mask;
+    while (cache->slots[slot]) {
+        const char *dir = cache->slots[slot];
+        if (strncmp(dir, path, len) == 0 && dir[len] == '\0') break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static bool dircache_insert(DirCache *cache, const char *path, size_t len) {
+    if ((cache->count + 1) * 2 > cache->slot_count) {
+        size_t slot_count = cache->slot_count * 2;
+        char **slots = calloc(slot_count, sizeof(char *));
+        if (!slots) return false;
+        for (size_t i = 0; i < cache->slot_count; i++) {
+            char *dir = cache->slots[i];
+            if (!dir) continue;
+            size_t slot = util_hash_fnv1a(dir, strlen(dir)) & (slot_count - 1);
+            while (slots[slot]) slot = (slot + 1) & (slot_count - 1);
+            slots[slot] = dir;
+        }
+        free(cache->slots);
+        cache->slots = slots;
+        cache->slot_count = slot_count;
+    }
+
+    size_t slot = dircache_slot(cache, path, len);
+    if (cache->slots[slot]) return true;
+    char *copy = malloc(len + 1);
+    if (!copy) return false;
+    memcpy(copy, path, len);
+    copy[len] = '\0';
+    cache->slots[slot] = copy;
+    cache->count++;
+    return true;
+}
+
+DirCache* dircache_create(void) {
+    DirCache *cache = calloc(1, sizeof(DirCache));
+    if (!cache) return NULL;
+    cache->slot_count = 64;
+    cache->slots = calloc(cache->slot_count, sizeof(char *));
+    if (!cache->slots) {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void dircache_destroy(DirCache *cache) {
+    if (!cache) return;
+    for (size_t i = 0; i < cache->slot_count; i++) {
+        free(cache->slots[i]);
+    }
+    free(cache->slots);
+    free(cache);
+}
+
+bool dircache_make_parent(DirCache *cache, const char *file_path) {
+    const char *slash = strrchr(file_path, '/');
+    if (!slash || slash == file_path) return true;
+
+    size_t len = (size_t)(slash - file_path);
+    if (cache->slots[dircache_slot(cache, file_path, len)]) return true;
+
+    /* Each missing ancestor, top down; known ones cost a lookup */
+    char *dir = malloc(len + 1);
+    if (!dir) return false;
+    memcpy(dir, file_path, len);
+    dir[len] = '\0';
+
+    bool ok = true;
+    for (size_t end = 1; ok && end <= len; end++) {
+        if (end < len && dir[end] != '/') continue;
+        if (cache->slots[dircache_slot(cache, dir, end)]) continue;
+
+        dir[end] = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) ok = false;
+        if (end < len) dir[end] = '/';
+        ok = ok && dircache_insert(cache, dir, end);
+    }
+
+    free(dir);
+    return ok;
+}
@@ -0,0 +1,42 @@
+/*
+ * WebP Converter - Directory scanner
+ * Finds the supported images below a directory, reading the directories
+ * of each level of the tree in parallel on the worker pool, and creates
+ * the matching output directories when the tree is mirrored.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "pool.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Supported images found below one directory */
+typedef struct {
+    char **paths;           /* Sorted; "root/sub/name" */
+    int count;
+    size_t base;            /* Offset in every path of the root's own name */
+} ScanResult;
+
+/*
+ * Walk root on pool (and the calling thread), skipping hidden entries
+ * and following symlinks, but reading each directory once however many
+ * paths lead to it. Must not be called from a task of that pool.
+ * Returns false if root cannot be opened or memory runs out.
+ */
+bool scan_directory(ThreadPool *pool, const char *root, ScanResult *result);
+
+/* Release the paths of a scan */
+void scan_free(ScanResult *result);
+
+/* Directories already created or found, so each is made only once */
+typedef struct DirCache DirCache;
+
+DirCache* dircache_create(void);
+void dircache_destroy(DirCache *cache);
+
+/* Create the directory that will hold file_path, parents included */
+bool dircache_make_parent(DirCache *cache, const char *file_path);
+
+#endif /* SCAN_H */
@@ -14,11 +14,13 @@ static const char* all_strings[LANG_COUNT][STR_COUNT] = {
         [STR_FILES] = "FILES",
         [STR_FILE] = "file",
         [STR_ADD_FILES] = "Add Files...",
+        [STR_ADD_FOLDER] = "Add Folder...",
         [STR_CLEAR_ALL] = "Clear All",
         [STR_OUTPUT_FOLDER] = "OUTPUT FOLDER",
         [STR_SAME_FOLDER] = "Same folder as source",
         [STR_SELECT_FOLDER] = "Select Folder...",
         [STR_CHANGE_FOLDER] = "Change Folder...",
+        [STR_SKIP_UNCHANGED] = "Skip unchanged files",
         [STR_PRESETS] = "PRESETS",
         [STR_LOW] = "Low",
         [STR_MEDIUM] = "Medium",
@@ -27,6 +29,7 @@ static const char* all_strings[LANG_COUNT][STR_COUNT] = {
         [STR_WEB] = "Web",
         [STR_PHOTO] = "Photo",
         [STR_THUMB] = "Thumb",
+        [STR_AUTO] = "Auto",
         [STR_SETTINGS] = "SETTINGS",
         [STR_QUALITY] = "Quality",
         [STR_COMPRESSION_EFFORT] = "Compression effort",
@@ -34,19 +37,31 @@ static const char* all_strings[LANG_COUNT][STR_COUNT] = {
         [STR_SHOW_ADVANCED] = "Show advanced options",
         [STR_ALPHA_QUALITY] = "Alpha quality",
         [STR_FILTER_STRENGTH] = "Filter strength",
+        [STR_BEST_OF] = "Keep smaller of lossy/lossless",
+        [STR_LIMIT_FILE_SIZE] = "Limit file size",
         [STR_CONVERT_TO_WEBP] = "Convert to WebP",
         [STR_CONVERT_FILES] = "Convert %d Files to WebP",
         [STR_FILE_SELECTED] = "1 file selected",
         [STR_FILES_SELECTED] = "%d files selected",
         [STR_ESTIMATE] = "Est: %s -> ~%s",
+        [STR_ESTIMATE_RANGE] = "Est: %s -> %s to %s",
+        [STR_ESTIMATING] = "Est: %s -> ...",
         [STR_DROP_IMAGES] = "Drop images here",
         [STR_SUPPORTED_FORMATS] = "PNG, JPEG, BMP, GIF",
         [STR_CONVERSION_COMPLETE] = "Conversion Complete!",
         [STR_FILES_CONVERTED] = "%d of %d files converted successfully",
         [STR_SAVED_SPACE] = "Saved %d%% space",
         [STR_FILES_FAILED] = "%d file(s) failed",
+        [STR_FILES_REUSED] = "%d rebuilt, %d up to date, %d copied, %d duplicates",
         [STR_OK] = "OK",
+        [STR_SAVE_REPORT] = "Save Report",
+        [STR_REPORT_SAVED] = "Report saved: %s",
+        [STR_REPORT_FAILED] = "Could not write the report",
+        [STR_STAGE_TIMES] = "decode %.0f  import %.0f  encode %.0f  write %.0f ms",
         [STR_CONVERTING] = "Converting %d/%d: %s",
+        [STR_TIME_LEFT] = "%d%%, %s left",
+        [STR_CANCEL] = "Cancel",
+        [STR_CANCELLED] = "Cancelled: %d converted, %d not converted",
         [STR_DONE] = "Done! %d converted, %d failed",
         [STR_READY_TO_CONVERT] = "%d file(s) ready to convert",
         [STR_DROP_OR_ADD] = "Drop images or click 'Add Files' to start",
@@ -58,11 +73,13 @@ static const char* all_strings[LANG_COUNT][STR_COUNT] = {
         [STR_FILES] = "FICHIERS",
         [STR_FILE] = "fichier",
         [STR_ADD_FILES] = "Ajouter...",
+        [STR_ADD_FOLDER] = "Dossier...",
         [STR_CLEAR_ALL] = "Tout effacer",
         [STR_OUTPUT_FOLDER] = "DOSSIER DE SORTIE",
         [STR_SAME_FOLDER] = "Meme dossier que source",
         [STR_SELECT_FOLDER] = "Choisir dossier...",
         [STR_CHANGE_FOLDER] = "Changer dossier...",
+        [STR_SKIP_UNCHANGED] = "Ignorer fichiers inchanges",
         [STR_PRESETS] = "PRESELECTIONS",
         [STR_LOW] = "Basse",
         [STR_MEDIUM] = "Moyenne",
@@ -71,6 +88,7 @@ static const char* all_strings[LANG_COUNT][STR_COUNT] = {
         [STR_WEB] = "Web",
         [STR_PHOTO] = "Photo",
         [STR_THUMB] = "Mini",
+        [STR_AUTO] = "Auto",
         [STR_SETTINGS] = "PARAMETRES",
         [STR_QUALITY] = "Qualite",
         [STR_COMPRESSION_EFFORT] = "Effort de compression",
@@ -78,19 +96,31 @@ static const char* all_strings[LANG_COUNT][STR_COUNT] = {
         [STR_SHOW_ADVANCED] = "Options avancees",
         [STR_ALPHA_QUALITY] = "Qualite alpha",
         [STR_FILTER_STRENGTH] = "Force du filtre",
+        [STR_BEST_OF] = "Garder le plus petit (avec/sans perte)",
+        [STR_LIMIT_FILE_SIZE] = "Limiter la taille",
         [STR_CONVERT_TO_WEBP] = "Convertir en WebP",
         [STR_CONVERT_FILES] = "Convertir %d fichiers",
         [STR_FILE_SELECTED] = "1 fichier selectionne",
         [STR_FILES_SELECTED] = "%d fichiers selectionnes",
         [STR_ESTIMATE] = "Est: %s -> ~%s",
+        [STR_ESTIMATE_RANGE] = "Est: %s -> %s a %s",
+        [STR_ESTIMATING] = "Est: %s -> ...",
         [STR_DROP_IMAGES] = "Deposez vos images ici",
         [STR_SUPPORTED_FORMATS] = "PNG, JPEG, BMP, GIF",
         [STR_CONVERSION_COMPLETE] = "Conversion terminee !",
         [STR_FILES_CONVERTED] = "%d sur %d fichiers convertis",
         [STR_SAVED_SPACE] = "%d%% d'espace economise",
         [STR_FILES_FAILED] = "%d fichier(s) echoue(s)",
+        [STR_FILES_REUSED] = "%d recode(s), %d a jour, %d copie(s), %d doublon(s)",
         [STR_OK] = "OK",
+        [STR_SAVE_REPORT] = "Enregistrer le rapport",
+        [STR_REPORT_SAVED] = "Rapport enregistre : %s",
+        [STR_REPORT_FAILED] = "Impossible d'ecrire le rapport",
+        [STR_STAGE_TIMES] = "decodage %.0f  import %.0f  encodage %.0f  ecriture %.0f ms",
         [STR_CONVERTING] = "Conversion %d/%d: %s",
+        [STR_TIME_LEFT] = "%d%%, %s restant",
+        [STR_CANCEL] = "Annuler",
+        [STR_CANCELLED] = "Annule : %d converti(s), %d non converti(s)",
         [STR_DONE] = "Termine ! %d converti(s), %d echoue(s)",
         [STR_READY_TO_CONVERT] = "%d fichier(s) pret(s)",
         [STR_DROP_OR_ADD] = "Deposez des images ou cliquez 'Ajouter'",
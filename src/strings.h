@@ -17,11 +17,13 @@ typedef enum {
     STR_FILES,
     STR_FILE,
     STR_ADD_FILES,
+    STR_ADD_FOLDER,
     STR_CLEAR_ALL,
     STR_OUTPUT_FOLDER,
     STR_SAME_FOLDER,
     STR_SELECT_FOLDER,
     STR_CHANGE_FOLDER,
+    STR_SKIP_UNCHANGED,
     STR_PRESETS,
     STR_LOW,
     STR_MEDIUM,
@@ -30,6 +32,7 @@ typedef enum {
     STR_WEB,
     STR_PHOTO,
     STR_THUMB,
+    STR_AUTO,
     STR_SETTINGS,
     STR_QUALITY,
     STR_COMPRESSION_EFFORT,
@@ -37,19 +40,31 @@ typedef enum {
     STR_SHOW_ADVANCED,
     STR_ALPHA_QUALITY,
     STR_FILTER_STRENGTH,
+    STR_BEST_OF,
+    STR_LIMIT_FILE_SIZE,
     STR_CONVERT_TO_WEBP,
     STR_CONVERT_FILES,
     STR_FILE_SELECTED,
     STR_FILES_SELECTED,
     STR_ESTIMATE,
+    STR_ESTIMATE_RANGE,
+    STR_ESTIMATING,
     STR_DROP_IMAGES,
     STR_SUPPORTED_FORMATS,
     STR_CONVERSION_COMPLETE,
     STR_FILES_CONVERTED,
     STR_SAVED_SPACE,
     STR_FILES_FAILED,
+    STR_FILES_REUSED,
     STR_OK,
+    STR_SAVE_REPORT,
+    STR_REPORT_SAVED,
+    STR_REPORT_FAILED,
+    STR_STAGE_TIMES,
     STR_CONVERTING,
+    STR_TIME_LEFT,
+    STR_CANCEL,
+    STR_CANCELLED,
     STR_DONE,
     STR_READY_TO_CONVERT,
     STR_DROP_OR_ADD,
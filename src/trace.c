@@ -0,0 +1,267 @@
+/*
+ * WebP Converter - Timeline trace recorder implementation
+ *
+ * Each thread appends to its own TraceBuffer, found through a
+ * thread-local pointer, so recording never contends. Buffers are linked
+ * into a global registry once (lock-free push) and never unlinked: when
+ * a thread exits its buffer is marked free and the next new thread
+ * adopts it, so short-lived threads (per-batch stages, search trials) do
+ * not pile up buffers. Events are kept in chunks tagged with the thread
+ * that wrote them, so an adopted buffer still reports its earlier owner's
+ * spans. A generation counter bumped by trace_start() tells each owner
+ * to drop the events of an earlier trace.
+ */
+
+#include "trace.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Chunk sizes: short-lived threads record a handful of spans */
+#define TRACE_FIRST_CHUNK 64
+#define TRACE_MAX_CHUNK 4096
+
+typedef struct {
+    double start_us;
+    double duration_us;
+    int name;
+    int file;
+} TraceEvent;
+
+typedef struct TraceChunk {
+    struct TraceChunk *next;
+    int tid;                    /* Thread that wrote the events */
+    char thread_name[32];
+    int count;
+    int capacity;
+    TraceEvent events[];
+} TraceChunk;
+
+typedef struct TraceBuffer {
+    struct TraceBuffer *next;   /* Registry link */
+    atomic_bool in_use;         /* Owned by a live thread */
+    int tid;                    /* Current owner */
+    char thread_name[32];
+    int file;                   /* Tag for the owner's next spans */
+    unsigned generation;        /* Trace the chunks belong to */
+    TraceChunk *head;
+    TraceChunk *tail;
+} TraceBuffer;
+
+static const char *const TRACE_NAMES[TRACE_NAME_COUNT] = {
+    [TRACE_READ] = "read",
+    [TRACE_HASH] = "hash",
+    [TRACE_DECODE] = "converter_load_image",
+    [TRACE_ANALYZE] = "content_analyze",
+    [TRACE_IMPORT] = "WebPPictureImport",
+    [TRACE_ENCODE] = "WebPEncode",
+    [TRACE_WRITE] = "write",
+    [TRACE_SCORE] = "score trial",
+};
+
+atomic_bool trace_active;
+
+static _Atomic(TraceBuffer *) registry;
+static atomic_int next_tid;
+static atomic_uint generation;
+static double epoch_us;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t buffer_key;
+static _Thread_local TraceBuffer *local_buffer;
+
+static double clock_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+double trace_now_us(void) {
+    return clock_us() - epoch_us;
+}
+
+/* Thread exit: hand the buffer (and its events) over to the next thread */
+static void release_buffer(void *arg) {
+    TraceBuffer *buffer = arg;
+    atomic_store(&buffer->in_use, false);
+}
+
+static void create_key(void) {
+    pthread_key_create(&buffer_key, release_buffer);
+}
+
+/* Drop chunks recorded for an earlier trace (owner thread only) */
+static void reset_if_stale(TraceBuffer *buffer) {
+    unsigned current = atomic_load_explicit(&generation, memory_order_acquire);
+    if (buffer->generation == current) return;
+
+    TraceChunk *chunk = buffer->head;
+    while (chunk) {
+        TraceChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    buffer->head = NULL;
+    buffer->tail = NULL;
+    buffer->generation = current;
+}
+
+static TraceBuffer* thread_buffer(void) {
+    if (local_buffer) return local_buffer;
+
+    pthread_once(&key_once, create_key);
+
+    /* Adopt the buffer of a thread that has exited (its events stay), or add one */
+    TraceBuffer *buffer = NULL;
+    for (TraceBuffer *b = atomic_load(&registry); b; b = b->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&b->in_use, &expected, true)) {
+            buffer = b;
+            break;
+        }
+    }
+    if (!buffer) {
+        buffer = calloc(1, sizeof(TraceBuffer));
+        if (!buffer) return NULL;
+        atomic_init(&buffer->in_use, true);
+        buffer->generation = atomic_load(&generation);
+        TraceBuffer *head = atomic_load(&registry);
+        do {
+            buffer->next = head;
+        } while (!atomic_compare_exchange_weak(&registry, &head, buffer));
+    }
+
+    buffer->tid = atomic_fetch_add(&next_tid, 1) + 1;
+    buffer->thread_name[0] = '\0';
+    buffer->file = -1;
+    pthread_setspecific(buffer_key, buffer);
+    local_buffer = buffer;
+    return buffer;
+}
+
+void trace_record(int name, double start_us) {
+    double end_us = trace_now_us();
+
+    TraceBuffer *buffer = thread_buffer();
+    if (!buffer) return;
+    reset_if_stale(buffer);
+
+    /* A new owner starts its own chunk; a busy one doubles its chunks */
+    TraceChunk *chunk = buffer->tail;
+    if (!chunk || chunk->count == chunk->capacity || chunk->tid != buffer->tid) {
+        int capacity = TRACE_FIRST_CHUNK;
+        if (chunk && chunk->tid == buffer->tid && chunk->capacity < TRACE_MAX_CHUNK) {
+            capacity = chunk->capacity * 2;
+        } else if (chunk && chunk->tid == buffer->tid) {
+            capacity = TRACE_MAX_CHUNK;
+        }
+        TraceChunk *grown = malloc(sizeof(TraceChunk) + (size_t)capacity * sizeof(TraceEvent));
+        if (!grown) return;
+        grown->next = NULL;
+        grown->tid = buffer->tid;
+        memcpy(grown->thread_name, buffer->thread_name, sizeof(grown->thread_name));
+        grown->count = 0;
+        grown->capacity = capacity;
+        if (chunk) {
+            chunk->next = grown;
+        } else {
+            buffer->head = grown;
+        }
+        buffer->tail = grown;
+        chunk = grown;
+    }
+
+    TraceEvent *event = &chunk->events[chunk->count++];
+    event->start_us = start_us;
+    event->duration_us = end_us - start_us;
+    event->name = name;
+    event->file = buffer->file;
+}
+
+void trace_start(void) {
+    epoch_us = clock_us();
+    atomic_fetch_add_explicit(&generation, 1, memory_order_release);
+    atomic_store(&trace_active, true);
+}
+
+void trace_stop(void) {
+    atomic_store(&trace_active, false);
+}
+
+void trace_set_thread_name(const char *name) {
+    if (!atomic_load_explicit(&trace_active, memory_order_relaxed)) return;
+
+    TraceBuffer *buffer = thread_buffer();
+    if (!buffer) return;
+    snprintf(buffer->thread_name, sizeof(buffer->thread_name), "%s", name);
+    if (buffer->tail && buffer->tail->tid == buffer->tid) {
+        memcpy(buffer->tail->thread_name, buffer->thread_name, sizeof(buffer->thread_name));
+    }
+}
+
+void trace_set_file(int file) {
+    if (!atomic_load_explicit(&trace_active, memory_order_relaxed)) return;
+
+    TraceBuffer *buffer = thread_buffer();
+    if (buffer) buffer->file = file;
+}
+
+int trace_current_file(void) {
+    return local_buffer ? local_buffer->file : -1;
+}
+
+bool trace_write(const char *path, const char *const *file_names, int file_count) {
+    trace_stop();
+    if (!path) return false;
+
+    FILE *out = fopen(path, "w");
+    if (!out) return false;
+
+    unsigned current = atomic_load(&generation);
+    bool first = true;
+
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (TraceBuffer *b = atomic_load(&registry); b; b = b->next) {
+        if (b->generation != current) continue;
+
+        int named_tid = 0;
+        for (TraceChunk *chunk = b->head; chunk; chunk = chunk->next) {
+            /* One name per thread, taken from its first chunk */
+            if (chunk->tid != named_tid && chunk->thread_name[0]) {
+                named_tid = chunk->tid;
+                fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                             "\"tid\": %d, \"args\": {\"name\": ",
+                        first ? "" : ",\n", chunk->tid);
+                util_write_json_string(out, chunk->thread_name);
+                fprintf(out, "}}");
+                first = false;
+            }
+            for (int i = 0; i < chunk->count; i++) {
+                const TraceEvent *e = &chunk->events[i];
+                fprintf(out, "%s{\"name\": \"%s\", \"cat\": \"convert\", \"ph\": \"X\", "
+                             "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d",
+                        first ? "" : ",\n", TRACE_NAMES[e->name],
+                        e->start_us, e->duration_us, chunk->tid);
+                if (e->file >= 0) {
+                    fprintf(out, ", \"args\": {\"file\": ");
+                    if (file_names && e->file < file_count && file_names[e->file]) {
+                        util_write_json_string(out, file_names[e->file]);
+                    } else {
+                        fprintf(out, "%d", e->file);
+                    }
+                    fprintf(out, "}");
+                }
+                fprintf(out, "}");
+                first = false;
+            }
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    bool ok = !ferror(out);
+    if (fclose(out) != 0) ok = false;
+    return ok;
+}
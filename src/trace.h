@@ -0,0 +1,78 @@
+/*
+ * WebP Converter - Timeline trace recorder
+ * Records per-file stage spans from every thread into per-thread buffers
+ * (no locks, no shared writes) and dumps them as Chrome Trace JSON, which
+ * chrome://tracing and ui.perfetto.dev open directly. While tracing is
+ * off a span costs one relaxed atomic load.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* Stages recorded as spans */
+typedef enum {
+    TRACE_READ,             /* Map, probe and prefetch an input file */
+    TRACE_HASH,             /* Read and hash an input for the manifest check */
+    TRACE_DECODE,           /* converter_load_image: file bytes to pixels */
+    TRACE_ANALYZE,          /* content_analyze (Auto preset) */
+    TRACE_IMPORT,           /* WebPPictureImport*: pixels to ARGB/YUV */
+    TRACE_ENCODE,           /* WebPEncode */
+    TRACE_WRITE,            /* Output file writes, close and rename */
+    TRACE_SCORE,            /* Decode and score a target-search trial */
+    TRACE_NAME_COUNT
+} TraceName;
+
+/* An open span; end it on the thread that began it */
+typedef struct {
+    double start_us;
+    int name;               /* -1 while tracing is off */
+} TraceSpan;
+
+/* Set while recording (read through trace_begin()) */
+extern atomic_bool trace_active;
+
+/* Microseconds since trace_start() */
+double trace_now_us(void);
+
+/* Append a finished span to the calling thread's buffer */
+void trace_record(int name, double start_us);
+
+static inline TraceSpan trace_begin(TraceName name) {
+    TraceSpan span = { 0.0, -1 };
+    if (atomic_load_explicit(&trace_active, memory_order_relaxed)) {
+        span.name = (int)name;
+        span.start_us = trace_now_us();
+    }
+    return span;
+}
+
+static inline void trace_end(TraceSpan span) {
+    if (span.name >= 0) trace_record(span.name, span.start_us);
+}
+
+/* Drop anything recorded before and start recording */
+void trace_start(void);
+
+/* Stop recording (spans already open are still closed and kept) */
+void trace_stop(void);
+
+/* Name the calling thread in the timeline (copied) */
+void trace_set_thread_name(const char *name);
+
+/* Tag the calling thread's next spans with a file index (-1 for none) */
+void trace_set_file(int file);
+
+/* File index the calling thread is tagged with */
+int trace_current_file(void);
+
+/*
+ * Stop recording and write every thread's spans to path. Call it once the
+ * traced threads are idle (after the batch). file_names[i] labels spans of
+ * file i and may be NULL. Returns false if the file cannot be written.
+ */
+bool trace_write(const char *path, const char *const *file_names, int file_count);
+
+#endif /* TRACE_H */
@@ -4,9 +4,12 @@
 
 #include "ui.h"
 #include "strings.h"
+#include "report.h"
+#include "scan.h"
 #include <stdio.h>
 #include <string.h>
 #include <libgen.h>
+#include <sys/stat.h>
 
 #define RAYGUI_IMPLEMENTATION
 #include "raygui.h"
@@ -29,6 +32,7 @@
 #define CONTROL_HEIGHT 30
 #define CONTROL_SPACING 10
 #define FILE_LIST_ITEM_HEIGHT 25
+#define FILE_LIST_SCROLLBAR_WIDTH 8
 
 /* Forward declarations */
 static void draw_sidebar(UIContext *ctx);
@@ -37,8 +41,13 @@ static void draw_file_list(UIContext *ctx);
 static void draw_status_bar(UIContext *ctx);
 static void draw_popup(UIContext *ctx);
 static void open_file_dialog(UIContext *ctx);
-static void generate_output_paths(UIContext *ctx);
+static void open_folder_dialog(UIContext *ctx);
+static void save_report_dialog(UIContext *ctx);
+static bool generate_output_paths(UIContext *ctx);
+static void update_estimator_files(UIContext *ctx);
+static void apply_preset(UIContext *ctx, PresetType type);
 static const char* format_size(size_t bytes);
+static const char* format_duration(double seconds);
 static const char* get_filename(const char *path);
 
 void ui_init(UIContext *ctx) {
@@ -51,11 +60,21 @@ void ui_init(UIContext *ctx) {
     ctx->preview_scale = 1.0f;
     ctx->waiting_for_drop = true;
     ctx->use_same_dir = true;
+    ctx->incremental = true;
     ctx->current_file = -1;
+    filetable_init(&ctx->files);
 
     presets_apply(PRESET_MEDIUM, &ctx->params);
     strncpy(ctx->status_message, str(STR_DROP_OR_ADD), sizeof(ctx->status_message) - 1);
 
+    /* Persistent worker threads, one per core */
+    ctx->engine = batch_create(0);
+
+    /* Size estimate thread; set_params below starts it on the empty list */
+    ctx->estimator = estimator_create();
+    ctx->estimated_params = ctx->params;
+    estimator_set_params(ctx->estimator, &ctx->params);
+
     /* Configure raygui style */
     GuiSetStyle(DEFAULT, TEXT_SIZE, 14);
     GuiSetStyle(DEFAULT, BACKGROUND_COLOR, ColorToInt(COLOR_PANEL));
@@ -64,28 +83,49 @@ void ui_init(UIContext *ctx) {
 }
 
 void ui_cleanup(UIContext *ctx) {
+    /* Stops an in-flight batch before the file list goes away */
+    batch_cancel(ctx->engine);
+    batch_destroy(ctx->engine);
+    ctx->engine = NULL;
+    manifest_free(ctx->manifest);
+    ctx->manifest = NULL;
+    estimator_destroy(ctx->estimator);
+    ctx->estimator = NULL;
+
     if (ctx->has_preview) {
         UnloadTexture(ctx->preview_texture);
         ctx->has_preview = false;
     }
     converter_free_image(&ctx->image);
+
+    filetable_free(&ctx->files);
+    free(ctx->jobs);
+    ctx->jobs = NULL;
+    ctx->job_count = 0;
+    ctx->job_capacity = 0;
 }
 
 void ui_clear_files(UIContext *ctx) {
+    /* Workers still read the file list */
+    if (ctx->state == STATE_CONVERTING) return;
+
     if (ctx->has_preview) {
         UnloadTexture(ctx->preview_texture);
         ctx->has_preview = false;
     }
     converter_free_image(&ctx->image);
 
-    ctx->file_count = 0;
+    filetable_clear(&ctx->files);
     ctx->current_file = -1;
+    ctx->scroll_offset = 0;
     ctx->converted_count = 0;
     ctx->failed_count = 0;
     ctx->total_input_size = 0;
     ctx->total_output_size = 0;
     ctx->state = STATE_IDLE;
     strncpy(ctx->status_message, str(STR_DROP_OR_ADD), sizeof(ctx->status_message) - 1);
+
+    estimator_set_files(ctx->estimator, NULL, NULL, 0);
 }
 
 static void open_file_dialog(UIContext *ctx) {
@@ -102,96 +142,178 @@ static void open_file_dialog(UIContext *ctx) {
     if (result) {
         /* tinyfiledialogs returns paths separated by | for multiple files */
         char *paths = strdup(result);
-        char *token = strtok(paths, "|");
-        const char *file_list[MAX_FILES];
-        int count = 0;
-
-        while (token && count < MAX_FILES) {
-            file_list[count++] = token;
-            token = strtok(NULL, "|");
+        int count = 1;
+        for (const char *p = result; *p; p++) {
+            if (*p == '|') count++;
         }
-
-        ui_add_files(ctx, file_list, count);
+        const char **file_list = malloc(sizeof(char *) * count);
+
+        if (paths && file_list) {
+            count = 0;
+            char *token = strtok(paths, "|");
+            while (token) {
+                file_list[count++] = token;
+                token = strtok(NULL, "|");
+            }
+            ui_add_files(ctx, file_list, count);
+        }
+        free(file_list);
         free(paths);
     }
 }
 
+static void open_folder_dialog(UIContext *ctx) {
+    const char *folder = tinyfd_selectFolderDialog(str(STR_ADD_FOLDER), "");
+    if (folder) {
+        ui_add_files(ctx, &folder, 1);
+    }
+}
+
+static void save_report_dialog(UIContext *ctx) {
+    const char *filters[] = { "*.json" };
+    const char *path = tinyfd_saveFileDialog(str(STR_SAVE_REPORT), "webp_report.json",
+                                             1, filters, "JSON");
+    if (!path) return;
+
+    BatchMemoryStats memory;
+    batch_memory_stats(ctx->engine, &memory);
+    if (report_write_json(path, ctx->jobs, ctx->job_count, &ctx->batch_params, &memory)) {
+        snprintf(ctx->status_message, sizeof(ctx->status_message),
+                str(STR_REPORT_SAVED), get_filename(path));
+    } else {
+        snprintf(ctx->status_message, sizeof(ctx->status_message), "%s",
+                str(STR_REPORT_FAILED));
+    }
+}
+
+/* Header probe of one newly added entry, run on the worker pool */
+typedef struct {
+    FileTable *table;
+    int first;
+} ProbeRange;
+
+static void probe_entry(void *arg, int index, int worker) {
+    ProbeRange *range = arg;
+    FileTable *table = range->table;
+    int i = range->first + index;
+
+    ImageData info;
+    if (converter_probe_image(table->input_paths[i], &info)) {
+        table->widths[i] = info.width;
+        table->heights[i] = info.height;
+        table->channels[i] = (uint8_t)info.channels;
+    }
+    /* Size comes from stat even when the header is unreadable */
+    table->file_sizes[i] = info.file_size;
+}
+
 void ui_add_files(UIContext *ctx, const char **filepaths, int count) {
-    for (int i = 0; i < count && ctx->file_count < MAX_FILES; i++) {
-        const char *path = filepaths[i];
+    /* Workers still read the file list */
+    if (ctx->state == STATE_CONVERTING) return;
 
-        /* Check if file is supported */
-        if (!converter_is_supported(path)) continue;
+    FileTable *files = &ctx->files;
+    int first_new = files->count;
+
+    for (int i = 0; i < count; i++) {
+        const char *path = filepaths[i];
 
-        /* Check if already in list */
-        bool duplicate = false;
-        for (int j = 0; j < ctx->file_count; j++) {
-            if (strcmp(ctx->files[j].input_path, path) == 0) {
-                duplicate = true;
-                break;
+        /* Folders: their images, to be mirrored under the output folder */
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            ScanResult scan;
+            if (scan_directory(batch_get_pool(ctx->engine), path, &scan)) {
+                for (int j = 0; j < scan.count; j++) {
+                    filetable_add(files, scan.paths[j], scan.paths[j] + scan.base);
+                }
+                scan_free(&scan);
             }
+            continue;
         }
-        if (duplicate) continue;
-
-        /* Add to list */
-        FileEntry *entry = &ctx->files[ctx->file_count];
-        strncpy(entry->input_path, path, sizeof(entry->input_path) - 1);
-        strncpy(entry->filename, get_filename(path), sizeof(entry->filename) - 1);
 
-        /* Get file size */
-        ImageData temp;
-        if (converter_load_image(path, &temp)) {
-            entry->file_size = temp.file_size;
-            converter_free_image(&temp);
-        }
+        /* Check if file is supported */
+        if (!converter_is_supported(path)) continue;
 
-        entry->converted = false;
-        entry->failed = false;
+        /* Skipped if already in the list */
+        filetable_add(files, path, NULL);
+    }
 
-        ctx->file_count++;
+    /* Read sizes and dimensions of the new files in parallel */
+    ProbeRange range = { files, first_new };
+    pool_parallel_for(batch_get_pool(ctx->engine), files->count - first_new,
+                      probe_entry, &range);
+    for (int i = first_new; i < files->count; i++) {
+        files->total_size += files->file_sizes[i];
     }
 
-    /* Generate output paths */
-    generate_output_paths(ctx);
+    if (files->count > first_new) {
+        update_estimator_files(ctx);
+    }
 
     /* Load preview of first file if none selected */
-    if (ctx->file_count > 0 && ctx->current_file < 0) {
+    if (files->count > 0 && ctx->current_file < 0) {
         ui_load_preview(ctx, 0);
     }
 
-    if (ctx->file_count > 0) {
+    if (files->count > 0) {
         ctx->state = STATE_LOADED;
         snprintf(ctx->status_message, sizeof(ctx->status_message),
-                str(STR_READY_TO_CONVERT), ctx->file_count);
+                str(STR_READY_TO_CONVERT), files->count);
     }
 }
 
-static void generate_output_paths(UIContext *ctx) {
-    for (int i = 0; i < ctx->file_count; i++) {
-        FileEntry *entry = &ctx->files[i];
-        char temp[512];
+/* Hand the current file list to the size estimator */
+static void update_estimator_files(UIContext *ctx) {
+    estimator_set_files(ctx->estimator, ctx->files.input_paths, ctx->files.file_sizes,
+                        ctx->files.count);
+}
+
+/*
+ * Output path of every file, for the batch about to start. In an output
+ * folder, files that came from an added folder keep their place in its
+ * tree; the directories are created here, each once.
+ */
+static bool generate_output_paths(UIContext *ctx) {
+    FileTable *files = &ctx->files;
+    filetable_reset_outputs(files);
+
+    bool same_dir = ctx->use_same_dir || !ctx->output_dir[0];
+    DirCache *dirs = same_dir ? NULL : dircache_create();
+    if (!same_dir && !dirs) return false;
+    bool ok = true;
+
+    for (int i = 0; i < files->count; i++) {
+        char temp[1024];
 
-        if (ctx->use_same_dir) {
-            strncpy(temp, entry->input_path, sizeof(temp) - 1);
+        /* No folder picked yet: next to the source */
+        if (same_dir) {
+            snprintf(temp, sizeof(temp), "%s", files->input_paths[i]);
         } else {
-            snprintf(temp, sizeof(temp), "%s/%s",
-                    ctx->output_dir, entry->filename);
+            snprintf(temp, sizeof(temp), "%s/%s", ctx->output_dir, files->relative_paths[i]);
         }
 
-        /* Replace extension with .webp */
-        char *dot = strrchr(temp, '.');
-        if (dot) {
-            strcpy(dot, ".webp");
-        } else {
-            strcat(temp, ".webp");
+        /* Replace the extension (of the file name, not a folder) with .webp */
+        char *slash = strrchr(temp, '/');
+        char *dot = strrchr(slash ? slash : temp, '.');
+        size_t end = dot ? (size_t)(dot - temp) : strlen(temp);
+        if (end + sizeof(".webp") > sizeof(temp)) {
+            ok = false;
+            break;
         }
+        memcpy(temp + end, ".webp", sizeof(".webp"));
 
-        strncpy(entry->output_path, temp, sizeof(entry->output_path) - 1);
+        if (!filetable_set_output(files, i, temp) ||
+            (dirs && !dircache_make_parent(dirs, temp))) {
+            ok = false;
+            break;
+        }
     }
+
+    dircache_destroy(dirs);
+    return ok;
 }
 
 bool ui_load_preview(UIContext *ctx, int file_index) {
-    if (file_index < 0 || file_index >= ctx->file_count) return false;
+    if (file_index < 0 || file_index >= ctx->files.count) return false;
 
     /* Free previous preview */
     if (ctx->has_preview) {
@@ -200,10 +322,8 @@ bool ui_load_preview(UIContext *ctx, int file_index) {
     }
     converter_free_image(&ctx->image);
 
-    FileEntry *entry = &ctx->files[file_index];
-
     /* Load the image */
-    if (!converter_load_image(entry->input_path, &ctx->image)) {
+    if (!converter_load_image(ctx->files.input_paths[file_index], &ctx->image)) {
         return false;
     }
 
@@ -212,7 +332,8 @@ bool ui_load_preview(UIContext *ctx, int file_index) {
         .data = ctx->image.data,
         .width = ctx->image.width,
         .height = ctx->image.height,
-        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+        .format = ctx->image.channels == 4 ? PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+                                           : PIXELFORMAT_UNCOMPRESSED_R8G8B8,
         .mipmaps = 1
     };
     ctx->preview_texture = LoadTextureFromImage(raylib_img);
@@ -227,43 +348,122 @@ bool ui_load_preview(UIContext *ctx, int file_index) {
 }
 
 void ui_start_conversion(UIContext *ctx) {
-    if (ctx->file_count == 0) return;
+    FileTable *files = &ctx->files;
+    if (files->count == 0 || ctx->state == STATE_CONVERTING) return;
+
+    if (files->count > ctx->job_capacity) {
+        BatchJob *jobs = realloc(ctx->jobs, sizeof(BatchJob) * files->count);
+        if (!jobs) return;
+        ctx->jobs = jobs;
+        ctx->job_capacity = files->count;
+    }
+    if (!generate_output_paths(ctx)) return;
 
-    ctx->state = STATE_CONVERTING;
     ctx->converted_count = 0;
     ctx->failed_count = 0;
+    ctx->cancelled_count = 0;
+    ctx->skipped_count = 0;
+    ctx->reused_count = 0;
+    ctx->duplicate_count = 0;
     ctx->total_input_size = 0;
     ctx->total_output_size = 0;
 
-    for (int i = 0; i < ctx->file_count; i++) {
-        FileEntry *entry = &ctx->files[i];
-        entry->output_size = 0;
+    for (int i = 0; i < files->count; i++) {
+        files->output_sizes[i] = 0;
+        files->status[i] = FILE_PENDING;
 
-        snprintf(ctx->status_message, sizeof(ctx->status_message),
-                str(STR_CONVERTING), i + 1, ctx->file_count, entry->filename);
+        ctx->jobs[i].input_path = files->input_paths[i];
+        ctx->jobs[i].output_path = files->output_paths[i];
+    }
 
-        /* Load image */
-        ImageData img;
-        if (!converter_load_image(entry->input_path, &img)) {
-            entry->failed = true;
-            ctx->failed_count++;
-            continue;
+    /* The manifest sits in the output folder, or above the sources */
+    if (ctx->incremental) {
+        char path[1024];
+        const char *output_dir = (ctx->use_same_dir || !ctx->output_dir[0]) ? NULL : ctx->output_dir;
+        if (manifest_default_path(output_dir, files->output_paths, files->count,
+                                  path, sizeof(path))) {
+            ctx->manifest = manifest_load(path);
         }
+    }
+    batch_set_manifest(ctx->engine, ctx->manifest);
+    batch_set_dedupe(ctx->engine, ctx->incremental);
+
+    if (!batch_start(ctx->engine, ctx->jobs, files->count, &ctx->params)) {
+        manifest_free(ctx->manifest);
+        ctx->manifest = NULL;
+        return;
+    }
+    ctx->job_count = files->count;
+    ctx->batch_params = ctx->params;
+
+    ctx->state = STATE_CONVERTING;
+    snprintf(ctx->last_filename, sizeof(ctx->last_filename), "%s", files->names[0]);
+    snprintf(ctx->status_message, sizeof(ctx->status_message),
+            str(STR_CONVERTING), 0, files->count, ctx->last_filename);
+}
 
-        /* Convert */
-        ConversionResult result = converter_to_webp(&img, entry->output_path, &ctx->params);
-        converter_free_image(&img);
+void ui_cancel_conversion(UIContext *ctx) {
+    if (ctx->state == STATE_CONVERTING) batch_cancel(ctx->engine);
+}
+
+void ui_poll_conversion(UIContext *ctx) {
+    if (ctx->state != STATE_CONVERTING) return;
+
+    int index;
+    while (batch_poll(ctx->engine, &index)) {
+        FileTable *files = &ctx->files;
+        const BatchJob *job = &ctx->jobs[index];
 
-        if (result.success) {
-            entry->converted = true;
-            entry->output_size = result.output_size;
+        if (job->result.success) {
+            files->status[index] = FILE_CONVERTED;
+            files->output_sizes[index] = job->result.output_size;
             ctx->converted_count++;
-            ctx->total_input_size += entry->file_size;
-            ctx->total_output_size += result.output_size;
+            ctx->total_input_size += files->file_sizes[index];
+            ctx->total_output_size += job->result.output_size;
+            if (job->reuse == BATCH_SKIPPED) ctx->skipped_count++;
+            else if (job->reuse == BATCH_REUSED) ctx->reused_count++;
+            else if (job->reuse == BATCH_DUPLICATE) ctx->duplicate_count++;
+        } else if (job->result.cancelled) {
+            ctx->cancelled_count++;
         } else {
-            entry->failed = true;
+            files->status[index] = FILE_FAILED;
             ctx->failed_count++;
         }
+        ctx->last_result = job->result;
+        snprintf(ctx->last_filename, sizeof(ctx->last_filename), "%s", files->names[index]);
+    }
+
+    if (batch_is_running(ctx->engine)) {
+        /* Files done so far, then the share of the batch and time left */
+        int done = ctx->converted_count + ctx->failed_count + ctx->cancelled_count;
+        int n = snprintf(ctx->status_message, sizeof(ctx->status_message),
+                         str(STR_CONVERTING), done, ctx->files.count, ctx->last_filename);
+        BatchProgress progress;
+        if (batch_progress(ctx->engine, &progress) && progress.eta_seconds >= 0 &&
+            n > 0 && (size_t)n < sizeof(ctx->status_message)) {
+            char left[64];
+            snprintf(left, sizeof(left), str(STR_TIME_LEFT),
+                     (int)(progress.fraction * 100.0f), format_duration(progress.eta_seconds));
+            snprintf(ctx->status_message + n, sizeof(ctx->status_message) - n, "  -  %s", left);
+        }
+        return;
+    }
+
+    /* Whatever was built, even by a cancelled batch, is remembered */
+    if (ctx->manifest) {
+        batch_record_manifest(ctx->engine, ctx->manifest);
+        manifest_save(ctx->manifest);
+        manifest_free(ctx->manifest);
+        ctx->manifest = NULL;
+    }
+
+    if (ctx->cancelled_count > 0) {
+        /* Cancelled: no popup, the list shows what was converted */
+        ctx->state = STATE_LOADED;
+        snprintf(ctx->status_message, sizeof(ctx->status_message),
+                str(STR_CANCELLED), ctx->converted_count,
+                ctx->files.count - ctx->converted_count);
+        return;
     }
 
     /* Show completion popup */
@@ -279,6 +479,15 @@ void ui_handle_drop(UIContext *ctx, const char **filepaths, int count) {
 }
 
 void ui_update(UIContext *ctx) {
+    /* Pick up conversions finished by the workers */
+    ui_poll_conversion(ctx);
+
+    /* Settings moved: the estimate in progress is stale */
+    if (!converter_params_equal(&ctx->estimated_params, &ctx->params)) {
+        ctx->estimated_params = ctx->params;
+        estimator_set_params(ctx->estimator, &ctx->params);
+    }
+
     /* Handle file drop */
     if (IsFileDropped()) {
         FilePathList dropped = LoadDroppedFiles();
@@ -335,18 +544,64 @@ static void draw_file_list(UIContext *ctx) {
     DrawText(str(STR_FILES), 10, 8, 12, COLOR_TEXT_DIM);
 
     /* File count */
+    const FileTable *files = &ctx->files;
     char count_text[32];
     snprintf(count_text, sizeof(count_text), "%d %s%s",
-            ctx->file_count, str(STR_FILE), ctx->file_count != 1 ? "s" : "");
+            files->count, str(STR_FILE), files->count != 1 ? "s" : "");
     DrawText(count_text, panel.width - 80, 8, 12, COLOR_TEXT_DIM);
 
-    /* File list */
+    /* Only the visible rows are drawn, so the cost does not grow with the list */
     int y = 30;
     int visible_items = (file_list_height - 35) / FILE_LIST_ITEM_HEIGHT;
+    int max_offset = files->count - visible_items;
+    if (max_offset < 0) max_offset = 0;
+    bool scrollable = max_offset > 0;
+    float list_width = panel.width - 10 - (scrollable ? FILE_LIST_SCROLLBAR_WIDTH + 4 : 0);
+
+    /* Scroll with the mouse wheel over the list, a page per notch on long lists */
+    Vector2 mouse = GetMousePosition();
+    if (CheckCollisionPointRec(mouse, panel)) {
+        float wheel = GetMouseWheelMove();
+        if (wheel != 0) {
+            int step = (files->count > 1000) ? visible_items : 1;
+            ctx->scroll_offset -= (int)wheel * step;
+        }
+    }
+
+    /* Scrollbar: the thumb can be dragged and clicking the track jumps there */
+    if (scrollable) {
+        Rectangle track = {
+            panel.width - 5 - FILE_LIST_SCROLLBAR_WIDTH, y,
+            FILE_LIST_SCROLLBAR_WIDTH, visible_items * FILE_LIST_ITEM_HEIGHT - 2
+        };
+        float thumb_h = track.height * visible_items / files->count;
+        if (thumb_h < 16) thumb_h = 16;
+
+        if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && CheckCollisionPointRec(mouse, track)) {
+            ctx->dragging_scrollbar = true;
+        }
+        if (!IsMouseButtonDown(MOUSE_LEFT_BUTTON)) ctx->dragging_scrollbar = false;
+        if (ctx->dragging_scrollbar) {
+            float t = (mouse.y - track.y - thumb_h / 2) / (track.height - thumb_h);
+            if (t < 0) t = 0;
+            if (t > 1) t = 1;
+            ctx->scroll_offset = (int)(t * max_offset + 0.5f);
+        }
+
+        if (ctx->scroll_offset < 0) ctx->scroll_offset = 0;
+        if (ctx->scroll_offset > max_offset) ctx->scroll_offset = max_offset;
+        float thumb_y = track.y + (track.height - thumb_h) * ctx->scroll_offset / max_offset;
+        DrawRectangleRec(track, COLOR_PANEL);
+        DrawRectangleRec((Rectangle){ track.x, thumb_y, track.width, thumb_h },
+                         ctx->dragging_scrollbar ? COLOR_ACCENT : COLOR_TEXT_DIM);
+    }
+    if (ctx->scroll_offset < 0) ctx->scroll_offset = 0;
+    if (ctx->scroll_offset > max_offset) ctx->scroll_offset = max_offset;
 
-    for (int i = ctx->scroll_offset; i < ctx->file_count && i < ctx->scroll_offset + visible_items; i++) {
-        FileEntry *entry = &ctx->files[i];
-        Rectangle item_rect = { 5, y, panel.width - 10, FILE_LIST_ITEM_HEIGHT - 2 };
+    for (int i = ctx->scroll_offset; i < files->count && i < ctx->scroll_offset + visible_items; i++) {
+        Rectangle item_rect = { 5, y, list_width, FILE_LIST_ITEM_HEIGHT - 2 };
+        bool converted = files->status[i] == FILE_CONVERTED;
+        bool failed = files->status[i] == FILE_FAILED;
 
         /* Highlight selected */
         if (i == ctx->current_file) {
@@ -354,36 +609,48 @@ static void draw_file_list(UIContext *ctx) {
         }
 
         /* Click to select */
-        if (CheckCollisionPointRec(GetMousePosition(), item_rect) && IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+        if (!ctx->dragging_scrollbar && CheckCollisionPointRec(mouse, item_rect) &&
+            IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
             ui_load_preview(ctx, i);
         }
 
         /* Status indicator */
         Color status_color = COLOR_TEXT_DIM;
-        if (entry->converted) status_color = COLOR_SUCCESS;
-        else if (entry->failed) status_color = COLOR_ERROR;
+        if (converted) status_color = COLOR_SUCCESS;
+        else if (failed) status_color = COLOR_ERROR;
         DrawCircle(15, y + FILE_LIST_ITEM_HEIGHT/2, 4, status_color);
 
         /* Filename */
-        DrawText(entry->filename, 28, y + 4, 14, COLOR_TEXT);
+        DrawText(files->names[i], 28, y + 4, 14, COLOR_TEXT);
 
         /* Size */
-        DrawText(format_size(entry->file_size), panel.width - 80, y + 4, 12, COLOR_TEXT_DIM);
-
-        y += FILE_LIST_ITEM_HEIGHT;
-    }
+        float right = item_rect.x + list_width;
+        DrawText(format_size(files->file_sizes[i]), right - 75, y + 4, 12, COLOR_TEXT_DIM);
+
+        /* Encode progress of the files in flight */
+        float progress = (ctx->state == STATE_CONVERTING) ? batch_job_progress(ctx->engine, i) : 0.0f;
+        if (!converted && !failed && progress > 0.0f && progress < 1.0f) {
+            Rectangle bar = { right - 195, y + 8, 100, 8 };
+            DrawRectangleRec(bar, COLOR_PANEL);
+            DrawRectangle(bar.x, bar.y, (int)(bar.width * progress), bar.height, COLOR_ACCENT);
+        }
 
-    /* Scroll with mouse wheel when over file list */
-    Vector2 mouse = GetMousePosition();
-    if (CheckCollisionPointRec(mouse, panel)) {
-        float wheel = GetMouseWheelMove();
-        if (wheel != 0) {
-            ctx->scroll_offset -= (int)wheel;
-            if (ctx->scroll_offset < 0) ctx->scroll_offset = 0;
-            if (ctx->scroll_offset > ctx->file_count - visible_items)
-                ctx->scroll_offset = ctx->file_count - visible_items;
-            if (ctx->scroll_offset < 0) ctx->scroll_offset = 0;
+        /* Where the time went, and the encoder's PSNR for lossy output */
+        if (converted) {
+            const ConversionResult *result = &ctx->jobs[i].result;
+            const StageTimings *t = &result->timings;
+            char stages[160];
+            int n = snprintf(stages, sizeof(stages), str(STR_STAGE_TIMES),
+                             t->decode_ms, t->import_ms, t->encode_ms, t->write_ms);
+            float psnr = result->stats.psnr[3];
+            if (n > 0 && (size_t)n < sizeof(stages) && psnr > 0 && psnr < 99.0f) {
+                snprintf(stages + n, sizeof(stages) - n, "  PSNR %.1f dB", psnr);
+            }
+            int stages_w = MeasureText(stages, 12);
+            DrawText(stages, right - 95 - stages_w, y + 5, 12, COLOR_TEXT_DIM);
         }
+
+        y += FILE_LIST_ITEM_HEIGHT;
     }
 }
 
@@ -454,6 +721,18 @@ static void draw_preview_panel(UIContext *ctx) {
     }
 }
 
+/* Load a preset but keep the file size limit and best-of, which presets don't cover */
+static void apply_preset(UIContext *ctx, PresetType type) {
+    TargetMode target_mode = ctx->params.target_mode;
+    size_t target_size = ctx->params.target_size;
+    bool best_of = ctx->params.best_of;
+
+    presets_apply(type, &ctx->params);
+    ctx->params.target_mode = target_mode;
+    ctx->params.target_size = target_size;
+    ctx->params.best_of = best_of;
+}
+
 static void draw_sidebar(UIContext *ctx) {
     int sidebar_width = 320;
     int status_height = 40;
@@ -485,11 +764,15 @@ static void draw_sidebar(UIContext *ctx) {
     GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, ColorToInt(CLITERAL(Color){ 70, 70, 75, 255 }));
     y += 35;
 
-    /* Add Files / Clear buttons */
-    if (GuiButton((Rectangle){ x, y, w/2 - 5, 35 }, str(STR_ADD_FILES))) {
+    /* Add Files / Add Folder / Clear buttons */
+    float button_w = (w - 20) / 3.0f;
+    if (GuiButton((Rectangle){ x, y, button_w, 35 }, str(STR_ADD_FILES))) {
         open_file_dialog(ctx);
     }
-    if (GuiButton((Rectangle){ x + w/2 + 5, y, w/2 - 5, 35 }, str(STR_CLEAR_ALL))) {
+    if (GuiButton((Rectangle){ x + button_w + 10, y, button_w, 35 }, str(STR_ADD_FOLDER))) {
+        open_folder_dialog(ctx);
+    }
+    if (GuiButton((Rectangle){ x + 2 * (button_w + 10), y, button_w, 35 }, str(STR_CLEAR_ALL))) {
         ui_clear_files(ctx);
     }
     y += 45;
@@ -524,13 +807,32 @@ static void draw_sidebar(UIContext *ctx) {
     }
     y += 28;
 
+    /* Toggle: skip files converted before with the same settings */
+    {
+        Rectangle cb = { x, y, 20, 20 };
+        bool checked = ctx->incremental;
+        DrawRectangleRec(cb, checked ? COLOR_SUCCESS : CLITERAL(Color){ 60, 60, 65, 255 });
+        DrawRectangleLinesEx(cb, 1, checked ? COLOR_SUCCESS : COLOR_TEXT_DIM);
+        if (checked) {
+            DrawLine(x + 4, y + 10, x + 8, y + 15, WHITE);
+            DrawLine(x + 8, y + 15, x + 16, y + 5, WHITE);
+            DrawLine(x + 4, y + 11, x + 8, y + 16, WHITE);
+            DrawLine(x + 8, y + 16, x + 16, y + 6, WHITE);
+        }
+        DrawText(str(STR_SKIP_UNCHANGED), x + 28, y + 3, 14, COLOR_TEXT);
+        if (CheckCollisionPointRec(GetMousePosition(), (Rectangle){ x, y, 200, 20 }) &&
+            IsMouseButtonPressed(MOUSE_LEFT_BUTTON) && ctx->state != STATE_CONVERTING) {
+            ctx->incremental = !ctx->incremental;
+        }
+    }
+    y += 28;
+
     /* Show current output folder or change button */
     if (!ctx->use_same_dir) {
         if (GuiButton((Rectangle){ x, y, w, 28 }, ctx->output_dir[0] ? str(STR_CHANGE_FOLDER) : str(STR_SELECT_FOLDER))) {
             const char *folder = tinyfd_selectFolderDialog("Select Output Folder", "");
             if (folder) {
                 strncpy(ctx->output_dir, folder, sizeof(ctx->output_dir) - 1);
-                generate_output_paths(ctx);
             }
         }
         y += 32;
@@ -548,10 +850,6 @@ static void draw_sidebar(UIContext *ctx) {
             y += 18;
         }
     } else {
-        /* Regenerate paths if switched back to same dir */
-        if (ctx->file_count > 0) {
-            generate_output_paths(ctx);
-        }
         y += 5;
     }
 
@@ -579,16 +877,16 @@ static void draw_sidebar(UIContext *ctx) {
 
         if (GuiButton((Rectangle){ bx, by, btn_w, 30 }, preset_names[i])) {
             ctx->selected_preset = i;
-            presets_apply(i, &ctx->params);
+            apply_preset(ctx, i);
         }
     }
     y += 80;
 
     /* Use-case presets */
-    const char *use_case_names[] = { str(STR_WEB), str(STR_PHOTO), str(STR_THUMB) };
-    for (int i = 0; i < 3; i++) {
-        int bx = x + i * (w / 3 + 3);
-        int bw = w / 3 - 5;
+    const char *use_case_names[] = { str(STR_WEB), str(STR_PHOTO), str(STR_THUMB), str(STR_AUTO) };
+    for (int i = 0; i < 4; i++) {
+        int bx = x + i * (w / 4 + 2);
+        int bw = w / 4 - 5;
         bool selected = (ctx->selected_preset == PRESET_WEB + i);
 
         if (selected) {
@@ -599,7 +897,7 @@ static void draw_sidebar(UIContext *ctx) {
 
         if (GuiButton((Rectangle){ bx, y, bw, 30 }, use_case_names[i])) {
             ctx->selected_preset = PRESET_WEB + i;
-            presets_apply(PRESET_WEB + i, &ctx->params);
+            apply_preset(ctx, PRESET_WEB + i);
         }
     }
     y += 50;
@@ -688,69 +986,136 @@ static void draw_sidebar(UIContext *ctx) {
         GuiSlider((Rectangle){ x, y, w, 20 }, NULL, NULL, &filter_f, 0, 100);
         ctx->params.filter_strength = (int)filter_f;
         y += 30;
+
+        /* Best-of toggle - custom checkbox */
+        {
+            Rectangle cb = { x, y, 20, 20 };
+            bool checked = ctx->params.best_of;
+            DrawRectangleRec(cb, checked ? COLOR_SUCCESS : CLITERAL(Color){ 60, 60, 65, 255 });
+            DrawRectangleLinesEx(cb, 1, checked ? COLOR_SUCCESS : COLOR_TEXT_DIM);
+            if (checked) {
+                DrawLine(x + 4, y + 10, x + 8, y + 15, WHITE);
+                DrawLine(x + 8, y + 15, x + 16, y + 5, WHITE);
+                DrawLine(x + 4, y + 11, x + 8, y + 16, WHITE);
+                DrawLine(x + 8, y + 16, x + 16, y + 6, WHITE);
+            }
+            DrawText(str(STR_BEST_OF), x + 28, y + 3, 14, COLOR_TEXT);
+            if (CheckCollisionPointRec(GetMousePosition(), (Rectangle){ x, y, w, 20 }) &&
+                IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+                ctx->params.best_of = !ctx->params.best_of;
+            }
+        }
+        y += 30;
+
+        /* File size limit - custom checkbox */
+        {
+            Rectangle cb = { x, y, 20, 20 };
+            bool checked = (ctx->params.target_mode == TARGET_SIZE);
+            DrawRectangleRec(cb, checked ? COLOR_SUCCESS : CLITERAL(Color){ 60, 60, 65, 255 });
+            DrawRectangleLinesEx(cb, 1, checked ? COLOR_SUCCESS : COLOR_TEXT_DIM);
+            if (checked) {
+                DrawLine(x + 4, y + 10, x + 8, y + 15, WHITE);
+                DrawLine(x + 8, y + 15, x + 16, y + 5, WHITE);
+                DrawLine(x + 4, y + 11, x + 8, y + 16, WHITE);
+                DrawLine(x + 8, y + 16, x + 16, y + 6, WHITE);
+            }
+            DrawText(str(STR_LIMIT_FILE_SIZE), x + 28, y + 3, 14, COLOR_TEXT);
+            if (checked) {
+                const char *target_text = format_size(ctx->params.target_size);
+                DrawText(target_text, x + w - MeasureText(target_text, 14), y + 3, 14, COLOR_TEXT);
+            }
+            if (CheckCollisionPointRec(GetMousePosition(), (Rectangle){ x, y, 200, 20 }) &&
+                IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+                ctx->params.target_mode = checked ? TARGET_QUALITY : TARGET_SIZE;
+                if (ctx->params.target_size == 0) {
+                    ctx->params.target_size = 200 * 1024;
+                }
+            }
+        }
+        y += 30;
+
+        if (ctx->params.target_mode == TARGET_SIZE) {
+            /* Per-file budget in KB; quality is searched to fit it */
+            float target_kb = (float)(ctx->params.target_size / 1024);
+            GuiSlider((Rectangle){ x, y, w, 20 }, NULL, NULL, &target_kb, 10, 2000);
+            ctx->params.target_size = (size_t)target_kb * 1024;
+            y += 30;
+        }
     }
 
     /* Spacer to push convert button to bottom */
     y = ctx->window_height - status_height - 95;
 
     /* Estimate section */
-    if (ctx->file_count > 0) {
-        /* Calculate total estimate */
-        size_t total_input = 0;
-        size_t total_estimate = 0;
-        for (int i = 0; i < ctx->file_count; i++) {
-            total_input += ctx->files[i].file_size;
-            /* Estimate based on image dimensions */
-            if (ctx->has_preview && i == ctx->current_file) {
-                total_estimate += converter_estimate_size(&ctx->image, &ctx->params);
-            } else {
-                /* Rough estimate based on file size */
-                /* Assume raw pixels ~3x compressed file size, then apply WebP ratio */
-                size_t approx_raw = ctx->files[i].file_size * 3;
-                float qf = ctx->params.quality / 100.0f;
-                float ratio = ctx->params.lossless ? 0.3f : (0.001f + qf * qf * 0.025f);
-                total_estimate += (size_t)(approx_raw * ratio);
-            }
-        }
+    if (ctx->files.count > 0) {
+        size_t total_input = ctx->files.total_size;
 
-        /* Show input size -> estimated output */
-        char input_str[32], est_str[32];
+        char input_str[32], est_str[32], high_str[32];
         snprintf(input_str, sizeof(input_str), "%s", format_size(total_input));
-        snprintf(est_str, sizeof(est_str), "%s", format_size(total_estimate));
 
         char estimate_text[128];
-        snprintf(estimate_text, sizeof(estimate_text), str(STR_ESTIMATE), input_str, est_str);
+        BatchEstimate estimate;
+        if (ctx->params.target_mode == TARGET_SIZE) {
+            /* Every output is at most the budget */
+            snprintf(est_str, sizeof(est_str), "%s",
+                     format_size(ctx->params.target_size * ctx->files.count));
+            snprintf(estimate_text, sizeof(estimate_text), str(STR_ESTIMATE), input_str, est_str);
+        } else if (estimator_get(ctx->estimator, &estimate)) {
+            /* Trial-encoded estimate, as its 95% interval unless that is tight */
+            if (estimate.high - estimate.low <= estimate.bytes / 50) {
+                snprintf(est_str, sizeof(est_str), "%s", format_size(estimate.bytes));
+                snprintf(estimate_text, sizeof(estimate_text), str(STR_ESTIMATE),
+                         input_str, est_str);
+            } else {
+                snprintf(est_str, sizeof(est_str), "%s", format_size(estimate.low));
+                snprintf(high_str, sizeof(high_str), "%s", format_size(estimate.high));
+                snprintf(estimate_text, sizeof(estimate_text), str(STR_ESTIMATE_RANGE),
+                         input_str, est_str, high_str);
+            }
+        } else {
+            snprintf(estimate_text, sizeof(estimate_text), str(STR_ESTIMATING), input_str);
+        }
         DrawText(estimate_text, x, y, 14, COLOR_TEXT_DIM);
         y += 20;
 
         /* File count */
         char info_text[64];
-        if (ctx->file_count == 1) {
+        if (ctx->files.count == 1) {
             snprintf(info_text, sizeof(info_text), "%s", str(STR_FILE_SELECTED));
         } else {
-            snprintf(info_text, sizeof(info_text), str(STR_FILES_SELECTED), ctx->file_count);
+            snprintf(info_text, sizeof(info_text), str(STR_FILES_SELECTED), ctx->files.count);
         }
         DrawText(info_text, x, y, 12, COLOR_TEXT_DIM);
     }
     y += 25;
 
     /* Convert button */
-    bool can_convert = (ctx->file_count > 0 && ctx->state != STATE_CONVERTING);
-    if (can_convert) {
+    /* Turns into Cancel while a batch runs */
+    bool converting = (ctx->state == STATE_CONVERTING);
+    bool can_convert = (ctx->files.count > 0 && !converting);
+    if (converting) {
+        GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, ColorToInt(COLOR_ERROR));
+    } else if (can_convert) {
         GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, ColorToInt(COLOR_SUCCESS));
     } else {
         GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, ColorToInt(CLITERAL(Color){ 60, 60, 65, 255 }));
     }
 
     char convert_text[64];
-    if (ctx->file_count > 1) {
-        snprintf(convert_text, sizeof(convert_text), str(STR_CONVERT_FILES), ctx->file_count);
+    if (converting) {
+        snprintf(convert_text, sizeof(convert_text), "%s", str(STR_CANCEL));
+    } else if (ctx->files.count > 1) {
+        snprintf(convert_text, sizeof(convert_text), str(STR_CONVERT_FILES), ctx->files.count);
     } else {
         strncpy(convert_text, str(STR_CONVERT_TO_WEBP), sizeof(convert_text) - 1);
     }
 
-    if (GuiButton((Rectangle){ x, y, w, 40 }, convert_text) && can_convert) {
-        ui_start_conversion(ctx);
+    if (GuiButton((Rectangle){ x, y, w, 40 }, convert_text)) {
+        if (converting) {
+            ui_cancel_conversion(ctx);
+        } else if (can_convert) {
+            ui_start_conversion(ctx);
+        }
     }
 
     GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, ColorToInt(CLITERAL(Color){ 70, 70, 75, 255 }));
@@ -762,7 +1127,7 @@ static void draw_popup(UIContext *ctx) {
 
     /* Popup box */
     int popup_w = 400;
-    int popup_h = 200;
+    int popup_h = 230;
     int popup_x = (ctx->window_width - popup_w) / 2;
     int popup_y = (ctx->window_height - popup_h) / 2;
 
@@ -777,7 +1142,7 @@ static void draw_popup(UIContext *ctx) {
     /* Results */
     char results[128];
     snprintf(results, sizeof(results), str(STR_FILES_CONVERTED),
-            ctx->converted_count, ctx->file_count);
+            ctx->converted_count, ctx->files.count);
     int results_w = MeasureText(results, 16);
     DrawText(results, popup_x + (popup_w - results_w) / 2, popup_y + 60, 16, COLOR_TEXT);
 
@@ -808,9 +1173,25 @@ static void draw_popup(UIContext *ctx) {
         DrawText(failed, popup_x + (popup_w - failed_w) / 2, popup_y + 140, 14, COLOR_ERROR);
     }
 
-    /* OK button */
+    /* Files encoded, and those the manifest or deduplication settled */
+    int settled = ctx->skipped_count + ctx->reused_count + ctx->duplicate_count;
+    if (settled > 0) {
+        char reused[96];
+        snprintf(reused, sizeof(reused), str(STR_FILES_REUSED),
+                 ctx->converted_count - settled, ctx->skipped_count,
+                 ctx->reused_count, ctx->duplicate_count);
+        int reused_w = MeasureText(reused, 14);
+        DrawText(reused, popup_x + (popup_w - reused_w) / 2,
+                 popup_y + (ctx->failed_count > 0 ? 160 : 140), 14, COLOR_TEXT_DIM);
+    }
+
+    /* Report and OK buttons */
+    if (GuiButton((Rectangle){ popup_x + popup_w/2 - 170, popup_y + popup_h - 50, 200, 35 },
+                  str(STR_SAVE_REPORT))) {
+        save_report_dialog(ctx);
+    }
     GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, ColorToInt(COLOR_ACCENT));
-    if (GuiButton((Rectangle){ popup_x + popup_w/2 - 60, popup_y + popup_h - 50, 120, 35 }, str(STR_OK))) {
+    if (GuiButton((Rectangle){ popup_x + popup_w/2 + 50, popup_y + popup_h - 50, 120, 35 }, str(STR_OK))) {
         ctx->show_popup = false;
     }
     GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, ColorToInt(CLITERAL(Color){ 70, 70, 75, 255 }));
@@ -861,6 +1242,13 @@ static void draw_status_bar(UIContext *ctx) {
     }
 
     DrawRectangleRec(status_bar, bar_color);
+
+    /* Batch progress along the top edge */
+    BatchProgress progress;
+    if (ctx->state == STATE_CONVERTING && batch_progress(ctx->engine, &progress)) {
+        DrawRectangle(0, status_bar.y, (int)(status_bar.width * progress.fraction), 3, COLOR_ACCENT);
+    }
+
     DrawText(ctx->status_message, 15, status_bar.y + 12, 16, text_color);
 
     /* Draw PIR logo in bottom right */
@@ -873,6 +1261,22 @@ static void draw_status_bar(UIContext *ctx) {
                   logo_scale, logo_color);
 }
 
+/* "45s", "3m 05s" or "2h 10m" */
+static const char* format_duration(double seconds) {
+    static char buffer[32];
+    long total = (long)(seconds + 0.5);
+
+    if (total < 60) {
+        snprintf(buffer, sizeof(buffer), "%lds", total);
+    } else if (total < 3600) {
+        snprintf(buffer, sizeof(buffer), "%ldm %02lds", total / 60, total % 60);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%ldh %02ldm", total / 3600, (total % 3600) / 60);
+    }
+
+    return buffer;
+}
+
 static const char* format_size(size_t bytes) {
     static char buffer[32];
 
@@ -8,10 +8,11 @@
 
 #include "converter.h"
 #include "presets.h"
+#include "batch.h"
+#include "estimator.h"
+#include "filetable.h"
 #include <raylib.h>
 
-#define MAX_FILES 100
-
 /* Application state */
 typedef enum {
     STATE_IDLE,         /* No image loaded */
@@ -21,17 +22,6 @@ typedef enum {
     STATE_ERROR         /* Error occurred */
 } AppState;
 
-/* File entry for batch processing */
-typedef struct {
-    char input_path[512];
-    char output_path[512];
-    char filename[256];
-    size_t file_size;
-    size_t output_size;
-    bool converted;
-    bool failed;
-} FileEntry;
-
 /* UI context */
 typedef struct {
     /* Window */
@@ -43,8 +33,7 @@ typedef struct {
     char status_message[256];
 
     /* Multiple files */
-    FileEntry files[MAX_FILES];
-    int file_count;
+    FileTable files;
     int current_file;       /* Currently previewed file */
 
     /* Preview */
@@ -60,10 +49,28 @@ typedef struct {
     char output_dir[512];
     bool use_same_dir;      /* Save in same directory as source */
 
+    /* Background conversion (jobs[i] belongs to file i) */
+    BatchEngine *engine;
+    BatchJob *jobs;
+    int job_count;          /* Files in the last batch */
+    int job_capacity;
+    ConversionParams batch_params;  /* Params of the last batch, for its report */
+    bool incremental;       /* Skip files whose output is up to date */
+    Manifest *manifest;     /* Of the running batch, when incremental */
+
+    /* Sidebar size estimate, rerun when the files or estimated_params change */
+    Estimator *estimator;
+    ConversionParams estimated_params;
+
     /* Results */
     ConversionResult last_result;
     int converted_count;
     int failed_count;
+    int cancelled_count;
+    int skipped_count;      /* Output already up to date */
+    int reused_count;       /* Linked or copied from an earlier batch's output */
+    int duplicate_count;    /* Sharing the encode of an identical input in the batch */
+    char last_filename[256];    /* Last file finished, for the status line */
     size_t total_input_size;
     size_t total_output_size;
 
@@ -74,6 +81,7 @@ typedef struct {
     bool show_popup;        /* Show completion popup */
     bool dragging_preview;
     int scroll_offset;      /* For file list scrolling */
+    bool dragging_scrollbar;
 
     /* Drag and drop */
     bool waiting_for_drop;
@@ -97,9 +105,15 @@ void ui_add_files(UIContext *ctx, const char **filepaths, int count);
 /* Load image for preview */
 bool ui_load_preview(UIContext *ctx, int file_index);
 
-/* Start conversion of all files */
+/* Start conversion of all files on the worker threads */
 void ui_start_conversion(UIContext *ctx);
 
+/* Stop the running conversion; finished files are kept */
+void ui_cancel_conversion(UIContext *ctx);
+
+/* Apply finished conversions to the file list (called every frame) */
+void ui_poll_conversion(UIContext *ctx);
+
 /* Clear all files */
 void ui_clear_files(UIContext *ctx);
 
@@ -0,0 +1,19 @@
+/*
+ * WebP Converter - Small shared helpers
+ * Hashing and text output used by several modules.
+ */
+
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* 32-bit FNV-1a of size bytes, for the path hash tables */
+uint32_t util_hash_fnv1a(const void *data, size_t size);
+
+/* Write text as a JSON string literal, escaping quotes, backslashes and control bytes */
+void util_write_json_string(FILE *out, const char *text);
+
+#endif /* UTIL_H */